@@ -77,12 +77,15 @@ void setup() {
   // Reset discovered fans list
   SmartMiFanAsync_resetDiscoveredFans();
   
+  // One token per fan: finish as soon as every token has found its fan
+  SmartMiFanAsync_setExpectAllTokens(true);
+  
   // Start async discovery (non-blocking)
   LOGI_F("Starting async discovery...");
   if (SmartMiFanAsync_startDiscovery(fanUdp, TOKENS, TOKEN_COUNT, 5000)) {
     discoveryStarted = true;
     LOGI_F("Discovery started successfully");
-    LOGI_F("Discovery will run for 5 seconds");
+    LOGI_F("Discovery runs up to 5 seconds (ends early once all fans are found)");
   } else {
     LOGE_F("Failed to start discovery");
   }
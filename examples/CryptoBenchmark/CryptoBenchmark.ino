@@ -0,0 +1,127 @@
+/**
+ * @file CryptoBenchmark.ino
+ * @brief Microbenchmark: per-command AES cost with and without cached key schedules
+ *
+ * Measures the crypto part of one set_properties command (encrypt request,
+ * decrypt reply) the way the library did it before and does it now:
+ * - Per packet: mbedtls_aes_init + setkey + 16-byte CBC loop + free
+ * - Cached:     key schedules expanded once, one CBC call over the payload
+ *
+ * No WiFi or fans needed. Results are printed as microseconds per command:
+ * [Bench] encrypt per-packet=<us> cached=<us>
+ *
+ * Hardware: ESP32
+ *
+ * Required libraries:
+ * - mbedtls (ESP32 Arduino Core)
+ *
+ * Usage:
+ * 1. Upload to ESP32
+ * 2. Open Serial Monitor at 115200 baud
+ */
+
+#include <Arduino.h>
+#include "mbedtls/aes.h"
+
+// ------ Benchmark Configuration ------
+const uint32_t ITERATIONS = 2000;
+// -------------------------------------
+
+// Typical request: {"id":123,"method":"set_properties","params":[{"siid":2,"piid":1,"value":true}]}
+// 84 bytes + 0x00 + PKCS7 padding = 96 bytes of cipher text
+const size_t PAYLOAD_LEN = 96;
+
+uint8_t key[16];
+uint8_t iv0[16];
+uint8_t plain[PAYLOAD_LEN];
+uint8_t cipher[PAYLOAD_LEN];
+uint8_t output[PAYLOAD_LEN];
+
+mbedtls_aes_context cachedEnc;
+mbedtls_aes_context cachedDec;
+
+// Before: schedule expanded on every packet, CBC called per 16-byte block
+void encryptPerPacket() {
+  mbedtls_aes_context aes;
+  mbedtls_aes_init(&aes);
+  mbedtls_aes_setkey_enc(&aes, key, 128);
+  uint8_t iv[16];
+  memcpy(iv, iv0, sizeof(iv));
+  memcpy(output, plain, PAYLOAD_LEN);
+  for (size_t off = 0; off < PAYLOAD_LEN; off += 16) {
+    mbedtls_aes_crypt_cbc(&aes, MBEDTLS_AES_ENCRYPT, 16, iv, output + off, output + off);
+  }
+  mbedtls_aes_free(&aes);
+}
+
+void decryptPerPacket() {
+  mbedtls_aes_context aes;
+  mbedtls_aes_init(&aes);
+  mbedtls_aes_setkey_dec(&aes, key, 128);
+  uint8_t iv[16];
+  memcpy(iv, iv0, sizeof(iv));
+  mbedtls_aes_crypt_cbc(&aes, MBEDTLS_AES_DECRYPT, PAYLOAD_LEN, iv, cipher, output);
+  mbedtls_aes_free(&aes);
+}
+
+// After: schedules kept per key, one CBC call over the whole payload
+void encryptCached() {
+  uint8_t iv[16];
+  memcpy(iv, iv0, sizeof(iv));
+  mbedtls_aes_crypt_cbc(&cachedEnc, MBEDTLS_AES_ENCRYPT, PAYLOAD_LEN, iv, plain, output);
+}
+
+void decryptCached() {
+  uint8_t iv[16];
+  memcpy(iv, iv0, sizeof(iv));
+  mbedtls_aes_crypt_cbc(&cachedDec, MBEDTLS_AES_DECRYPT, PAYLOAD_LEN, iv, cipher, output);
+}
+
+float measureUs(void (*fn)()) {
+  uint32_t start = micros();
+  for (uint32_t i = 0; i < ITERATIONS; ++i) {
+    fn();
+  }
+  return (micros() - start) / static_cast<float>(ITERATIONS);
+}
+
+void setup() {
+  Serial.begin(115200);
+  delay(1000);
+
+  for (size_t i = 0; i < sizeof(key); ++i) {
+    key[i] = static_cast<uint8_t>(i * 7 + 1);
+    iv0[i] = static_cast<uint8_t>(i * 13 + 5);
+  }
+  for (size_t i = 0; i < PAYLOAD_LEN; ++i) {
+    plain[i] = static_cast<uint8_t>('a' + (i % 26));
+  }
+
+  mbedtls_aes_init(&cachedEnc);
+  mbedtls_aes_init(&cachedDec);
+  mbedtls_aes_setkey_enc(&cachedEnc, key, 128);
+  mbedtls_aes_setkey_dec(&cachedDec, key, 128);
+
+  encryptCached();
+  memcpy(cipher, output, PAYLOAD_LEN);
+
+  // Sanity check: both paths must produce identical cipher text
+  encryptPerPacket();
+  if (memcmp(cipher, output, PAYLOAD_LEN) != 0) {
+    Serial.println("[Bench] ERROR: per-packet and cached cipher text differ");
+  }
+}
+
+void loop() {
+  float encBefore = measureUs(encryptPerPacket);
+  float encAfter = measureUs(encryptCached);
+  float decBefore = measureUs(decryptPerPacket);
+  float decAfter = measureUs(decryptCached);
+
+  Serial.printf("[Bench] encrypt per-packet=%.1fus cached=%.1fus\n", encBefore, encAfter);
+  Serial.printf("[Bench] decrypt per-packet=%.1fus cached=%.1fus\n", decBefore, decAfter);
+  Serial.printf("[Bench] per command (enc+dec) per-packet=%.1fus cached=%.1fus\n",
+                encBefore + decBefore, encAfter + decAfter);
+
+  delay(5000);
+}
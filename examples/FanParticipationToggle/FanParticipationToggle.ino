@@ -246,6 +246,9 @@ void loop() {
       break;
   }
   
+  // Send coalesced orchestrated values once the cooldown ends (trailing edge)
+  SmartMiFanAsync_update();
+  
   delay(100);
 }
 
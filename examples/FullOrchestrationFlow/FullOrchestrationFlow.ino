@@ -271,6 +271,9 @@ void loop() {
     }
   }
   
+  // Send coalesced orchestrated values once the cooldown ends (trailing edge)
+  SmartMiFanAsync_update();
+  
   // Demonstrate fan participation toggle
   static bool fan1Disabled = false;
   if (!fan1Disabled && millis() > 15000 && millis() < 15100) {
@@ -102,11 +102,14 @@ void setup() {
   // Reset discovered fans list
   SmartMiFanAsync_resetDiscoveredFans();
   
+  // One token per fan: finish as soon as every token has found its fan
+  SmartMiFanAsync_setExpectAllTokens(true);
+  
   // Start async discovery
   LOGI_F("Starting async discovery...");
   if (SmartMiFanAsync_startDiscovery(fanUdp, TOKENS, TOKEN_COUNT, 5000)) {
     appState = AppState::DISCOVERING;
-    LOGI_F("Discovery started (5 second timeout)");
+    LOGI_F("Discovery started (up to 5 seconds, ends early once all fans are found)");
   } else {
     LOGE_F("Failed to start discovery");
     appState = AppState::IDLE;
@@ -208,6 +208,9 @@ void loop() {
     WebSocketHandler::updateTelemetry();
   }
   
+  // Send the last coalesced slider value once the cooldown ends (trailing edge)
+  SmartMiFanAsync_update();
+  
   // Clean up disconnected WebSocket clients
   WebSocketHandler::cleanup();
   
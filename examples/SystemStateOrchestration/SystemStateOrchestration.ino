@@ -217,6 +217,9 @@ void loop() {
     }
   }
   
+  // Send coalesced orchestrated values once the cooldown ends (trailing edge)
+  SmartMiFanAsync_update();
+  
   // Print system state periodically
   static unsigned long lastStatePrint = 0;
   if (millis() - lastStatePrint > 5000) {
@@ -941,6 +941,9 @@ void loop() {
     sendTelemetry();
   }
   
+  // Send the last coalesced slider value once the cooldown ends (trailing edge)
+  SmartMiFanAsync_update();
+  
   // Clean up disconnected WebSocket clients
   ws.cleanupClients();
   
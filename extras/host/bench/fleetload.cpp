@@ -0,0 +1,538 @@
+// =============================================================================
+// SmartMiFanAsync - Host Build: fleet load test
+// =============================================================================
+// Runs discovery (cold, from the knowledge cache and with early exit), Smart
+// Connect and orchestrated commands against a fleet of emulated fans on an
+// impaired link (loss, jitter, duplication, reordering) and prints one JSON
+// document with timings and correctness counters.
+//
+//   fleetload                       preset matrix (16 / 64 / 256 fans)
+//   fleetload --fans 128 --loss 10 --jitter 40 --dup 2 --reorder 5
+//   fleetload --quick --check       small lossy run, exit 1 on wrong results
+//
+// All times are virtual milliseconds (see docs/10_HOST_BUILD.md), so runs
+// are reproducible for a given --seed.
+// =============================================================================
+
+#include <SmartMiFanAsync.h>
+
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "MiioFanEmulator.h"
+#include "internal/SmartMiFanInternal.h"
+
+using namespace SmartMiFanInternal;
+
+namespace {
+
+// =========================
+// Configuration
+// =========================
+
+struct LoadConfig {
+  size_t fans = 16;             // emulated devices on the network
+  size_t managed = 16;          // devices whose tokens the library is given
+  HostLinkConfig link{2, 0, 0.0f, 0.0f, 0.0f, 0};
+  size_t commands = 40;         // orchestrated speed commands
+  unsigned long gapMs = 250;    // idle time between commands (> coalescing cooldown)
+  unsigned long discoveryMs = 3000;
+  unsigned stalePercent = 25;   // Fast Connect entries with an outdated IP
+  uint32_t seed = 1;
+};
+
+struct PhaseResult {
+  const char* state = "";
+  unsigned long durationMs = 0;
+  unsigned long budgetMs = 0;
+  size_t candidates = 0;
+  size_t found = 0;
+  size_t missed = 0;
+  size_t wrong = 0;
+};
+
+struct CommandStats {
+  size_t fanResults = 0;
+  size_t complete = 0;
+  size_t timeout = 0;
+  size_t error = 0;
+  size_t skipped = 0;        // discovered fans not addressed (not ACTIVE)
+  size_t wrong = 0;          // COMPLETE, but the device holds another value
+  size_t lostAck = 0;        // failed, but the device applied the value
+  size_t finalMismatch = 0;  // device state != library cache after draining the link
+  uint32_t lateReplies = 0;  // replies that arrived after their request ended
+  uint32_t retransmits = 0;  // hellos and requests resent after their RTO
+  std::vector<uint32_t> fanLatency;
+  std::vector<uint32_t> callLatency;
+};
+
+// =========================
+// Fleet
+// =========================
+
+std::vector<std::unique_ptr<MiioFanEmulator>> g_fleet;
+std::vector<std::string> g_tokenStrings;
+std::vector<const char*> g_managedTokens;
+std::vector<size_t> g_managedIndex;
+std::map<uint32_t, MiioFanEmulator*> g_byIp;
+
+IPAddress fleetIp(size_t i) {
+  return IPAddress(10, 0, static_cast<uint8_t>(i / 200), static_cast<uint8_t>(10 + i % 200));
+}
+
+uint32_t mix(uint32_t x) {
+  x ^= x >> 16;
+  x *= 0x7feb352d;
+  x ^= x >> 15;
+  x *= 0x846ca68b;
+  x ^= x >> 16;
+  return x;
+}
+
+void buildFleet(const LoadConfig& cfg) {
+  g_fleet.clear();
+  g_byIp.clear();
+  g_tokenStrings.clear();
+  g_managedTokens.clear();
+  g_managedIndex.clear();
+
+  for (size_t i = 0; i < cfg.fans; ++i) {
+    char token[33];
+    uint32_t base = cfg.seed * 7919u + static_cast<uint32_t>(i) * 4u;
+    snprintf(token, sizeof(token), "%08x%08x%08x%08x", mix(base + 1), mix(base + 2), mix(base + 3),
+             mix(base + 4));
+    g_tokenStrings.push_back(token);
+  }
+  for (size_t i = 0; i < cfg.fans; ++i) {
+    MiioFanEmulatorConfig fan{fleetIp(i), static_cast<uint32_t>(0x10000 + i), g_tokenStrings[i].c_str(),
+                              MiioFanEmulator::supportedModel(i), nullptr, nullptr};
+    g_fleet.emplace_back(new MiioFanEmulator(fan));
+    g_byIp[static_cast<uint32_t>(fleetIp(i))] = g_fleet.back().get();
+  }
+  // Managed fans are spread over the fleet, not just the first hello repliers
+  for (size_t m = 0; m < cfg.managed; ++m) {
+    size_t i = m * cfg.fans / cfg.managed;
+    g_managedIndex.push_back(i);
+    g_managedTokens.push_back(g_tokenStrings[i].c_str());
+  }
+}
+
+MiioFanEmulator* emulatorAt(const IPAddress& ip) {
+  auto it = g_byIp.find(static_cast<uint32_t>(ip));
+  return it == g_byIp.end() ? nullptr : it->second;
+}
+
+bool isManaged(const MiioFanEmulator* emu) {
+  for (size_t i : g_managedIndex) {
+    if (g_fleet[i].get() == emu) return true;
+  }
+  return false;
+}
+
+// Every registered fan must be a managed device with matching identity
+void scoreFanTable(PhaseResult& out, size_t expected) {
+  size_t count = 0;
+  const SmartMiFanDiscoveredDevice* fans = SmartMiFanAsync_getDiscoveredFans(count);
+  for (size_t i = 0; i < count; ++i) {
+    MiioFanEmulator* emu = emulatorAt(fans[i].ip);
+    bool ok = emu != nullptr && isManaged(emu) && fans[i].did == emu->did() &&
+              strcmp(fans[i].model, emu->model()) == 0 &&
+              memcmp(fans[i].tokenBytes, emu->token(), 16) == 0;
+    if (ok) {
+      ++out.found;
+    } else {
+      ++out.wrong;
+    }
+  }
+  out.missed = expected > out.found ? expected - out.found : 0;
+}
+
+const char* discoveryStateName(DiscoveryState state) {
+  switch (state) {
+    case DiscoveryState::COMPLETE: return "COMPLETE";
+    case DiscoveryState::TIMEOUT: return "TIMEOUT";
+    case DiscoveryState::ERROR: return "ERROR";
+    case DiscoveryState::IDLE: return "IDLE";
+    default: return "IN_PROGRESS";
+  }
+}
+
+unsigned long discoveryBudget(unsigned long discoveryMs) {
+  unsigned long minTimeout = discoveryMs * 3;
+  unsigned long budget = discoveryMs + g_discoveryContext.candidateCount * g_discoveryContext.tokenCount * 2500UL;
+  return budget < minTimeout ? minTimeout : budget;
+}
+
+void resetLibrary() {
+  SmartMiFanAsync_cancelSmartConnect();
+  SmartMiFanAsync_cancelQuery();
+  SmartMiFanAsync_clearFastConnectConfig();
+  SmartMiFanAsync_resetDiscoveredFans();
+  SmartMiFanAsync_clearDiscoveryCache();
+  SmartMiFanAsync_clearExpectedFans();
+  SmartMiFanAsync_resetRxStats();
+  SmartMiFanAsync_setFanOutCallback(nullptr);
+}
+
+// =========================
+// Phases
+// =========================
+
+PhaseResult runDiscovery(WiFiUDP& udp, const LoadConfig& cfg) {
+  PhaseResult out;
+  unsigned long start = millis();
+  SmartMiFanAsync_startDiscovery(udp, g_managedTokens.data(), g_managedTokens.size(), cfg.discoveryMs);
+  while (SmartMiFanAsync_updateDiscovery()) yield();
+  out.durationMs = millis() - start;
+  out.state = discoveryStateName(SmartMiFanAsync_getDiscoveryState());
+  out.candidates = g_discoveryContext.candidateCount;
+  out.budgetMs = discoveryBudget(cfg.discoveryMs);
+  scoreFanTable(out, g_managedIndex.size());
+  return out;
+}
+
+// Fast Connect holds at most kMaxFastConnectFans entries
+PhaseResult runSmartConnect(WiFiUDP& udp, const LoadConfig& cfg) {
+  std::vector<std::string> ips;
+  std::vector<SmartMiFanFastConnectEntry> entries;
+  size_t configured = std::min(g_managedIndex.size(), kMaxFastConnectFans);
+  for (size_t m = 0; m < configured; ++m) {
+    IPAddress ip = fleetIp(g_managedIndex[m]);
+    // Stale entries point at an address where nothing answers (fan got a new DHCP lease)
+    bool stale = (mix(cfg.seed + static_cast<uint32_t>(m)) % 100) < cfg.stalePercent;
+    char buf[16];
+    snprintf(buf, sizeof(buf), "%u.%u.%u.%u", 10u, 1u, static_cast<unsigned>(ip[2]),
+             static_cast<unsigned>(ip[3]));
+    if (!stale) snprintf(buf, sizeof(buf), "%u.%u.%u.%u", ip[0], ip[1], ip[2], ip[3]);
+    ips.push_back(buf);
+  }
+  for (size_t m = 0; m < configured; ++m) {
+    entries.push_back(SmartMiFanFastConnectEntry{ips[m].c_str(), g_managedTokens[m], nullptr});
+  }
+  SmartMiFanAsync_setFastConnectConfig(entries.data(), entries.size());
+  SmartMiFanAsync_setFastConnectEnabled(true);
+
+  PhaseResult out;
+  unsigned long start = millis();
+  SmartMiFanAsync_startSmartConnect(udp, cfg.discoveryMs);
+  while (SmartMiFanAsync_updateSmartConnect()) yield();
+  out.durationMs = millis() - start;
+  out.state = SmartMiFanAsync_isSmartConnectComplete() ? "COMPLETE" : "ERROR";
+  out.candidates = g_discoveryContext.candidateCount;
+  out.budgetMs = discoveryBudget(cfg.discoveryMs);
+  scoreFanTable(out, configured);
+  return out;
+}
+
+// Restores a snapshot taken after discovery and runs the first fan-out: the
+// duration covers what a warm boot costs until every fan has been validated
+PhaseResult runWarmBoot(const std::vector<uint8_t>& snapshot) {
+  PhaseResult out;
+  unsigned long start = millis();
+  bool restored = SmartMiFanAsync_deserializeFans(snapshot.data(), snapshot.size());
+  if (restored && SmartMiFanAsync_startSetSpeedAll(42)) {
+    while (SmartMiFanAsync_isFanOutInProgress()) {
+      SmartMiFanAsync_update();
+      yield();
+    }
+  }
+  out.durationMs = millis() - start;
+  out.state = restored ? "COMPLETE" : "ERROR";
+  scoreFanTable(out, g_managedIndex.size());
+  return out;
+}
+
+// After a quiet period past the handshake TTL, one fan-out to every fan: with
+// extrapolated sessions this is one round trip, not hello + request
+PhaseResult runAfterIdle(unsigned long idleMs) {
+  PhaseResult out;
+  delay(idleMs);
+  unsigned long start = millis();
+  bool started = SmartMiFanAsync_startSetSpeedAll(58);
+  while (SmartMiFanAsync_isFanOutInProgress()) {
+    SmartMiFanAsync_update();
+    yield();
+  }
+  out.durationMs = millis() - start;
+  out.state = started ? "COMPLETE" : "ERROR";
+  scoreFanTable(out, g_managedIndex.size());
+  return out;
+}
+
+// Every session dropped (as after a Wi-Fi reconnect), then handshakeAll(): one
+// broadcast hello, unicast only for fans that stay silent
+PhaseResult runRehandshake() {
+  PhaseResult out;
+  SmartMiFanAsync_prepareForSleep(false, true);
+  unsigned long start = millis();
+  bool ok = SmartMiFanAsync_handshakeAll();
+  out.durationMs = millis() - start;
+  out.state = ok ? "COMPLETE" : "ERROR";
+  scoreFanTable(out, g_managedIndex.size());
+  return out;
+}
+
+CommandStats* g_commandStats = nullptr;
+uint8_t g_commandPercent = 0;
+
+void onFanOut(const FanCommandResult results[], size_t count) {
+  CommandStats& stats = *g_commandStats;
+  size_t fanCount = 0;
+  const SmartMiFanDiscoveredDevice* fans = SmartMiFanAsync_getDiscoveredFans(fanCount);
+  for (size_t i = 0; i < count; ++i) {
+    const FanCommandResult& r = results[i];
+    ++stats.fanResults;
+    const SmartMiFanDiscoveredDevice& fan = fans[r.fanIndex];
+    FanPropertyWrite expected = speedPropertyWrite(fan.modelType, g_commandPercent);
+    MiioFanEmulator* emu = emulatorAt(fan.ip);
+    bool applied = emu != nullptr && emu->property(expected.siid, expected.piid) == expected.value;
+
+    if (r.state == CommandState::COMPLETE) {
+      ++stats.complete;
+      stats.fanLatency.push_back(r.elapsedMs);
+      if (!applied) ++stats.wrong;
+    } else {
+      if (r.state == CommandState::TIMEOUT) ++stats.timeout;
+      else ++stats.error;
+      if (applied) ++stats.lostAck;
+    }
+  }
+}
+
+void idle(unsigned long ms) {
+  unsigned long start = millis();
+  while (millis() - start < ms) {
+    SmartMiFanAsync_update();
+    yield();
+  }
+}
+
+CommandStats runCommands(const LoadConfig& cfg) {
+  CommandStats stats;
+  g_commandStats = &stats;
+  SmartMiFanAsync_setFanOutCallback(onFanOut);
+  SmartMiFanAsync_resetRxStats();
+
+  uint32_t rng = cfg.seed * 2654435761u + 1;
+  for (size_t c = 0; c < cfg.commands; ++c) {
+    rng = mix(rng);
+    g_commandPercent = static_cast<uint8_t>(1 + rng % 100);
+
+    size_t fanCount = 0;
+    SmartMiFanAsync_getDiscoveredFans(fanCount);
+    size_t before = stats.fanResults;
+    unsigned long start = millis();
+    SmartMiFanAsync_setSpeedAllOrchestrated(g_commandPercent);
+    stats.callLatency.push_back(millis() - start);
+    size_t addressed = stats.fanResults - before;
+    stats.skipped += fanCount > addressed ? fanCount - addressed : 0;
+
+    idle(cfg.gapMs);
+  }
+
+  // Let delayed and duplicated datagrams land before comparing final state
+  idle(5000);
+  size_t fanCount = 0;
+  const SmartMiFanDiscoveredDevice* fans = SmartMiFanAsync_getDiscoveredFans(fanCount);
+  for (size_t i = 0; i < fanCount; ++i) {
+    MiioFanEmulator* emu = emulatorAt(fans[i].ip);
+    FanPropertyWrite prop = speedPropertyWrite(fans[i].modelType, 50);
+    FanPropertyValue cached;
+    if (emu && SmartMiFanAsync_getCachedProperty(static_cast<uint8_t>(i), prop.siid, prop.piid, cached) &&
+        emu->property(prop.siid, prop.piid) != cached.value) {
+      ++stats.finalMismatch;
+    }
+  }
+
+  SmartMiFanRxStats rx;
+  SmartMiFanAsync_getRxStats(rx);
+  stats.lateReplies = rx.unmatched;
+  for (size_t i = 0; i < fanCount; ++i) {
+    SmartMiFanRttStats rtt;
+    if (SmartMiFanAsync_getFanRttStats(static_cast<uint8_t>(i), rtt)) stats.retransmits += rtt.retransmits;
+  }
+  SmartMiFanAsync_setFanOutCallback(nullptr);
+  g_commandStats = nullptr;
+  return stats;
+}
+
+// =========================
+// Report
+// =========================
+
+uint32_t percentile(std::vector<uint32_t> values, double p) {
+  if (values.empty()) return 0;
+  std::sort(values.begin(), values.end());
+  size_t idx = static_cast<size_t>(p * (values.size() - 1) + 0.5);
+  return values[idx];
+}
+
+void printPhase(FILE* out, const char* name, const PhaseResult& r) {
+  fprintf(out,
+          "      \"%s\": {\"state\": \"%s\", \"durationMs\": %lu, \"timeoutBudgetMs\": %lu, "
+          "\"candidates\": %zu, \"found\": %zu, \"missed\": %zu, \"wrong\": %zu},\n",
+          name, r.state, r.durationMs, r.budgetMs, r.candidates, r.found, r.missed, r.wrong);
+}
+
+void printLatency(FILE* out, const char* name, const std::vector<uint32_t>& values, const char* tail) {
+  uint32_t maxValue = values.empty() ? 0 : *std::max_element(values.begin(), values.end());
+  fprintf(out, "\"%s\": {\"p50\": %u, \"p99\": %u, \"max\": %u}%s", name, percentile(values, 0.50),
+          percentile(values, 0.99), maxValue, tail);
+}
+
+// Returns the number of wrong results
+size_t runScenario(FILE* out, const LoadConfig& cfg, bool last) {
+  HostNetwork::reset();
+  HostNetwork::setSeed(cfg.seed);
+  resetLibrary();
+  buildFleet(cfg);
+  HostNetwork::setLinkConfig(cfg.link);
+
+  size_t wrong = 0;
+  {
+    WiFiUDP udp;
+    PhaseResult discovery = runDiscovery(udp, cfg);
+    // Second run against the same fleet starts from the knowledge cache
+    SmartMiFanAsync_resetDiscoveredFans();
+    PhaseResult rediscovery = runDiscovery(udp, cfg);
+    // Cold run again, this time ending as soon as every managed token matched
+    SmartMiFanAsync_resetDiscoveredFans();
+    SmartMiFanAsync_clearDiscoveryCache();
+    SmartMiFanAsync_setExpectAllTokens(true);
+    PhaseResult earlyExit = runDiscovery(udp, cfg);
+    SmartMiFanAsync_clearExpectedFans();
+    std::vector<uint8_t> snapshot(SmartMiFanAsync_serializeFans(nullptr, 0));
+    SmartMiFanAsync_serializeFans(snapshot.data(), snapshot.size());
+    CommandStats commands = runCommands(cfg);
+    resetLibrary();
+    PhaseResult smart = runSmartConnect(udp, cfg);
+    resetLibrary();
+    PhaseResult warmBoot = runWarmBoot(snapshot);
+    PhaseResult afterIdle = runAfterIdle(5 * 60 * 1000UL);
+    PhaseResult rehandshake = runRehandshake();
+    wrong = discovery.wrong + rediscovery.wrong + earlyExit.wrong + smart.wrong + warmBoot.wrong +
+            afterIdle.wrong + rehandshake.wrong + commands.wrong;
+
+    const HostLinkConfig& l = cfg.link;
+    fprintf(out, "    {\n      \"fans\": %zu, \"managed\": %zu, \"seed\": %u,\n", cfg.fans, cfg.managed,
+            static_cast<unsigned>(cfg.seed));
+    fprintf(out,
+            "      \"link\": {\"latencyMs\": %lu, \"jitterMs\": %lu, \"lossPercent\": %.1f, "
+            "\"duplicatePercent\": %.1f, \"reorderPercent\": %.1f, \"reorderDelayMs\": %lu},\n",
+            l.latencyMs, l.jitterMs, l.lossPercent, l.duplicatePercent, l.reorderPercent, l.reorderDelayMs);
+    printPhase(out, "discovery", discovery);
+    printPhase(out, "rediscovery", rediscovery);
+    printPhase(out, "earlyExit", earlyExit);
+    printPhase(out, "smartConnect", smart);
+    printPhase(out, "warmBoot", warmBoot);
+    printPhase(out, "afterIdle", afterIdle);
+    printPhase(out, "rehandshake", rehandshake);
+    fprintf(out,
+            "      \"commands\": {\"count\": %zu, \"fanResults\": %zu, \"complete\": %zu, \"timeout\": %zu, "
+            "\"error\": %zu, \"skipped\": %zu, \"wrong\": %zu, \"lostAck\": %zu, \"finalMismatch\": %zu, "
+            "\"lateReplies\": %u, \"retransmits\": %u, ",
+            cfg.commands, commands.fanResults, commands.complete, commands.timeout, commands.error,
+            commands.skipped, commands.wrong, commands.lostAck, commands.finalMismatch,
+            static_cast<unsigned>(commands.lateReplies), static_cast<unsigned>(commands.retransmits));
+    printLatency(out, "fanLatencyMs", commands.fanLatency, ", ");
+    printLatency(out, "callLatencyMs", commands.callLatency, "},\n");
+    fprintf(out,
+            "      \"network\": {\"sent\": %u, \"delivered\": %u, \"dropped\": %u, \"duplicated\": %u, "
+            "\"reordered\": %u}\n    }%s\n",
+            static_cast<unsigned>(HostNetwork::packetsSent()), static_cast<unsigned>(HostNetwork::packetsDelivered()),
+            static_cast<unsigned>(HostNetwork::packetsDropped()),
+            static_cast<unsigned>(HostNetwork::packetsDuplicated()),
+            static_cast<unsigned>(HostNetwork::packetsReordered()), last ? "" : ",");
+  }
+  resetLibrary();
+  g_fleet.clear();
+  return wrong;
+}
+
+LoadConfig lossyLink(size_t fans) {
+  LoadConfig cfg;
+  cfg.fans = fans;
+  cfg.managed = std::min<size_t>(fans, kMaxSmartMiFans);
+  cfg.link = HostLinkConfig{3, 30, 5.0f, 1.0f, 2.0f, 400};
+  return cfg;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  LoadConfig single;
+  bool custom = false;
+  bool quick = false;
+  bool check = false;
+  const char* outPath = nullptr;
+
+  for (int i = 1; i < argc; ++i) {
+    const char* arg = argv[i];
+    const char* value = (i + 1 < argc) ? argv[i + 1] : nullptr;
+    if (strcmp(arg, "--quick") == 0) { quick = true; continue; }
+    if (strcmp(arg, "--check") == 0) { check = true; continue; }
+    if (value == nullptr) {
+      fprintf(stderr, "missing value for %s\n", arg);
+      return 2;
+    }
+    ++i;
+    if (strcmp(arg, "--out") == 0) { outPath = value; continue; }
+    custom = true;
+    if (strcmp(arg, "--fans") == 0) single.fans = strtoul(value, nullptr, 10);
+    else if (strcmp(arg, "--managed") == 0) single.managed = strtoul(value, nullptr, 10);
+    else if (strcmp(arg, "--latency") == 0) single.link.latencyMs = strtoul(value, nullptr, 10);
+    else if (strcmp(arg, "--jitter") == 0) single.link.jitterMs = strtoul(value, nullptr, 10);
+    else if (strcmp(arg, "--loss") == 0) single.link.lossPercent = strtof(value, nullptr);
+    else if (strcmp(arg, "--dup") == 0) single.link.duplicatePercent = strtof(value, nullptr);
+    else if (strcmp(arg, "--reorder") == 0) single.link.reorderPercent = strtof(value, nullptr);
+    else if (strcmp(arg, "--reorder-delay") == 0) single.link.reorderDelayMs = strtoul(value, nullptr, 10);
+    else if (strcmp(arg, "--commands") == 0) single.commands = strtoul(value, nullptr, 10);
+    else if (strcmp(arg, "--stale") == 0) single.stalePercent = strtoul(value, nullptr, 10);
+    else if (strcmp(arg, "--seed") == 0) single.seed = strtoul(value, nullptr, 10);
+    else {
+      fprintf(stderr,
+              "usage: %s [--quick] [--check] [--out file.json] [--fans N] [--managed M] [--latency ms]\n"
+              "          [--jitter ms] [--loss %%] [--dup %%] [--reorder %%] [--reorder-delay ms]\n"
+              "          [--commands K] [--stale %%] [--seed S]\n",
+              argv[0]);
+      return 2;
+    }
+  }
+
+  std::vector<LoadConfig> scenarios;
+  if (quick) {
+    LoadConfig cfg = lossyLink(16);
+    cfg.commands = 10;
+    scenarios.push_back(cfg);
+  } else if (custom) {
+    if (single.managed > single.fans) single.managed = single.fans;
+    if (single.managed > kMaxSmartMiFans) single.managed = kMaxSmartMiFans;
+    if (single.link.reorderPercent > 0 && single.link.reorderDelayMs == 0) single.link.reorderDelayMs = 400;
+    scenarios.push_back(single);
+  } else {
+    LoadConfig clean;
+    scenarios.push_back(clean);
+    scenarios.push_back(lossyLink(16));
+    scenarios.push_back(lossyLink(64));
+    scenarios.push_back(lossyLink(256));
+  }
+
+  FILE* out = outPath ? fopen(outPath, "w") : stdout;
+  if (!out) {
+    fprintf(stderr, "cannot open %s\n", outPath);
+    return 1;
+  }
+  fprintf(out, "{\n  \"suite\": \"fleetload\",\n  \"version\": \"%s\",\n  \"runs\": [\n", SMART_MI_FAN_ASYNC_VERSION);
+  size_t wrong = 0;
+  for (size_t i = 0; i < scenarios.size(); ++i) {
+    wrong += runScenario(out, scenarios[i], i + 1 == scenarios.size());
+    fflush(out);
+  }
+  fprintf(out, "  ]\n}\n");
+  if (out != stdout) fclose(out);
+
+  return (check && wrong > 0) ? 1 : 0;
+}
@@ -0,0 +1,326 @@
+// =============================================================================
+// SmartMiFanAsync - Host Build: microbenchmarks for the hot primitives
+// =============================================================================
+// Prints one JSON document to stdout (or --out <file>):
+//   {"suite":"microbench", "version":..., "results":[
+//     {"name":..., "iterations":..., "ns_per_op":..., "stack_bytes":...}, ...]}
+//
+// ns_per_op:   wall-clock time of a tight loop (best of several runs)
+// stack_bytes: peak stack depth of one call, measured by running it once on a
+//              painted private stack (includes callees, excludes the harness)
+//
+// Numbers are host numbers: use them to compare releases and alternatives,
+// not as ESP32 timings.
+//
+//   microbench [--quick] [--out results.json]
+// =============================================================================
+
+#include <SmartMiFanAsync.h>
+#include <ucontext.h>
+
+#include <chrono>
+#include <vector>
+
+#include "internal/SmartMiFanInternal.h"
+
+using namespace SmartMiFanInternal;
+
+namespace {
+
+// =========================
+// Inputs
+// =========================
+
+const char* kTokenHex = "00112233445566778899aabbccddeeff";
+const uint8_t kDeviceId[4] = {0x12, 0x34, 0x56, 0x78};
+
+// Typical miIO.info reply body (trimmed to the fields the library reads)
+const char* kInfoReply =
+    "{\"id\":1,\"result\":{\"life\":8714,\"cfg_time\":0,\"token\":\"00112233445566778899aabbccddeeff\","
+    "\"mac\":\"AA:BB:CC:DD:EE:FF\",\"fw_ver\":\"2.1.8\",\"hw_ver\":\"esp32\",\"uid\":1234567890,"
+    "\"model\":\"dmaker.fan.p11\",\"mcu_fw_ver\":\"0007\",\"wifi_fw_ver\":\"v4.4.1\","
+    "\"ap\":{\"rssi\":-52,\"ssid\":\"home\",\"bssid\":\"11:22:33:44:55:66\"},"
+    "\"netif\":{\"localIp\":\"192.168.1.50\",\"mask\":\"255.255.255.0\",\"gw\":\"192.168.1.1\"},"
+    "\"did\":\"363152873\"}}";
+
+uint8_t g_token[16];
+uint8_t g_key[16];
+uint8_t g_iv[16];
+uint8_t g_plain[96];
+uint8_t g_out[kMiioMaxFrameLen];
+char g_json[256];
+FanPropertyWrite g_props[2];
+DiscoveryTokenKey g_tokenKey;
+uint8_t g_sleepSnapshot[SMART_MI_FAN_SLEEP_SNAPSHOT_BYTES];
+size_t g_sleepSnapshotLen = 0;
+
+volatile uint32_t g_sink;
+
+void setupInputs() {
+  hexToBytes16Helper(kTokenHex, g_token);
+  computeKeyIv(g_token, g_key, g_iv);
+  for (size_t i = 0; i < sizeof(g_plain); ++i) g_plain[i] = static_cast<uint8_t>('a' + i % 26);
+  g_props[0] = powerPropertyWrite(true);
+  g_props[1] = speedPropertyWrite(FanModelType::DMAKER_FAN_P11, 55);
+  memcpy(g_tokenKey.token, g_token, 16);
+  memcpy(g_tokenKey.iv, g_iv, 16);
+  aesScheduleExpand(g_tokenKey.aes, g_key);
+  g_tokenKey.valid = true;
+
+  // Full fan table with live sessions for the sleep snapshot benchmarks
+  for (size_t i = 0; i < kMaxSmartMiFans; ++i) {
+    SmartMiFanDiscoveredDevice fan{};
+    fan.ip = IPAddress(192, 168, 1, static_cast<uint8_t>(10 + i));
+    fan.did = 1000 + static_cast<uint32_t>(i);
+    snprintf(fan.model, sizeof(fan.model), "%s", kSupportedModels[i % kSupportedModelCount]);
+    snprintf(fan.token, sizeof(fan.token), "%s", kTokenHex);
+    snprintf(fan.fw_ver, sizeof(fan.fw_ver), "2.1.8");
+    snprintf(fan.hw_ver, sizeof(fan.hw_ver), "esp32");
+    fan.userEnabled = true;
+    appendDiscoveredFan(fan);
+    g_discoveredFans[i].session.valid = true;
+    g_discoveredFans[i].session.handshakeMillis = millis();
+  }
+  g_sleepSnapshotLen = SmartMiFanAsync_saveSleepSnapshot(g_sleepSnapshot, sizeof(g_sleepSnapshot));
+}
+
+// =========================
+// Operations
+// =========================
+
+void opHexToBytes() {
+  uint8_t out[16];
+  hexToBytes16Helper(kTokenHex, out);
+  g_sink += out[7];
+}
+
+void opComputeKeyIv() {
+  uint8_t key[16];
+  uint8_t iv[16];
+  computeKeyIv(g_token, key, iv);
+  g_sink += key[3] ^ iv[5];
+}
+
+// What cacheFanCrypto() saves on every command: token hex parse + key/IV
+void opUncachedFanCrypto() {
+  uint8_t token[16];
+  uint8_t key[16];
+  uint8_t iv[16];
+  hexToBytes16Helper(kTokenHex, token);
+  computeKeyIv(token, key, iv);
+  g_sink += key[0] ^ iv[15];
+}
+
+void opMd5() {
+  uint8_t out[16];
+  md5(g_plain, 32, out);
+  g_sink += out[1];
+}
+
+// 96-byte payload = typical set_properties request after padding
+void opAesCbcEncrypt() {
+  aesCbcEncrypt(g_key, g_iv, g_plain, g_out, sizeof(g_plain));
+  g_sink += g_out[95];
+}
+
+void opJsonExtractString() {
+  char model[24];
+  char fw[16];
+  char hw[16];
+  jsonExtractString(kInfoReply, "model", model, sizeof(model));
+  jsonExtractString(kInfoReply, "fw_ver", fw, sizeof(fw));
+  jsonExtractString(kInfoReply, "hw_ver", hw, sizeof(hw));
+  g_sink += model[0] + fw[0] + hw[0] + jsonExtractUint(kInfoReply, "did");
+}
+
+void opParseMiioInfoSinglePass() {
+  MiioInfoFields fields;
+  parseMiioInfoSinglePass(kInfoReply, fields);
+  g_sink += fields.model[0] + fields.did;
+}
+
+void opJsonExtractUint() { g_sink += jsonExtractUint(kInfoReply, "did"); }
+
+void opModelStringToType() {
+  for (size_t i = 0; i < kSupportedModelCount; ++i) {
+    g_sink += static_cast<uint32_t>(modelStringToType(kSupportedModels[i]));
+  }
+}
+
+void opGetSpeedParams() {
+  for (size_t i = 0; i < kSupportedModelCount; ++i) {
+    int siid = 0;
+    int piid = 0;
+    bool useFanLevel = false;
+    getSpeedParams(kSupportedModels[i], siid, piid, useFanLevel);
+    g_sink += siid + piid;
+  }
+}
+
+void opBuildSetPropertiesJson() {
+  g_sink += buildSetPropertiesJson(g_sink, g_props, 2, g_json, sizeof(g_json));
+}
+
+// Complete request: JSON + padding + AES + header + checksum
+void opSetPropertiesFrame() {
+  char json[256];
+  size_t jsonLen = buildSetPropertiesJson(g_sink, g_props, 2, json, sizeof(json));
+  if (jsonLen == 0) return;
+  g_sink += encodeMiioFrame(g_token, g_key, g_iv, kDeviceId, 1234, json, g_out, sizeof(g_out));
+}
+
+// Discovery miIO.info probe as it was built per candidate x token before the
+// token key table: hex parse + key/IV derivation + frame
+void opProbeFrameFromHex() {
+  static const char kProbe[] = "{\"id\":4711,\"method\":\"miIO.info\",\"params\":[]}";
+  uint8_t token[16];
+  uint8_t key[16];
+  uint8_t iv[16];
+  hexToBytes16Helper(kTokenHex, token);
+  computeKeyIv(token, key, iv);
+  g_sink += encodeMiioFrame(token, key, iv, kDeviceId, 1234, kProbe, g_out, sizeof(g_out));
+}
+
+// Same probe from a precomputed DiscoveryTokenKey
+void opProbeFrameFromTable() {
+  static const char kProbe[] = "{\"id\":4711,\"method\":\"miIO.info\",\"params\":[]}";
+  g_sink += encodeMiioFrame(g_tokenKey.token, g_tokenKey.aes, g_tokenKey.iv, kDeviceId, 1234, kProbe,
+                            g_out, sizeof(g_out));
+}
+
+// What softWakeUp() used to cost before the first command: key/IV for every fan
+void opWakeRederiveCrypto() {
+  for (size_t i = 0; i < kMaxSmartMiFans; ++i) opUncachedFanCrypto();
+}
+
+void opSaveSleepSnapshot() {
+  g_sink += SmartMiFanAsync_saveSleepSnapshot(g_sleepSnapshot, sizeof(g_sleepSnapshot));
+}
+
+void opResumeFromSleep() {
+  g_sink += SmartMiFanAsync_resumeFromSleep(g_sleepSnapshot, g_sleepSnapshotLen, 1000);
+}
+
+struct Benchmark {
+  const char* name;
+  void (*fn)();
+  const char* note;
+};
+
+const Benchmark kBenchmarks[] = {
+    {"hexToBytes16Helper", opHexToBytes, "32 hex chars"},
+    {"computeKeyIv", opComputeKeyIv, "2x MD5"},
+    {"uncachedFanCrypto", opUncachedFanCrypto, "hexToBytes16Helper + computeKeyIv (saved per command by cacheFanCrypto)"},
+    {"md5", opMd5, "32 bytes"},
+    {"aesCbcEncrypt", opAesCbcEncrypt, "96 bytes, cached key schedule (replaces encryptPayload)"},
+    {"jsonExtractString", opJsonExtractString, "miIO.info: model, fw_ver, hw_ver + did"},
+    {"parseMiioInfoSinglePass", opParseMiioInfoSinglePass, "miIO.info: all fields in one pass"},
+    {"jsonExtractUint", opJsonExtractUint, "miIO.info: did"},
+    {"modelStringToType", opModelStringToType, "all kSupportedModels"},
+    {"getSpeedParams", opGetSpeedParams, "all kSupportedModels"},
+    {"buildSetPropertiesJson", opBuildSetPropertiesJson, "power + speed"},
+    {"setPropertiesFrame", opSetPropertiesFrame, "power + speed, JSON to finished UDP frame"},
+    {"probeFrameFromHex", opProbeFrameFromHex, "discovery miIO.info probe: hex + key/IV + frame"},
+    {"probeFrameFromTable", opProbeFrameFromTable, "discovery miIO.info probe from DiscoveryTokenKey"},
+    {"wakeRederiveCrypto", opWakeRederiveCrypto, "16 fans: uncachedFanCrypto each (old softWakeUp)"},
+    {"saveSleepSnapshot", opSaveSleepSnapshot, "16 fans with sessions into retained memory"},
+    {"resumeFromSleep", opResumeFromSleep, "16 fans with sessions from retained memory (no MD5)"},
+};
+
+// =========================
+// Timing
+// =========================
+
+double measureNsPerOp(void (*fn)(), uint32_t iterations, int runs) {
+  double best = 0;
+  for (int r = 0; r < runs; ++r) {
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < iterations; ++i) fn();
+    auto end = std::chrono::steady_clock::now();
+    double ns = std::chrono::duration<double, std::nano>(end - start).count() / iterations;
+    if (r == 0 || ns < best) best = ns;
+  }
+  return best;
+}
+
+// =========================
+// Stack depth
+// =========================
+
+constexpr size_t kProbeStackSize = 64 * 1024;
+constexpr uint8_t kPaint = 0xA5;
+
+ucontext_t g_mainContext;
+ucontext_t g_probeContext;
+void (*g_probeFn)() = nullptr;
+
+void probeEntry() {
+  if (g_probeFn) g_probeFn();
+}
+
+void noop() {}
+
+// Stack grows down: count painted bytes from the low end
+size_t stackUsedBy(void (*fn)()) {
+  static std::vector<uint8_t> stack(kProbeStackSize);
+  memset(stack.data(), kPaint, stack.size());
+  getcontext(&g_probeContext);
+  g_probeContext.uc_stack.ss_sp = stack.data();
+  g_probeContext.uc_stack.ss_size = stack.size();
+  g_probeContext.uc_link = &g_mainContext;
+  g_probeFn = fn;
+  makecontext(&g_probeContext, probeEntry, 0);
+  swapcontext(&g_mainContext, &g_probeContext);
+
+  size_t untouched = 0;
+  while (untouched < stack.size() && stack[untouched] == kPaint) ++untouched;
+  return stack.size() - untouched;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  bool quick = false;
+  const char* outPath = nullptr;
+  for (int i = 1; i < argc; ++i) {
+    if (strcmp(argv[i], "--quick") == 0) {
+      quick = true;
+    } else if (strcmp(argv[i], "--out") == 0 && i + 1 < argc) {
+      outPath = argv[++i];
+    } else {
+      fprintf(stderr, "usage: %s [--quick] [--out file.json]\n", argv[0]);
+      return 2;
+    }
+  }
+
+  setupInputs();
+  const uint32_t iterations = quick ? 2000 : 200000;
+  const int runs = quick ? 1 : 5;
+  const size_t baseline = stackUsedBy(noop);
+
+  FILE* out = outPath ? fopen(outPath, "w") : stdout;
+  if (!out) {
+    fprintf(stderr, "cannot open %s\n", outPath);
+    return 1;
+  }
+
+  fprintf(out, "{\n  \"suite\": \"microbench\",\n  \"version\": \"%s\",\n", SMART_MI_FAN_ASYNC_VERSION);
+  fprintf(out, "  \"compiler\": \"%s\",\n  \"iterations\": %u,\n  \"runs\": %d,\n", __VERSION__,
+          static_cast<unsigned>(iterations), runs);
+  fprintf(out, "  \"results\": [\n");
+  const size_t count = sizeof(kBenchmarks) / sizeof(kBenchmarks[0]);
+  for (size_t i = 0; i < count; ++i) {
+    const Benchmark& b = kBenchmarks[i];
+    size_t stack = stackUsedBy(b.fn);
+    double ns = measureNsPerOp(b.fn, iterations, runs);
+    fprintf(out,
+            "    {\"name\": \"%s\", \"iterations\": %u, \"ns_per_op\": %.1f, \"stack_bytes\": %zu, "
+            "\"note\": \"%s\"}%s\n",
+            b.name, static_cast<unsigned>(iterations), ns, stack > baseline ? stack - baseline : 0, b.note,
+            i + 1 < count ? "," : "");
+  }
+  fprintf(out, "  ]\n}\n");
+
+  if (out != stdout) fclose(out);
+  return 0;
+}
@@ -0,0 +1,49 @@
+// =============================================================================
+// SmartMiFanAsync - Host Build: Arduino stand-in
+// =============================================================================
+// Minimal subset of the Arduino core used by the library so that the unity
+// build (src/SmartMiFanAsync.cpp) compiles and runs on Linux.
+// Time is virtual: millis() only advances through yield()/delay() or
+// hostAdvanceMillis(), which makes every timeout deterministic.
+// =============================================================================
+
+#pragma once
+
+#include <ctype.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "IPAddress.h"
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void yield();
+
+// Host-only clock control
+void hostAdvanceMillis(unsigned long ms);
+void hostSetMillis(unsigned long ms);
+
+#include <type_traits>
+
+template <typename A, typename B>
+inline typename std::common_type<A, B>::type min(A a, B b) { return (b < a) ? b : a; }
+template <typename A, typename B>
+inline typename std::common_type<A, B>::type max(A a, B b) { return (a < b) ? b : a; }
+
+class HostSerial {
+public:
+  void begin(unsigned long) {}
+  int printf(const char* fmt, ...) __attribute__((format(printf, 2, 3)));
+  size_t print(const char* s);
+  size_t println(const char* s = "");
+  void setEnabled(bool enabled) { _enabled = enabled; }
+
+private:
+  bool _enabled = false;
+};
+
+extern HostSerial Serial;
@@ -0,0 +1,69 @@
+// =============================================================================
+// SmartMiFanAsync - Host Build: In-process UDP network
+// =============================================================================
+// Routes datagrams between WiFiUDP sockets (the library side, bound to
+// hostIp()) and HostNode instances (emulated devices). Every datagram is
+// delivered after a per-link latency measured on the virtual millis() clock;
+// loss, jitter, duplication and reordering can be injected per datagram
+// (broadcasts per recipient) from a seeded, reproducible random stream.
+// =============================================================================
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "IPAddress.h"
+
+class WiFiUDP;
+
+// A simulated device reachable on the network
+class HostNode {
+public:
+  virtual ~HostNode() {}
+  virtual IPAddress nodeIp() const = 0;
+  virtual void onPacket(const IPAddress& srcIp, uint16_t srcPort, uint16_t dstPort,
+                        const uint8_t* data, size_t len) = 0;
+};
+
+// Link characteristics applied to every datagram (default: clean 1 ms link)
+struct HostLinkConfig {
+  unsigned long latencyMs = 1;        // one-way base latency
+  unsigned long jitterMs = 0;         // plus uniform 0..jitterMs per datagram
+  float lossPercent = 0.0f;           // datagrams dropped
+  float duplicatePercent = 0.0f;      // datagrams delivered twice (independent delays)
+  float reorderPercent = 0.0f;        // datagrams held back by reorderDelayMs
+  unsigned long reorderDelayMs = 0;   // hold-back for reordered datagrams
+};
+
+namespace HostNetwork {
+
+void reset();
+IPAddress hostIp();
+
+void setLinkConfig(const HostLinkConfig& config);
+const HostLinkConfig& linkConfig();
+void setSeed(uint32_t seed);
+
+void attachNode(HostNode* node);
+void detachNode(HostNode* node);
+
+void bindSocket(WiFiUDP* socket, uint16_t port);
+void unbindSocket(WiFiUDP* socket);
+uint16_t allocatePort();
+
+// Queue a datagram; broadcast (255.255.255.255) reaches every node
+void send(const IPAddress& srcIp, uint16_t srcPort, const IPAddress& dstIp, uint16_t dstPort,
+          const uint8_t* data, size_t len);
+
+// Deliver every datagram that is due at the current virtual time
+void pump();
+
+// Counters
+uint32_t packetsSent();
+uint32_t packetsDelivered();
+uint32_t packetsDropped();
+uint32_t packetsDuplicated();
+uint32_t packetsReordered();
+
+}  // namespace HostNetwork
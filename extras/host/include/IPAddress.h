@@ -0,0 +1,37 @@
+// =============================================================================
+// SmartMiFanAsync - Host Build: IPAddress stand-in
+// =============================================================================
+
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+
+class IPAddress {
+public:
+  IPAddress() : _addr(0) {}
+  IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d)
+      : _addr(uint32_t(a) | (uint32_t(b) << 8) | (uint32_t(c) << 16) | (uint32_t(d) << 24)) {}
+  explicit IPAddress(uint32_t raw) : _addr(raw) {}
+
+  // Raw value in network order (octet 0 in the low byte), as on ESP32
+  operator uint32_t() const { return _addr; }
+
+  uint8_t operator[](int index) const { return static_cast<uint8_t>(_addr >> (index * 8)); }
+
+  bool operator==(const IPAddress& other) const { return _addr == other._addr; }
+  bool operator!=(const IPAddress& other) const { return _addr != other._addr; }
+
+  bool fromString(const char* str) {
+    if (str == nullptr) return false;
+    unsigned a, b, c, d;
+    char tail;
+    if (sscanf(str, "%u.%u.%u.%u%c", &a, &b, &c, &d, &tail) != 4) return false;
+    if (a > 255 || b > 255 || c > 255 || d > 255) return false;
+    *this = IPAddress(a, b, c, d);
+    return true;
+  }
+
+private:
+  uint32_t _addr;
+};
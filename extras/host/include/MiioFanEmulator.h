@@ -0,0 +1,94 @@
+// =============================================================================
+// SmartMiFanAsync - Host Build: miIO fan emulator
+// =============================================================================
+// In-process stand-in for a Xiaomi/SmartMi fan on the HostNetwork. Answers the
+// hello handshake and encrypted miIO.info / set_properties / get_properties
+// requests with real AES-128-CBC + MD5 framing derived from its own token.
+// =============================================================================
+
+#pragma once
+
+#include <map>
+#include <utility>
+#include <vector>
+
+#include "Arduino.h"
+#include "HostNetwork.h"
+
+struct MiioFanEmulatorConfig {
+  IPAddress ip;
+  uint32_t did;
+  const char* tokenHex;   // 32 hex characters
+  const char* model;      // e.g. "zhimi.fan.za5"; nullptr = first supported model
+  const char* fwVer;
+  const char* hwVer;
+};
+
+class MiioFanEmulator : public HostNode {
+public:
+  struct Stats {
+    uint32_t hellos;
+    uint32_t infoRequests;
+    uint32_t setRequests;
+    uint32_t getRequests;
+    uint32_t propertiesSet;
+    uint32_t badChecksum;
+    uint32_t unknownMethod;
+    uint32_t staleSession;  // Requests dropped after reboot() until the next hello
+    uint32_t staleTimestamp;  // Requests dropped for a timestamp too far behind the device clock
+    uint32_t repeatedRequests;  // Requests byte-identical to the previous one (retransmissions)
+  };
+
+  explicit MiioFanEmulator(const MiioFanEmulatorConfig& config);
+  ~MiioFanEmulator() override;
+
+  IPAddress nodeIp() const override { return _ip; }
+  void onPacket(const IPAddress& srcIp, uint16_t srcPort, uint16_t dstPort,
+                const uint8_t* data, size_t len) override;
+
+  // Device behaviour
+  void setOnline(bool online) { _online = online; }
+  bool isOnline() const { return _online; }
+  void setIp(const IPAddress& ip) { _ip = ip; }
+  void reboot();  // Restarts the device clock; requests are ignored until a hello
+  void dropReplies(uint32_t count) { _dropReplies = count; }  // Next count request replies are lost
+
+  // MIoT property store (siid/piid -> value; booleans stored as 0/1)
+  bool hasProperty(int siid, int piid) const;
+  int property(int siid, int piid) const;
+  void setProperty(int siid, int piid, int value);
+
+  // Models the library accepts (kSupportedModels), wrapping around
+  static const char* supportedModel(size_t index);
+  static size_t supportedModelCount();
+
+  uint32_t did() const { return _did; }
+  const char* model() const { return _model; }
+  const uint8_t* token() const { return _token; }
+  uint32_t deviceTimestamp() const;
+  const Stats& stats() const { return _stats; }
+  void resetStats();
+
+private:
+  void reply(const IPAddress& dstIp, uint16_t dstPort, const char* json);
+  void handleRequest(const IPAddress& srcIp, uint16_t srcPort, const char* json);
+  size_t handleSetProperties(const char* params, char* out, size_t outCap);
+  size_t handleGetProperties(const char* params, char* out, size_t outCap);
+
+  IPAddress _ip;
+  uint32_t _did;
+  uint8_t _token[16];
+  uint8_t _key[16];
+  uint8_t _iv[16];
+  char _model[32];
+  char _fwVer[16];
+  char _hwVer[16];
+  bool _online;
+  bool _awaitingHello;
+  uint32_t _dropReplies;
+  std::vector<uint8_t> _lastRequest;
+  unsigned long _bootMillis;
+  uint32_t _bootStamp;
+  std::map<std::pair<int, int>, int> _properties;
+  Stats _stats;
+};
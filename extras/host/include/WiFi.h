@@ -0,0 +1,8 @@
+// =============================================================================
+// SmartMiFanAsync - Host Build: WiFi stand-in
+// =============================================================================
+
+#pragma once
+
+#include "Arduino.h"
+#include "WiFiUdp.h"
@@ -0,0 +1,62 @@
+// =============================================================================
+// SmartMiFanAsync - Host Build: WiFiUDP stand-in
+// =============================================================================
+// Sockets live on the in-process HostNetwork (see HostNetwork.h). The API
+// mirrors the subset of the ESP32 WiFiUDP class used by the library.
+// =============================================================================
+
+#pragma once
+
+#include <deque>
+#include <vector>
+
+#include "Arduino.h"
+
+struct HostPacket {
+  IPAddress srcIp;
+  uint16_t srcPort;
+  IPAddress dstIp;
+  uint16_t dstPort;
+  unsigned long deliverAt;
+  uint64_t seq;
+  std::vector<uint8_t> data;
+};
+
+class WiFiUDP {
+public:
+  WiFiUDP();
+  ~WiFiUDP();
+
+  uint8_t begin(uint16_t port);
+  void stop();
+
+  int beginPacket(const IPAddress& ip, uint16_t port);
+  size_t write(const uint8_t* buffer, size_t size);
+  size_t write(uint8_t byte) { return write(&byte, 1); }
+  int endPacket();
+
+  int parsePacket();
+  int available();
+  int read(uint8_t* buffer, size_t len);
+  int read(char* buffer, size_t len) { return read(reinterpret_cast<uint8_t*>(buffer), len); }
+  void flush();
+
+  IPAddress remoteIP() const { return _current.srcIp; }
+  uint16_t remotePort() const { return _current.srcPort; }
+  uint16_t localPort() const { return _port; }
+
+  // Called by HostNetwork when a packet reaches this socket
+  void deliver(HostPacket&& packet);
+
+private:
+  uint16_t _port;
+  bool _open;
+  std::deque<HostPacket> _rx;
+  HostPacket _current;
+  size_t _readPos;
+  bool _hasCurrent;
+  IPAddress _txIp;
+  uint16_t _txPort;
+  std::vector<uint8_t> _tx;
+  bool _txActive;
+};
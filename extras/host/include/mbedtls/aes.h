@@ -0,0 +1,30 @@
+// =============================================================================
+// SmartMiFanAsync - Host Build: mbedtls AES subset
+// =============================================================================
+// Portable AES-128/192/256 (FIPS-197) exposing the mbedtls calls used by the
+// library. Not constant-time; for host testing and benchmarking only.
+// =============================================================================
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define MBEDTLS_AES_ENCRYPT 1
+#define MBEDTLS_AES_DECRYPT 0
+#define MBEDTLS_ERR_AES_INVALID_KEY_LENGTH -0x0020
+#define MBEDTLS_ERR_AES_INVALID_INPUT_LENGTH -0x0022
+
+typedef struct mbedtls_aes_context {
+  int nr;
+  uint8_t rk[240];
+} mbedtls_aes_context;
+
+void mbedtls_aes_init(mbedtls_aes_context* ctx);
+void mbedtls_aes_free(mbedtls_aes_context* ctx);
+int mbedtls_aes_setkey_enc(mbedtls_aes_context* ctx, const unsigned char* key, unsigned int keybits);
+int mbedtls_aes_setkey_dec(mbedtls_aes_context* ctx, const unsigned char* key, unsigned int keybits);
+int mbedtls_aes_crypt_ecb(mbedtls_aes_context* ctx, int mode, const unsigned char input[16],
+                          unsigned char output[16]);
+int mbedtls_aes_crypt_cbc(mbedtls_aes_context* ctx, int mode, size_t length, unsigned char iv[16],
+                          const unsigned char* input, unsigned char* output);
@@ -0,0 +1,55 @@
+// =============================================================================
+// SmartMiFanAsync - Host Build: Arduino runtime (virtual clock, Serial)
+// =============================================================================
+
+#include "Arduino.h"
+#include "HostNetwork.h"
+
+namespace {
+unsigned long g_hostMillis = 1000;
+}
+
+HostSerial Serial;
+
+unsigned long millis() { return g_hostMillis; }
+
+unsigned long micros() { return g_hostMillis * 1000UL; }
+
+void hostAdvanceMillis(unsigned long ms) {
+  // Step one millisecond at a time so datagrams are delivered in order
+  for (unsigned long i = 0; i < ms; ++i) {
+    ++g_hostMillis;
+    HostNetwork::pump();
+  }
+}
+
+void hostSetMillis(unsigned long ms) {
+  g_hostMillis = ms;
+  HostNetwork::pump();
+}
+
+void delay(unsigned long ms) { hostAdvanceMillis(ms); }
+
+// Blocking library loops call yield() between polls; each call costs 1 ms
+void yield() { hostAdvanceMillis(1); }
+
+int HostSerial::printf(const char* fmt, ...) {
+  if (!_enabled) return 0;
+  va_list args;
+  va_start(args, fmt);
+  int n = vfprintf(stdout, fmt, args);
+  va_end(args);
+  return n;
+}
+
+size_t HostSerial::print(const char* s) {
+  if (!_enabled || s == nullptr) return 0;
+  return fputs(s, stdout) >= 0 ? strlen(s) : 0;
+}
+
+size_t HostSerial::println(const char* s) {
+  if (!_enabled) return 0;
+  size_t n = print(s);
+  fputc('\n', stdout);
+  return n + 1;
+}
@@ -0,0 +1,308 @@
+// =============================================================================
+// SmartMiFanAsync - Host Build: AES and MD5 for the mbedtls stand-in
+// =============================================================================
+
+#include <string.h>
+
+#include "mbedtls/aes.h"
+#include "mbedtls/md5.h"
+
+// =========================
+// AES
+// =========================
+
+namespace {
+
+const uint8_t kSbox[256] = {
+    0x63, 0x7c, 0x77, 0x7b, 0xf2, 0x6b, 0x6f, 0xc5, 0x30, 0x01, 0x67, 0x2b, 0xfe, 0xd7, 0xab, 0x76,
+    0xca, 0x82, 0xc9, 0x7d, 0xfa, 0x59, 0x47, 0xf0, 0xad, 0xd4, 0xa2, 0xaf, 0x9c, 0xa4, 0x72, 0xc0,
+    0xb7, 0xfd, 0x93, 0x26, 0x36, 0x3f, 0xf7, 0xcc, 0x34, 0xa5, 0xe5, 0xf1, 0x71, 0xd8, 0x31, 0x15,
+    0x04, 0xc7, 0x23, 0xc3, 0x18, 0x96, 0x05, 0x9a, 0x07, 0x12, 0x80, 0xe2, 0xeb, 0x27, 0xb2, 0x75,
+    0x09, 0x83, 0x2c, 0x1a, 0x1b, 0x6e, 0x5a, 0xa0, 0x52, 0x3b, 0xd6, 0xb3, 0x29, 0xe3, 0x2f, 0x84,
+    0x53, 0xd1, 0x00, 0xed, 0x20, 0xfc, 0xb1, 0x5b, 0x6a, 0xcb, 0xbe, 0x39, 0x4a, 0x4c, 0x58, 0xcf,
+    0xd0, 0xef, 0xaa, 0xfb, 0x43, 0x4d, 0x33, 0x85, 0x45, 0xf9, 0x02, 0x7f, 0x50, 0x3c, 0x9f, 0xa8,
+    0x51, 0xa3, 0x40, 0x8f, 0x92, 0x9d, 0x38, 0xf5, 0xbc, 0xb6, 0xda, 0x21, 0x10, 0xff, 0xf3, 0xd2,
+    0xcd, 0x0c, 0x13, 0xec, 0x5f, 0x97, 0x44, 0x17, 0xc4, 0xa7, 0x7e, 0x3d, 0x64, 0x5d, 0x19, 0x73,
+    0x60, 0x81, 0x4f, 0xdc, 0x22, 0x2a, 0x90, 0x88, 0x46, 0xee, 0xb8, 0x14, 0xde, 0x5e, 0x0b, 0xdb,
+    0xe0, 0x32, 0x3a, 0x0a, 0x49, 0x06, 0x24, 0x5c, 0xc2, 0xd3, 0xac, 0x62, 0x91, 0x95, 0xe4, 0x79,
+    0xe7, 0xc8, 0x37, 0x6d, 0x8d, 0xd5, 0x4e, 0xa9, 0x6c, 0x56, 0xf4, 0xea, 0x65, 0x7a, 0xae, 0x08,
+    0xba, 0x78, 0x25, 0x2e, 0x1c, 0xa6, 0xb4, 0xc6, 0xe8, 0xdd, 0x74, 0x1f, 0x4b, 0xbd, 0x8b, 0x8a,
+    0x70, 0x3e, 0xb5, 0x66, 0x48, 0x03, 0xf6, 0x0e, 0x61, 0x35, 0x57, 0xb9, 0x86, 0xc1, 0x1d, 0x9e,
+    0xe1, 0xf8, 0x98, 0x11, 0x69, 0xd9, 0x8e, 0x94, 0x9b, 0x1e, 0x87, 0xe9, 0xce, 0x55, 0x28, 0xdf,
+    0x8c, 0xa1, 0x89, 0x0d, 0xbf, 0xe6, 0x42, 0x68, 0x41, 0x99, 0x2d, 0x0f, 0xb0, 0x54, 0xbb, 0x16};
+
+uint8_t g_invSbox[256];
+bool g_invSboxReady = false;
+
+void ensureInvSbox() {
+  if (g_invSboxReady) return;
+  for (int i = 0; i < 256; ++i) g_invSbox[kSbox[i]] = static_cast<uint8_t>(i);
+  g_invSboxReady = true;
+}
+
+inline uint8_t xtime(uint8_t x) { return static_cast<uint8_t>((x << 1) ^ ((x & 0x80) ? 0x1b : 0x00)); }
+
+inline uint8_t gmul(uint8_t a, uint8_t b) {
+  uint8_t p = 0;
+  while (b) {
+    if (b & 1) p ^= a;
+    a = xtime(a);
+    b >>= 1;
+  }
+  return p;
+}
+
+int expandKey(mbedtls_aes_context* ctx, const unsigned char* key, unsigned int keybits) {
+  int nk;
+  switch (keybits) {
+    case 128: nk = 4; ctx->nr = 10; break;
+    case 192: nk = 6; ctx->nr = 12; break;
+    case 256: nk = 8; ctx->nr = 14; break;
+    default: return MBEDTLS_ERR_AES_INVALID_KEY_LENGTH;
+  }
+  const int words = 4 * (ctx->nr + 1);
+  memcpy(ctx->rk, key, nk * 4);
+  uint8_t rcon = 0x01;
+  for (int i = nk; i < words; ++i) {
+    uint8_t t[4];
+    memcpy(t, ctx->rk + (i - 1) * 4, 4);
+    if (i % nk == 0) {
+      uint8_t first = t[0];
+      t[0] = static_cast<uint8_t>(kSbox[t[1]] ^ rcon);
+      t[1] = kSbox[t[2]];
+      t[2] = kSbox[t[3]];
+      t[3] = kSbox[first];
+      rcon = xtime(rcon);
+    } else if (nk > 6 && i % nk == 4) {
+      for (int j = 0; j < 4; ++j) t[j] = kSbox[t[j]];
+    }
+    for (int j = 0; j < 4; ++j) ctx->rk[i * 4 + j] = static_cast<uint8_t>(ctx->rk[(i - nk) * 4 + j] ^ t[j]);
+  }
+  return 0;
+}
+
+void addRoundKey(uint8_t s[16], const uint8_t* rk) {
+  for (int i = 0; i < 16; ++i) s[i] ^= rk[i];
+}
+
+void encryptBlock(const mbedtls_aes_context* ctx, const uint8_t in[16], uint8_t out[16]) {
+  uint8_t s[16];
+  memcpy(s, in, 16);
+  addRoundKey(s, ctx->rk);
+  for (int round = 1; round <= ctx->nr; ++round) {
+    for (int i = 0; i < 16; ++i) s[i] = kSbox[s[i]];
+    uint8_t t[16];
+    for (int c = 0; c < 4; ++c) {
+      for (int r = 0; r < 4; ++r) t[c * 4 + r] = s[((c + r) % 4) * 4 + r];
+    }
+    if (round != ctx->nr) {
+      for (int c = 0; c < 4; ++c) {
+        uint8_t* col = t + c * 4;
+        uint8_t a0 = col[0], a1 = col[1], a2 = col[2], a3 = col[3];
+        uint8_t all = a0 ^ a1 ^ a2 ^ a3;
+        col[0] ^= all ^ xtime(a0 ^ a1);
+        col[1] ^= all ^ xtime(a1 ^ a2);
+        col[2] ^= all ^ xtime(a2 ^ a3);
+        col[3] ^= all ^ xtime(a3 ^ a0);
+      }
+    }
+    memcpy(s, t, 16);
+    addRoundKey(s, ctx->rk + round * 16);
+  }
+  memcpy(out, s, 16);
+}
+
+void decryptBlock(const mbedtls_aes_context* ctx, const uint8_t in[16], uint8_t out[16]) {
+  uint8_t s[16];
+  memcpy(s, in, 16);
+  addRoundKey(s, ctx->rk + ctx->nr * 16);
+  for (int round = ctx->nr - 1; round >= 0; --round) {
+    uint8_t t[16];
+    for (int c = 0; c < 4; ++c) {
+      for (int r = 0; r < 4; ++r) t[((c + r) % 4) * 4 + r] = s[c * 4 + r];
+    }
+    for (int i = 0; i < 16; ++i) s[i] = g_invSbox[t[i]];
+    addRoundKey(s, ctx->rk + round * 16);
+    if (round != 0) {
+      for (int c = 0; c < 4; ++c) {
+        uint8_t* col = s + c * 4;
+        uint8_t a0 = col[0], a1 = col[1], a2 = col[2], a3 = col[3];
+        col[0] = gmul(a0, 14) ^ gmul(a1, 11) ^ gmul(a2, 13) ^ gmul(a3, 9);
+        col[1] = gmul(a0, 9) ^ gmul(a1, 14) ^ gmul(a2, 11) ^ gmul(a3, 13);
+        col[2] = gmul(a0, 13) ^ gmul(a1, 9) ^ gmul(a2, 14) ^ gmul(a3, 11);
+        col[3] = gmul(a0, 11) ^ gmul(a1, 13) ^ gmul(a2, 9) ^ gmul(a3, 14);
+      }
+    }
+  }
+  memcpy(out, s, 16);
+}
+
+}  // namespace
+
+void mbedtls_aes_init(mbedtls_aes_context* ctx) { memset(ctx, 0, sizeof(*ctx)); }
+
+void mbedtls_aes_free(mbedtls_aes_context* ctx) {
+  if (ctx) memset(ctx, 0, sizeof(*ctx));
+}
+
+int mbedtls_aes_setkey_enc(mbedtls_aes_context* ctx, const unsigned char* key, unsigned int keybits) {
+  return expandKey(ctx, key, keybits);
+}
+
+int mbedtls_aes_setkey_dec(mbedtls_aes_context* ctx, const unsigned char* key, unsigned int keybits) {
+  ensureInvSbox();
+  return expandKey(ctx, key, keybits);
+}
+
+int mbedtls_aes_crypt_ecb(mbedtls_aes_context* ctx, int mode, const unsigned char input[16],
+                          unsigned char output[16]) {
+  if (mode == MBEDTLS_AES_ENCRYPT) {
+    encryptBlock(ctx, input, output);
+  } else {
+    ensureInvSbox();
+    decryptBlock(ctx, input, output);
+  }
+  return 0;
+}
+
+int mbedtls_aes_crypt_cbc(mbedtls_aes_context* ctx, int mode, size_t length, unsigned char iv[16],
+                          const unsigned char* input, unsigned char* output) {
+  if (length % 16 != 0) return MBEDTLS_ERR_AES_INVALID_INPUT_LENGTH;
+  if (mode == MBEDTLS_AES_ENCRYPT) {
+    for (size_t off = 0; off < length; off += 16) {
+      uint8_t block[16];
+      for (int i = 0; i < 16; ++i) block[i] = static_cast<uint8_t>(input[off + i] ^ iv[i]);
+      encryptBlock(ctx, block, output + off);
+      memcpy(iv, output + off, 16);
+    }
+  } else {
+    ensureInvSbox();
+    for (size_t off = 0; off < length; off += 16) {
+      uint8_t saved[16];
+      memcpy(saved, input + off, 16);
+      decryptBlock(ctx, saved, output + off);
+      for (int i = 0; i < 16; ++i) output[off + i] ^= iv[i];
+      memcpy(iv, saved, 16);
+    }
+  }
+  return 0;
+}
+
+// =========================
+// MD5 (RFC 1321)
+// =========================
+
+namespace {
+
+inline uint32_t rotl(uint32_t x, int c) { return (x << c) | (x >> (32 - c)); }
+
+const uint32_t kMd5K[64] = {
+    0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee, 0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501,
+    0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be, 0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821,
+    0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa, 0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+    0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed, 0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a,
+    0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c, 0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70,
+    0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05, 0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+    0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039, 0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
+    0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1, 0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391};
+
+const int kMd5R[64] = {7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22,
+                       5, 9,  14, 20, 5, 9,  14, 20, 5, 9,  14, 20, 5, 9,  14, 20,
+                       4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23,
+                       6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21};
+
+void md5Process(mbedtls_md5_context* ctx, const unsigned char data[64]) {
+  uint32_t m[16];
+  for (int i = 0; i < 16; ++i) {
+    m[i] = uint32_t(data[i * 4]) | (uint32_t(data[i * 4 + 1]) << 8) | (uint32_t(data[i * 4 + 2]) << 16) |
+           (uint32_t(data[i * 4 + 3]) << 24);
+  }
+  uint32_t a = ctx->state[0], b = ctx->state[1], c = ctx->state[2], d = ctx->state[3];
+  for (int i = 0; i < 64; ++i) {
+    uint32_t f;
+    int g;
+    if (i < 16) {
+      f = (b & c) | (~b & d);
+      g = i;
+    } else if (i < 32) {
+      f = (d & b) | (~d & c);
+      g = (5 * i + 1) % 16;
+    } else if (i < 48) {
+      f = b ^ c ^ d;
+      g = (3 * i + 5) % 16;
+    } else {
+      f = c ^ (b | ~d);
+      g = (7 * i) % 16;
+    }
+    uint32_t tmp = d;
+    d = c;
+    c = b;
+    b = b + rotl(a + f + kMd5K[i] + m[g], kMd5R[i]);
+    a = tmp;
+  }
+  ctx->state[0] += a;
+  ctx->state[1] += b;
+  ctx->state[2] += c;
+  ctx->state[3] += d;
+}
+
+}  // namespace
+
+void mbedtls_md5_init(mbedtls_md5_context* ctx) { memset(ctx, 0, sizeof(*ctx)); }
+
+void mbedtls_md5_free(mbedtls_md5_context* ctx) {
+  if (ctx) memset(ctx, 0, sizeof(*ctx));
+}
+
+void mbedtls_md5_clone(mbedtls_md5_context* dst, const mbedtls_md5_context* src) { *dst = *src; }
+
+int mbedtls_md5_starts(mbedtls_md5_context* ctx) {
+  ctx->total[0] = 0;
+  ctx->total[1] = 0;
+  ctx->state[0] = 0x67452301;
+  ctx->state[1] = 0xefcdab89;
+  ctx->state[2] = 0x98badcfe;
+  ctx->state[3] = 0x10325476;
+  return 0;
+}
+
+int mbedtls_md5_update(mbedtls_md5_context* ctx, const unsigned char* input, size_t ilen) {
+  if (ilen == 0) return 0;
+  size_t left = ctx->total[0] & 0x3F;
+  size_t fill = 64 - left;
+  ctx->total[0] += static_cast<uint32_t>(ilen);
+  if (ctx->total[0] < static_cast<uint32_t>(ilen)) ctx->total[1]++;
+  if (left && ilen >= fill) {
+    memcpy(ctx->buffer + left, input, fill);
+    md5Process(ctx, ctx->buffer);
+    input += fill;
+    ilen -= fill;
+    left = 0;
+  }
+  while (ilen >= 64) {
+    md5Process(ctx, input);
+    input += 64;
+    ilen -= 64;
+  }
+  if (ilen > 0) memcpy(ctx->buffer + left, input, ilen);
+  return 0;
+}
+
+int mbedtls_md5_finish(mbedtls_md5_context* ctx, unsigned char output[16]) {
+  uint32_t high = (ctx->total[0] >> 29) | (ctx->total[1] << 3);
+  uint32_t low = ctx->total[0] << 3;
+  unsigned char msglen[8];
+  for (int i = 0; i < 4; ++i) {
+    msglen[i] = static_cast<unsigned char>(low >> (8 * i));
+    msglen[4 + i] = static_cast<unsigned char>(high >> (8 * i));
+  }
+  static const unsigned char padding[64] = {0x80};
+  size_t last = ctx->total[0] & 0x3F;
+  size_t padn = (last < 56) ? (56 - last) : (120 - last);
+  mbedtls_md5_update(ctx, padding, padn);
+  mbedtls_md5_update(ctx, msglen, 8);
+  for (int i = 0; i < 4; ++i) {
+    for (int j = 0; j < 4; ++j) output[i * 4 + j] = static_cast<unsigned char>(ctx->state[i] >> (8 * j));
+  }
+  return 0;
+}
@@ -0,0 +1,297 @@
+// =============================================================================
+// SmartMiFanAsync - Host Build: In-process UDP network and WiFiUDP
+// =============================================================================
+
+#include "HostNetwork.h"
+
+#include <algorithm>
+#include <map>
+#include <vector>
+
+#include "WiFiUdp.h"
+
+namespace {
+
+const IPAddress kHostIp(192, 168, 1, 2);
+const IPAddress kBroadcast(255, 255, 255, 255);
+
+struct NetworkState {
+  HostLinkConfig link;
+  uint32_t rng = 1;
+  std::vector<HostNode*> nodes;
+  std::map<uint16_t, WiFiUDP*> sockets;
+  std::vector<HostPacket> inFlight;
+  uint64_t nextSeq = 0;
+  uint16_t nextEphemeralPort = 40000;
+  uint32_t sent = 0;
+  uint32_t delivered = 0;
+  uint32_t dropped = 0;
+  uint32_t duplicated = 0;
+  uint32_t reordered = 0;
+  bool pumping = false;
+};
+
+NetworkState& net() {
+  static NetworkState state;
+  return state;
+}
+
+// xorshift32: cheap, and the same seed always gives the same packet trace
+uint32_t nextRandom() {
+  uint32_t& x = net().rng;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  return x;
+}
+
+bool chance(float percent) {
+  if (percent <= 0.0f) return false;
+  return (nextRandom() % 10000) < static_cast<uint32_t>(percent * 100.0f);
+}
+
+unsigned long linkDelay() {
+  const HostLinkConfig& link = net().link;
+  unsigned long delay = link.latencyMs;
+  if (link.jitterMs > 0) delay += nextRandom() % (link.jitterMs + 1);
+  return delay;
+}
+
+void enqueue(const HostPacket& packet) {
+  NetworkState& n = net();
+  if (chance(n.link.lossPercent)) {
+    ++n.dropped;
+    return;
+  }
+  int copies = 1;
+  if (chance(n.link.duplicatePercent)) {
+    ++n.duplicated;
+    copies = 2;
+  }
+  for (int i = 0; i < copies; ++i) {
+    HostPacket copy = packet;
+    unsigned long delay = linkDelay();
+    if (chance(n.link.reorderPercent)) {
+      ++n.reordered;
+      delay += n.link.reorderDelayMs;
+    }
+    copy.deliverAt = millis() + delay;
+    copy.seq = n.nextSeq++;
+    n.inFlight.push_back(std::move(copy));
+  }
+}
+
+void deliverOne(HostPacket&& packet) {
+  NetworkState& n = net();
+  if (packet.dstIp == kHostIp) {
+    auto it = n.sockets.find(packet.dstPort);
+    if (it != n.sockets.end()) {
+      ++n.delivered;
+      it->second->deliver(std::move(packet));
+    }
+    return;
+  }
+  for (HostNode* node : n.nodes) {
+    if (node->nodeIp() == packet.dstIp) {
+      ++n.delivered;
+      node->onPacket(packet.srcIp, packet.srcPort, packet.dstPort, packet.data.data(), packet.data.size());
+      break;
+    }
+  }
+}
+
+}  // namespace
+
+namespace HostNetwork {
+
+void reset() {
+  NetworkState& n = net();
+  n.nodes.clear();
+  n.inFlight.clear();
+  n.link = HostLinkConfig{};
+  n.rng = 1;
+  n.sent = 0;
+  n.delivered = 0;
+  n.dropped = 0;
+  n.duplicated = 0;
+  n.reordered = 0;
+}
+
+IPAddress hostIp() { return kHostIp; }
+
+void setLinkConfig(const HostLinkConfig& config) { net().link = config; }
+
+const HostLinkConfig& linkConfig() { return net().link; }
+
+void setSeed(uint32_t seed) { net().rng = seed ? seed : 1; }
+
+void attachNode(HostNode* node) { net().nodes.push_back(node); }
+
+void detachNode(HostNode* node) {
+  auto& nodes = net().nodes;
+  nodes.erase(std::remove(nodes.begin(), nodes.end(), node), nodes.end());
+}
+
+void bindSocket(WiFiUDP* socket, uint16_t port) { net().sockets[port] = socket; }
+
+void unbindSocket(WiFiUDP* socket) {
+  auto& sockets = net().sockets;
+  for (auto it = sockets.begin(); it != sockets.end();) {
+    if (it->second == socket) {
+      it = sockets.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
+
+uint16_t allocatePort() {
+  NetworkState& n = net();
+  while (n.sockets.count(n.nextEphemeralPort)) ++n.nextEphemeralPort;
+  return n.nextEphemeralPort++;
+}
+
+void send(const IPAddress& srcIp, uint16_t srcPort, const IPAddress& dstIp, uint16_t dstPort,
+          const uint8_t* data, size_t len) {
+  NetworkState& n = net();
+  HostPacket packet;
+  packet.srcIp = srcIp;
+  packet.srcPort = srcPort;
+  packet.dstIp = dstIp;
+  packet.dstPort = dstPort;
+  packet.data.assign(data, data + len);
+  ++n.sent;
+  if (dstIp != kBroadcast) {
+    enqueue(packet);
+    return;
+  }
+  // Broadcast: every recipient sees its own loss / delay
+  for (HostNode* node : n.nodes) {
+    packet.dstIp = node->nodeIp();
+    enqueue(packet);
+  }
+}
+
+void pump() {
+  NetworkState& n = net();
+  if (n.pumping) return;
+  n.pumping = true;
+  unsigned long now = millis();
+  // Nodes may send replies while we deliver, so re-scan until nothing is due
+  bool progress = true;
+  while (progress) {
+    progress = false;
+    size_t best = n.inFlight.size();
+    for (size_t i = 0; i < n.inFlight.size(); ++i) {
+      const HostPacket& p = n.inFlight[i];
+      if (static_cast<long>(now - p.deliverAt) < 0) continue;
+      if (best == n.inFlight.size() || p.deliverAt < n.inFlight[best].deliverAt ||
+          (p.deliverAt == n.inFlight[best].deliverAt && p.seq < n.inFlight[best].seq)) {
+        best = i;
+      }
+    }
+    if (best < n.inFlight.size()) {
+      HostPacket packet = std::move(n.inFlight[best]);
+      n.inFlight.erase(n.inFlight.begin() + best);
+      deliverOne(std::move(packet));
+      progress = true;
+    }
+  }
+  n.pumping = false;
+}
+
+uint32_t packetsSent() { return net().sent; }
+
+uint32_t packetsDelivered() { return net().delivered; }
+
+uint32_t packetsDropped() { return net().dropped; }
+
+uint32_t packetsDuplicated() { return net().duplicated; }
+
+uint32_t packetsReordered() { return net().reordered; }
+
+}  // namespace HostNetwork
+
+// =========================
+// WiFiUDP
+// =========================
+
+WiFiUDP::WiFiUDP()
+    : _port(0), _open(false), _readPos(0), _hasCurrent(false), _txPort(0), _txActive(false) {}
+
+WiFiUDP::~WiFiUDP() { stop(); }
+
+uint8_t WiFiUDP::begin(uint16_t port) {
+  // As on the ESP32: an open socket is closed (queued packets dropped) and
+  // bound again, on a new port when port is 0
+  stop();
+  _port = (port == 0) ? HostNetwork::allocatePort() : port;
+  _open = true;
+  HostNetwork::bindSocket(this, _port);
+  return 1;
+}
+
+void WiFiUDP::stop() {
+  if (!_open) return;
+  HostNetwork::unbindSocket(this);
+  _open = false;
+  _rx.clear();
+  _hasCurrent = false;
+  _readPos = 0;
+}
+
+int WiFiUDP::beginPacket(const IPAddress& ip, uint16_t port) {
+  _txIp = ip;
+  _txPort = port;
+  _tx.clear();
+  _txActive = true;
+  return 1;
+}
+
+size_t WiFiUDP::write(const uint8_t* buffer, size_t size) {
+  if (!_txActive || buffer == nullptr) return 0;
+  _tx.insert(_tx.end(), buffer, buffer + size);
+  return size;
+}
+
+int WiFiUDP::endPacket() {
+  if (!_txActive) return 0;
+  _txActive = false;
+  if (!_open) return 0;
+  HostNetwork::send(HostNetwork::hostIp(), _port, _txIp, _txPort, _tx.data(), _tx.size());
+  return 1;
+}
+
+int WiFiUDP::parsePacket() {
+  HostNetwork::pump();
+  _hasCurrent = false;
+  _readPos = 0;
+  if (_rx.empty()) return 0;
+  _current = std::move(_rx.front());
+  _rx.pop_front();
+  _hasCurrent = true;
+  return static_cast<int>(_current.data.size());
+}
+
+int WiFiUDP::available() {
+  if (!_hasCurrent) return 0;
+  return static_cast<int>(_current.data.size() - _readPos);
+}
+
+int WiFiUDP::read(uint8_t* buffer, size_t len) {
+  int avail = available();
+  if (avail <= 0 || buffer == nullptr) return 0;
+  size_t n = (len < static_cast<size_t>(avail)) ? len : static_cast<size_t>(avail);
+  memcpy(buffer, _current.data.data() + _readPos, n);
+  _readPos += n;
+  return static_cast<int>(n);
+}
+
+void WiFiUDP::flush() {
+  if (_hasCurrent) _readPos = _current.data.size();
+}
+
+void WiFiUDP::deliver(HostPacket&& packet) {
+  if (!_open) return;
+  _rx.push_back(std::move(packet));
+}
@@ -0,0 +1,298 @@
+// =============================================================================
+// SmartMiFanAsync - Host Build: miIO fan emulator
+// =============================================================================
+
+#include "MiioFanEmulator.h"
+
+#include "internal/SmartMiFanInternal.h"
+#include "mbedtls/aes.h"
+#include "mbedtls/md5.h"
+
+namespace {
+
+// Accepted request timestamp lag behind the device clock (seconds)
+constexpr uint32_t kTimestampWindowS = 120;
+
+void md5Of(const uint8_t* a, size_t aLen, const uint8_t* b, size_t bLen, const uint8_t* c, size_t cLen,
+           uint8_t out[16]) {
+  mbedtls_md5_context ctx;
+  mbedtls_md5_init(&ctx);
+  mbedtls_md5_starts(&ctx);
+  mbedtls_md5_update(&ctx, a, aLen);
+  if (bLen) mbedtls_md5_update(&ctx, b, bLen);
+  if (cLen) mbedtls_md5_update(&ctx, c, cLen);
+  mbedtls_md5_finish(&ctx, out);
+  mbedtls_md5_free(&ctx);
+}
+
+bool parseHex16(const char* hex, uint8_t out[16]) {
+  if (hex == nullptr || strlen(hex) < 32) return false;
+  for (int i = 0; i < 16; ++i) {
+    unsigned v;
+    char pair[3] = {hex[i * 2], hex[i * 2 + 1], '\0'};
+    if (sscanf(pair, "%2x", &v) != 1) return false;
+    out[i] = static_cast<uint8_t>(v);
+  }
+  return true;
+}
+
+// Parse integer/bool value following `"key":` starting at p; returns false if absent
+bool findInt(const char* p, const char* end, const char* key, int& out) {
+  char pattern[24];
+  snprintf(pattern, sizeof(pattern), "\"%s\":", key);
+  const char* hit = strstr(p, pattern);
+  if (!hit || (end && hit >= end)) return false;
+  hit += strlen(pattern);
+  while (*hit == ' ') ++hit;
+  if (strncmp(hit, "true", 4) == 0) { out = 1; return true; }
+  if (strncmp(hit, "false", 5) == 0) { out = 0; return true; }
+  if (*hit == '"') ++hit;
+  out = static_cast<int>(strtol(hit, nullptr, 10));
+  return true;
+}
+
+}  // namespace
+
+MiioFanEmulator::MiioFanEmulator(const MiioFanEmulatorConfig& config)
+    : _ip(config.ip), _did(config.did), _online(true), _awaitingHello(false), _dropReplies(0), _bootMillis(millis()), _bootStamp(1000 + config.did % 5000) {
+  memset(&_stats, 0, sizeof(_stats));
+  parseHex16(config.tokenHex, _token);
+  md5Of(_token, 16, nullptr, 0, nullptr, 0, _key);
+  md5Of(_key, 16, _token, 16, nullptr, 0, _iv);
+  snprintf(_model, sizeof(_model), "%s", config.model ? config.model : supportedModel(0));
+  snprintf(_fwVer, sizeof(_fwVer), "%s", config.fwVer ? config.fwVer : "2.1.8");
+  snprintf(_hwVer, sizeof(_hwVer), "%s", config.hwVer ? config.hwVer : "esp32");
+  setProperty(2, 1, 0);
+  HostNetwork::attachNode(this);
+}
+
+MiioFanEmulator::~MiioFanEmulator() { HostNetwork::detachNode(this); }
+
+const char* MiioFanEmulator::supportedModel(size_t index) {
+  return SmartMiFanInternal::kSupportedModels[index % SmartMiFanInternal::kSupportedModelCount];
+}
+
+size_t MiioFanEmulator::supportedModelCount() { return SmartMiFanInternal::kSupportedModelCount; }
+
+void MiioFanEmulator::reboot() {
+  _bootMillis = millis();
+  _bootStamp = 1;
+  _awaitingHello = true;
+}
+
+bool MiioFanEmulator::hasProperty(int siid, int piid) const {
+  return _properties.count(std::make_pair(siid, piid)) > 0;
+}
+
+int MiioFanEmulator::property(int siid, int piid) const {
+  auto it = _properties.find(std::make_pair(siid, piid));
+  return it == _properties.end() ? -1 : it->second;
+}
+
+void MiioFanEmulator::setProperty(int siid, int piid, int value) {
+  _properties[std::make_pair(siid, piid)] = value;
+}
+
+uint32_t MiioFanEmulator::deviceTimestamp() const {
+  return _bootStamp + static_cast<uint32_t>((millis() - _bootMillis) / 1000);
+}
+
+void MiioFanEmulator::resetStats() { memset(&_stats, 0, sizeof(_stats)); }
+
+void MiioFanEmulator::onPacket(const IPAddress& srcIp, uint16_t srcPort, uint16_t dstPort,
+                               const uint8_t* data, size_t len) {
+  if (!_online || dstPort != SmartMiFanInternal::kMiioPort || len < 32) return;
+  if (data[0] != 0x21 || data[1] != 0x31) return;
+
+  // Hello: 32-byte header with all-0xFF body
+  if (len == 32) {
+    bool hello = true;
+    for (size_t i = 4; i < 32; ++i) {
+      if (data[i] != 0xFF) { hello = false; break; }
+    }
+    if (!hello) return;
+    _stats.hellos++;
+    _awaitingHello = false;
+    uint8_t resp[32] = {0x21, 0x31, 0x00, 0x20};
+    resp[8] = static_cast<uint8_t>(_did >> 24);
+    resp[9] = static_cast<uint8_t>(_did >> 16);
+    resp[10] = static_cast<uint8_t>(_did >> 8);
+    resp[11] = static_cast<uint8_t>(_did);
+    uint32_t ts = deviceTimestamp();
+    resp[12] = static_cast<uint8_t>(ts >> 24);
+    resp[13] = static_cast<uint8_t>(ts >> 16);
+    resp[14] = static_cast<uint8_t>(ts >> 8);
+    resp[15] = static_cast<uint8_t>(ts);
+    HostNetwork::send(_ip, SmartMiFanInternal::kMiioPort, srcIp, srcPort, resp, sizeof(resp));
+    return;
+  }
+
+  size_t cipherLen = len - 32;
+  if (cipherLen % 16 != 0 || cipherLen > 1024) return;
+  if (_awaitingHello) {
+    _stats.staleSession++;
+    return;
+  }
+
+  uint8_t checksum[16];
+  md5Of(data, 16, _token, 16, data + 32, cipherLen, checksum);
+  if (memcmp(checksum, data + 16, 16) != 0) {
+    _stats.badChecksum++;
+    return;
+  }
+  // Like real devices, ignore requests stamped well behind the device clock
+  uint32_t requestTs = (uint32_t(data[12]) << 24) | (uint32_t(data[13]) << 16) |
+                       (uint32_t(data[14]) << 8) | uint32_t(data[15]);
+  if (requestTs + kTimestampWindowS < deviceTimestamp()) {
+    _stats.staleTimestamp++;
+    return;
+  }
+  if (_lastRequest.size() == len && memcmp(_lastRequest.data(), data, len) == 0) _stats.repeatedRequests++;
+  _lastRequest.assign(data, data + len);
+
+  uint8_t plain[1025];
+  mbedtls_aes_context aes;
+  mbedtls_aes_init(&aes);
+  mbedtls_aes_setkey_dec(&aes, _key, 128);
+  uint8_t iv[16];
+  memcpy(iv, _iv, 16);
+  mbedtls_aes_crypt_cbc(&aes, MBEDTLS_AES_DECRYPT, cipherLen, iv, data + 32, plain);
+  mbedtls_aes_free(&aes);
+  uint8_t pad = plain[cipherLen - 1];
+  size_t plainLen = (pad > 0 && pad <= 16) ? cipherLen - pad : cipherLen;
+  plain[plainLen] = '\0';
+
+  handleRequest(srcIp, srcPort, reinterpret_cast<const char*>(plain));
+}
+
+void MiioFanEmulator::handleRequest(const IPAddress& srcIp, uint16_t srcPort, const char* json) {
+  int id = 0;
+  findInt(json, nullptr, "id", id);
+  const char* method = strstr(json, "\"method\":\"");
+  const char* params = strstr(json, "\"params\":");
+  char out[1024];
+  char body[900];
+  body[0] = '\0';
+
+  if (method && strncmp(method + 10, "miIO.info\"", 10) == 0) {
+    _stats.infoRequests++;
+    snprintf(body, sizeof(body),
+             "{\"life\":%lu,\"model\":\"%s\",\"token\":\"\",\"fw_ver\":\"%s\",\"hw_ver\":\"%s\","
+             "\"did\":\"%lu\",\"mac\":\"AA:BB:CC:DD:EE:FF\"}",
+             static_cast<unsigned long>(deviceTimestamp()), _model, _fwVer, _hwVer,
+             static_cast<unsigned long>(_did));
+  } else if (method && params && strncmp(method + 10, "set_properties\"", 15) == 0) {
+    _stats.setRequests++;
+    handleSetProperties(params, body, sizeof(body));
+  } else if (method && params && strncmp(method + 10, "get_properties\"", 15) == 0) {
+    _stats.getRequests++;
+    handleGetProperties(params, body, sizeof(body));
+  } else {
+    _stats.unknownMethod++;
+    snprintf(out, sizeof(out), "{\"id\":%d,\"error\":{\"code\":-32601,\"message\":\"Method not found.\"}}", id);
+    reply(srcIp, srcPort, out);
+    return;
+  }
+
+  snprintf(out, sizeof(out), "{\"id\":%d,\"result\":%s}", id, body);
+  reply(srcIp, srcPort, out);
+}
+
+size_t MiioFanEmulator::handleSetProperties(const char* params, char* out, size_t outCap) {
+  size_t used = snprintf(out, outCap, "[");
+  const char* p = params;
+  bool first = true;
+  while ((p = strchr(p, '{')) != nullptr) {
+    const char* end = strchr(p, '}');
+    if (!end) break;
+    int siid = 0, piid = 0, value = 0;
+    if (findInt(p, end, "siid", siid) && findInt(p, end, "piid", piid) && findInt(p, end, "value", value)) {
+      setProperty(siid, piid, value);
+      _stats.propertiesSet++;
+      used += snprintf(out + used, outCap - used, "%s{\"did\":\"%lu\",\"siid\":%d,\"piid\":%d,\"code\":0}",
+                       first ? "" : ",", static_cast<unsigned long>(_did), siid, piid);
+      first = false;
+    }
+    p = end + 1;
+    if (used >= outCap - 64) break;
+  }
+  used += snprintf(out + used, outCap - used, "]");
+  return used;
+}
+
+size_t MiioFanEmulator::handleGetProperties(const char* params, char* out, size_t outCap) {
+  size_t used = snprintf(out, outCap, "[");
+  const char* p = params;
+  bool first = true;
+  while ((p = strchr(p, '{')) != nullptr) {
+    const char* end = strchr(p, '}');
+    if (!end) break;
+    int siid = 0, piid = 0;
+    if (findInt(p, end, "siid", siid) && findInt(p, end, "piid", piid)) {
+      if (hasProperty(siid, piid)) {
+        int value = property(siid, piid);
+        bool isBool = (siid == 2 && piid == 1);
+        char valueStr[16];
+        if (isBool) {
+          snprintf(valueStr, sizeof(valueStr), "%s", value ? "true" : "false");
+        } else {
+          snprintf(valueStr, sizeof(valueStr), "%d", value);
+        }
+        used += snprintf(out + used, outCap - used,
+                         "%s{\"did\":\"%lu\",\"siid\":%d,\"piid\":%d,\"code\":0,\"value\":%s}", first ? "" : ",",
+                         static_cast<unsigned long>(_did), siid, piid, valueStr);
+      } else {
+        used += snprintf(out + used, outCap - used, "%s{\"did\":\"%lu\",\"siid\":%d,\"piid\":%d,\"code\":-4003}",
+                         first ? "" : ",", static_cast<unsigned long>(_did), siid, piid);
+      }
+      first = false;
+    }
+    p = end + 1;
+    if (used >= outCap - 96) break;
+  }
+  used += snprintf(out + used, outCap - used, "]");
+  return used;
+}
+
+void MiioFanEmulator::reply(const IPAddress& dstIp, uint16_t dstPort, const char* json) {
+  if (_dropReplies > 0) {
+    _dropReplies--;
+    return;
+  }
+  size_t len = strlen(json);
+  size_t raw = len + 1;
+  size_t pad = 16 - (raw % 16);
+  size_t cipherLen = raw + pad;
+  uint8_t frame[32 + 1040];
+  if (cipherLen > 1040) return;
+  uint8_t* cipher = frame + 32;
+  memcpy(cipher, json, len);
+  cipher[len] = 0x00;
+  memset(cipher + len + 1, static_cast<int>(pad), pad);
+
+  mbedtls_aes_context aes;
+  mbedtls_aes_init(&aes);
+  mbedtls_aes_setkey_enc(&aes, _key, 128);
+  uint8_t iv[16];
+  memcpy(iv, _iv, 16);
+  mbedtls_aes_crypt_cbc(&aes, MBEDTLS_AES_ENCRYPT, cipherLen, iv, cipher, cipher);
+  mbedtls_aes_free(&aes);
+
+  uint16_t total = static_cast<uint16_t>(32 + cipherLen);
+  uint32_t ts = deviceTimestamp();
+  frame[0] = 0x21;
+  frame[1] = 0x31;
+  frame[2] = static_cast<uint8_t>(total >> 8);
+  frame[3] = static_cast<uint8_t>(total);
+  memset(frame + 4, 0, 4);
+  frame[8] = static_cast<uint8_t>(_did >> 24);
+  frame[9] = static_cast<uint8_t>(_did >> 16);
+  frame[10] = static_cast<uint8_t>(_did >> 8);
+  frame[11] = static_cast<uint8_t>(_did);
+  frame[12] = static_cast<uint8_t>(ts >> 24);
+  frame[13] = static_cast<uint8_t>(ts >> 16);
+  frame[14] = static_cast<uint8_t>(ts >> 8);
+  frame[15] = static_cast<uint8_t>(ts);
+  md5Of(frame, 16, _token, 16, cipher, cipherLen, frame + 16);
+  HostNetwork::send(_ip, SmartMiFanInternal::kMiioPort, dstIp, dstPort, frame, total);
+}
@@ -0,0 +1,37 @@
+// =============================================================================
+// SmartMiFanAsync - Host Build: minimal test helpers
+// =============================================================================
+
+#pragma once
+
+#include <stdio.h>
+
+static int g_hostTestFailures = 0;
+
+#define HOST_CHECK(cond)                                                   \
+  do {                                                                     \
+    if (!(cond)) {                                                         \
+      fprintf(stderr, "%s:%d: CHECK failed: %s\n", __FILE__, __LINE__, #cond); \
+      ++g_hostTestFailures;                                                \
+    }                                                                      \
+  } while (0)
+
+#define HOST_CHECK_EQ(a, b)                                                \
+  do {                                                                     \
+    long long va_ = static_cast<long long>(a);                             \
+    long long vb_ = static_cast<long long>(b);                             \
+    if (va_ != vb_) {                                                      \
+      fprintf(stderr, "%s:%d: CHECK_EQ failed: %s (%lld) != %s (%lld)\n",  \
+              __FILE__, __LINE__, #a, va_, #b, vb_);                       \
+      ++g_hostTestFailures;                                                \
+    }                                                                      \
+  } while (0)
+
+inline int hostTestResult(const char* name) {
+  if (g_hostTestFailures == 0) {
+    printf("[%s] PASS\n", name);
+    return 0;
+  }
+  printf("[%s] FAIL (%d checks)\n", name, g_hostTestFailures);
+  return 1;
+}
@@ -0,0 +1,80 @@
+// =============================================================================
+// SmartMiFanAsync - Host Build: crypto known-answer test
+// =============================================================================
+// The host mbedtls subset must match the ESP32 implementation bit for bit,
+// otherwise the emulator and the library would only agree with each other.
+// =============================================================================
+
+#include <string.h>
+
+#include "HostTest.h"
+#include "mbedtls/aes.h"
+#include "mbedtls/md5.h"
+
+namespace {
+
+bool equalsHex(const unsigned char* bytes, size_t len, const char* hex) {
+  char buf[65];
+  for (size_t i = 0; i < len; ++i) snprintf(buf + i * 2, 3, "%02x", bytes[i]);
+  return strcmp(buf, hex) == 0;
+}
+
+}  // namespace
+
+int main() {
+  // RFC 1321 test suite
+  unsigned char digest[16];
+  mbedtls_md5_context md5;
+  mbedtls_md5_init(&md5);
+  mbedtls_md5_starts(&md5);
+  mbedtls_md5_update(&md5, reinterpret_cast<const unsigned char*>("abc"), 3);
+  mbedtls_md5_finish(&md5, digest);
+  mbedtls_md5_free(&md5);
+  HOST_CHECK(equalsHex(digest, 16, "900150983cd24fb0d6963f7d28e17f72"));
+
+  // Incremental updates across the 64-byte block boundary
+  const char* text = "12345678901234567890123456789012345678901234567890123456789012345678901234567890";
+  mbedtls_md5_init(&md5);
+  mbedtls_md5_starts(&md5);
+  mbedtls_md5_update(&md5, reinterpret_cast<const unsigned char*>(text), 30);
+  mbedtls_md5_update(&md5, reinterpret_cast<const unsigned char*>(text) + 30, strlen(text) - 30);
+  mbedtls_md5_finish(&md5, digest);
+  mbedtls_md5_free(&md5);
+  HOST_CHECK(equalsHex(digest, 16, "57edf4a22be3c955ac49da2e2107b67a"));
+
+  // FIPS-197 / SP 800-38A AES-128 vector
+  const unsigned char key[16] = {0x2b, 0x7e, 0x15, 0x16, 0x28, 0xae, 0xd2, 0xa6,
+                                 0xab, 0xf7, 0x15, 0x88, 0x09, 0xcf, 0x4f, 0x3c};
+  const unsigned char plain[16] = {0x6b, 0xc1, 0xbe, 0xe2, 0x2e, 0x40, 0x9f, 0x96,
+                                   0xe9, 0x3d, 0x7e, 0x11, 0x73, 0x93, 0x17, 0x2a};
+  unsigned char cipher[16];
+  unsigned char back[16];
+  mbedtls_aes_context aes;
+  mbedtls_aes_init(&aes);
+  mbedtls_aes_setkey_enc(&aes, key, 128);
+  mbedtls_aes_crypt_ecb(&aes, MBEDTLS_AES_ENCRYPT, plain, cipher);
+  HOST_CHECK(equalsHex(cipher, 16, "3ad77bb40d7a3660a89ecaf32466ef97"));
+  mbedtls_aes_setkey_dec(&aes, key, 128);
+  mbedtls_aes_crypt_ecb(&aes, MBEDTLS_AES_DECRYPT, cipher, back);
+  HOST_CHECK(memcmp(back, plain, 16) == 0);
+
+  // SP 800-38A F.2.1 CBC-AES128 first block, then an in-place round trip
+  unsigned char iv[16];
+  for (int i = 0; i < 16; ++i) iv[i] = static_cast<unsigned char>(i);
+  mbedtls_aes_setkey_enc(&aes, key, 128);
+  mbedtls_aes_crypt_cbc(&aes, MBEDTLS_AES_ENCRYPT, 16, iv, plain, cipher);
+  HOST_CHECK(equalsHex(cipher, 16, "7649abac8119b246cee98e9b12e9197d"));
+
+  unsigned char buf[48];
+  unsigned char orig[48];
+  for (int i = 0; i < 48; ++i) orig[i] = buf[i] = static_cast<unsigned char>(i * 5 + 1);
+  memset(iv, 0x42, sizeof(iv));
+  mbedtls_aes_crypt_cbc(&aes, MBEDTLS_AES_ENCRYPT, sizeof(buf), iv, buf, buf);
+  memset(iv, 0x42, sizeof(iv));
+  mbedtls_aes_setkey_dec(&aes, key, 128);
+  mbedtls_aes_crypt_cbc(&aes, MBEDTLS_AES_DECRYPT, sizeof(buf), iv, buf, buf);
+  HOST_CHECK(memcmp(buf, orig, sizeof(buf)) == 0);
+  mbedtls_aes_free(&aes);
+
+  return hostTestResult("crypto_test");
+}
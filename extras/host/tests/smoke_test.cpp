@@ -0,0 +1,647 @@
+// =============================================================================
+// SmartMiFanAsync - Host Build: end-to-end smoke test
+// =============================================================================
+// Discovers a small fleet of emulated fans with per-device tokens and models,
+// then drives the blocking, async and fan-out command paths against them.
+// Each feature is one test function with a fresh fleet and library state.
+// =============================================================================
+
+#include <SmartMiFanAsync.h>
+#include <SmartMiFanFileStorage.h>
+
+#include <stdio.h>
+#include <string.h>
+
+#include "HostTest.h"
+#include "MiioFanEmulator.h"
+#include "internal/SmartMiFanInternal.h"
+
+namespace {
+
+const char* kTokens[] = {
+    "00112233445566778899aabbccddeeff",
+    "ffeeddccbbaa99887766554433221100",
+    "0f1e2d3c4b5a69788796a5b4c3d2e1f0",
+};
+
+// Three supported fans with their own tokens, plus a stranger that answers
+// hello but whose token is not configured (must never be registered)
+struct Fleet {
+  MiioFanEmulator za5{{IPAddress(192, 168, 1, 50), 0x1001, kTokens[0], "zhimi.fan.za5", nullptr, nullptr}};
+  MiioFanEmulator fan1c{{IPAddress(192, 168, 1, 51), 0x1002, kTokens[1], "dmaker.fan.1c", nullptr, nullptr}};
+  MiioFanEmulator p11{{IPAddress(192, 168, 1, 52), 0x1003, kTokens[2], "dmaker.fan.p11", nullptr, nullptr}};
+  MiioFanEmulator stranger{{IPAddress(192, 168, 1, 53), 0x1004, "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa",
+                            MiioFanEmulator::supportedModel(1), nullptr, nullptr}};
+  MiioFanEmulator* emulators[3] = {&za5, &fan1c, &p11};
+
+  void resetStats() {
+    for (MiioFanEmulator* emu : emulators) emu->resetStats();
+    stranger.resetStats();
+  }
+};
+
+int fanIndexOf(const MiioFanEmulator& emu) {
+  size_t count = 0;
+  const SmartMiFanDiscoveredDevice* fans = SmartMiFanAsync_getDiscoveredFans(count);
+  for (size_t i = 0; i < count; ++i) {
+    if (fans[i].ip == emu.nodeIp()) return static_cast<int>(i);
+  }
+  return -1;
+}
+
+uint8_t fanIndex(const MiioFanEmulator& emu) {
+  return static_cast<uint8_t>(fanIndexOf(emu));
+}
+
+void runUntilIdle(unsigned long maxMs) {
+  unsigned long start = millis();
+  while (SmartMiFanAsync_update() && millis() - start < maxMs) yield();
+}
+
+// Forget everything the previous test left behind (call before building its fleet)
+void resetLibrary() {
+  SmartMiFanAsync_cancelSmartConnect();
+  SmartMiFanAsync_cancelQuery();
+  SmartMiFanAsync_clearFastConnectConfig();
+  SmartMiFanAsync_resetDiscoveredFans();
+  SmartMiFanAsync_clearDiscoveryCache();
+  SmartMiFanAsync_clearExpectedFans();
+  SmartMiFanAsync_setExpectAllTokens(false);
+  SmartMiFanAsync_setKeepAliveEnabled(false);
+  SmartMiFanAsync_setSystemState(SystemState::ACTIVE);
+  SmartMiFanAsync_resetRxStats();
+  HostNetwork::reset();
+}
+
+bool runDiscovery(WiFiUDP& udp, uint32_t windowMs) {
+  HOST_CHECK(SmartMiFanAsync_startDiscovery(udp, kTokens, 3, windowMs));
+  unsigned long start = millis();
+  while (SmartMiFanAsync_updateDiscovery() && millis() - start < 60000) yield();
+  HOST_CHECK(SmartMiFanAsync_isDiscoveryComplete());
+  size_t count = 0;
+  SmartMiFanAsync_getDiscoveredFans(count);
+  HOST_CHECK_EQ(count, 3);
+  return SmartMiFanAsync_isDiscoveryComplete() && count == 3;
+}
+
+// Discovery probes every candidate with every token; the misses show up as
+// bad checksums on the emulators, so stats count from after it
+bool discoverFleet(Fleet& fleet, WiFiUDP& udp) {
+  bool ok = runDiscovery(udp, 1000);
+  fleet.resetStats();
+  return ok;
+}
+
+// =========================
+// Discovery
+// =========================
+
+void testDiscovery(WiFiUDP& udp) {
+  resetLibrary();
+  Fleet fleet;
+  if (!runDiscovery(udp, 1000)) return;
+
+  size_t count = 0;
+  const SmartMiFanDiscoveredDevice* fans = SmartMiFanAsync_getDiscoveredFans(count);
+  HOST_CHECK_EQ(fanIndexOf(fleet.stranger), -1);
+  for (MiioFanEmulator* emu : fleet.emulators) {
+    int idx = fanIndexOf(*emu);
+    HOST_CHECK(idx >= 0);
+    if (idx < 0) continue;
+    HOST_CHECK(strcmp(fans[idx].model, emu->model()) == 0);
+    HOST_CHECK_EQ(fans[idx].did, emu->did());
+  }
+}
+
+// Rediscovery uses the knowledge cache: each fan gets one probe with the
+// token that matched before, the stranger is not probed at all
+void testDiscoveryCache(WiFiUDP& udp) {
+  resetLibrary();
+  Fleet fleet;
+  if (!discoverFleet(fleet, udp)) return;
+
+  SmartMiFanAsync_resetDiscoveredFans();
+  if (!runDiscovery(udp, 1000)) return;
+  for (MiioFanEmulator* emu : fleet.emulators) {
+    HOST_CHECK_EQ(emu->stats().infoRequests, 1);
+    HOST_CHECK_EQ(emu->stats().badChecksum, 0);
+  }
+  HOST_CHECK_EQ(fleet.stranger.stats().badChecksum, 0);
+  HOST_CHECK_EQ(fanIndexOf(fleet.stranger), -1);
+}
+
+// After a reboot the knowledge cache comes back from storage: rediscovery
+// probes each fan once with its token and skips the stranger, as in RAM
+void testDiscoveryCacheRestore(WiFiUDP& udp) {
+  resetLibrary();
+  Fleet fleet;
+  if (!discoverFleet(fleet, udp)) return;
+
+  const char* cachePath = "smoke_test_discovery.bin";
+  SmartMiFanFileStorage storage(cachePath);
+  HOST_CHECK(SmartMiFanAsync_saveDiscoveryCache(storage));
+  uint8_t blob[1024];
+  size_t blobLen = SmartMiFanAsync_serializeDiscoveryCache(blob, sizeof(blob));
+  HOST_CHECK(blobLen > 0);
+  HOST_CHECK_EQ(blobLen, SmartMiFanAsync_serializeDiscoveryCache(nullptr, 0));
+  blob[blobLen / 2] ^= 0x01;
+  HOST_CHECK(!SmartMiFanAsync_deserializeDiscoveryCache(blob, blobLen));
+
+  SmartMiFanAsync_resetDiscoveredFans();
+  SmartMiFanAsync_clearDiscoveryCache();
+  HOST_CHECK(SmartMiFanAsync_restoreDiscoveryCache(storage));
+  remove(cachePath);
+  if (!runDiscovery(udp, 1000)) return;
+  for (MiioFanEmulator* emu : fleet.emulators) {
+    HOST_CHECK_EQ(emu->stats().infoRequests, 1);
+    HOST_CHECK_EQ(emu->stats().badChecksum, 0);
+  }
+  HOST_CHECK_EQ(fleet.stranger.stats().badChecksum, 0);
+  HOST_CHECK_EQ(fanIndexOf(fleet.stranger), -1);
+}
+
+// Early exit: with every token expected, a 5 s window ends once the three
+// fans are resolved. The answered miIO.info probe is a live session, so the
+// first command needs no hello.
+void testDiscoveryEarlyExit(WiFiUDP& udp) {
+  resetLibrary();
+  Fleet fleet;
+  SmartMiFanAsync_setExpectAllTokens(true);
+  unsigned long start = millis();
+  if (!runDiscovery(udp, 5000)) return;
+  HOST_CHECK(millis() - start < 1000);
+  SmartMiFanAsync_clearExpectedFans();
+
+  size_t count = 0;
+  const SmartMiFanDiscoveredDevice* fans = SmartMiFanAsync_getDiscoveredFans(count);
+  for (size_t i = 0; i < count; ++i) HOST_CHECK(fans[i].session.valid && fans[i].ready);
+  fleet.resetStats();
+  HOST_CHECK(SmartMiFanAsync_setFanPower(fanIndex(fleet.p11), true));
+  HOST_CHECK_EQ(fleet.p11.stats().hellos, 0);
+  HOST_CHECK_EQ(fleet.p11.stats().setRequests, 1);
+}
+
+// Keys that belong to no fan (device queries, standalone clients, removed
+// fans) take the spare AES schedule slots; a fan's schedule stays in place
+void testAesScheduleEviction(WiFiUDP& udp) {
+  resetLibrary();
+  Fleet fleet;
+  if (!discoverFleet(fleet, udp)) return;
+
+  size_t count = 0;
+  const SmartMiFanDiscoveredDevice* fans = SmartMiFanAsync_getDiscoveredFans(count);
+  SmartMiFanInternal::AesKeySchedule* schedules[3] = {};
+  for (size_t i = 0; i < count && i < 3; ++i) schedules[i] = &SmartMiFanInternal::aesScheduleFor(fans[i].cachedKey);
+  for (size_t k = 0; k < 2 * SmartMiFanInternal::kAesScheduleSlots; ++k) {
+    uint8_t foreignKey[16] = {0xA5, static_cast<uint8_t>(k)};
+    SmartMiFanInternal::aesScheduleFor(foreignKey);
+  }
+  for (size_t i = 0; i < count && i < 3; ++i) {
+    HOST_CHECK(schedules[i]->valid);
+    HOST_CHECK(memcmp(schedules[i]->key, fans[i].cachedKey, 16) == 0);
+  }
+}
+
+// =========================
+// Snapshots
+// =========================
+
+// Warm boot: a restored table equals the discovered one (crypto included,
+// session not), a corrupted snapshot leaves the table untouched, and restored
+// fans are commanded without being queried again
+void testWarmBootSnapshot(WiFiUDP& udp) {
+  resetLibrary();
+  Fleet fleet;
+  if (!discoverFleet(fleet, udp)) return;
+
+  const char* snapshotPath = "smoke_test_fans.bin";
+  SmartMiFanFileStorage storage(snapshotPath);
+  HOST_CHECK(SmartMiFanAsync_saveFans(storage));
+  size_t count = 0;
+  SmartMiFanDiscoveredDevice before[3];
+  memcpy(before, SmartMiFanAsync_getDiscoveredFans(count), sizeof(before));
+  SmartMiFanAsync_resetDiscoveredFans();
+  HOST_CHECK(SmartMiFanAsync_restoreFans(storage));
+  remove(snapshotPath);
+  const SmartMiFanDiscoveredDevice* fans = SmartMiFanAsync_getDiscoveredFans(count);
+  HOST_CHECK_EQ(count, 3);
+  for (size_t i = 0; i < count && i < 3; ++i) {
+    HOST_CHECK(fans[i].ip == before[i].ip);
+    HOST_CHECK_EQ(fans[i].did, before[i].did);
+    HOST_CHECK(strcmp(fans[i].model, before[i].model) == 0);
+    HOST_CHECK(strcmp(fans[i].token, before[i].token) == 0);
+    HOST_CHECK(memcmp(fans[i].cachedKey, before[i].cachedKey, 16) == 0);
+    HOST_CHECK(memcmp(fans[i].cachedIv, before[i].cachedIv, 16) == 0);
+    HOST_CHECK(fans[i].modelType == before[i].modelType);
+    HOST_CHECK(fans[i].cryptoCached);
+    HOST_CHECK(!fans[i].session.valid);
+  }
+
+  uint8_t snapshot[1024];
+  size_t snapshotLen = SmartMiFanAsync_serializeFans(snapshot, sizeof(snapshot));
+  HOST_CHECK(snapshotLen > 0);
+  HOST_CHECK_EQ(snapshotLen, SmartMiFanAsync_serializeFans(nullptr, 0));
+  snapshot[snapshotLen / 2] ^= 0x01;
+  HOST_CHECK(!SmartMiFanAsync_deserializeFans(snapshot, snapshotLen));
+  SmartMiFanAsync_getDiscoveredFans(count);
+  HOST_CHECK_EQ(count, 3);
+
+  for (MiioFanEmulator* emu : fleet.emulators) {
+    HOST_CHECK(SmartMiFanAsync_setFanPower(fanIndex(*emu), true));
+    HOST_CHECK_EQ(emu->property(2, 1), 1);
+    HOST_CHECK_EQ(emu->stats().hellos, 1);
+    HOST_CHECK_EQ(emu->stats().infoRequests, 0);
+    HOST_CHECK_EQ(emu->stats().badChecksum, 0);
+  }
+}
+
+// Deep sleep: table and sessions come back from retained memory and the
+// first command needs no hello; a fan that rebooted meanwhile ignores the
+// resumed session, so its command falls back to a hello and still completes
+void testDeepSleepResume(WiFiUDP& udp) {
+  resetLibrary();
+  Fleet fleet;
+  if (!discoverFleet(fleet, udp)) return;
+  uint8_t za5Idx = fanIndex(fleet.za5);
+  uint8_t fan1cIdx = fanIndex(fleet.fan1c);
+  uint8_t p11Idx = fanIndex(fleet.p11);
+
+  uint8_t retained[SMART_MI_FAN_SLEEP_SNAPSHOT_BYTES];
+  size_t retainedLen = SmartMiFanAsync_saveSleepSnapshot(retained, sizeof(retained));
+  HOST_CHECK(retainedLen > 0);
+  SmartMiFanAsync_prepareForSleep(true, false);
+  SmartMiFanAsync_resetDiscoveredFans();  // RAM is lost in deep sleep
+  delay(5000);
+  HOST_CHECK(SmartMiFanAsync_resumeFromSleep(retained, retainedLen, 5000));
+  SmartMiFanAsync_softWakeUp();
+  size_t count = 0;
+  const SmartMiFanDiscoveredDevice* fans = SmartMiFanAsync_getDiscoveredFans(count);
+  HOST_CHECK_EQ(count, 3);
+  for (size_t i = 0; i < count; ++i) HOST_CHECK(fans[i].session.valid && fans[i].session.resumed);
+
+  fleet.fan1c.reboot();
+  HOST_CHECK(SmartMiFanAsync_startSetFanPower(za5Idx, true));
+  HOST_CHECK(SmartMiFanAsync_startSetFanPower(fan1cIdx, true));
+  runUntilIdle(10000);
+  HOST_CHECK(SmartMiFanAsync_isCommandComplete(za5Idx));
+  HOST_CHECK(SmartMiFanAsync_isCommandComplete(fan1cIdx));
+  HOST_CHECK_EQ(fleet.za5.stats().hellos, 0);
+  HOST_CHECK_EQ(fleet.fan1c.stats().staleSession, 1);
+  HOST_CHECK_EQ(fleet.fan1c.stats().hellos, 1);
+  HOST_CHECK_EQ(fleet.fan1c.property(2, 1), 1);
+
+  // Same fallback on the blocking path
+  fleet.p11.reboot();
+  HOST_CHECK(SmartMiFanAsync_setFanPower(p11Idx, true));
+  HOST_CHECK_EQ(fleet.p11.stats().hellos, 1);
+  HOST_CHECK_EQ(fleet.p11.property(2, 1), 1);
+}
+
+// =========================
+// Commands
+// =========================
+
+void testBlockingCommands(WiFiUDP& udp) {
+  resetLibrary();
+  Fleet fleet;
+  if (!discoverFleet(fleet, udp)) return;
+  uint8_t za5Idx = fanIndex(fleet.za5);
+  uint8_t fan1cIdx = fanIndex(fleet.fan1c);
+
+  // Power and speed in one set_properties request
+  HOST_CHECK(SmartMiFanAsync_setFanState(za5Idx, true, 50));
+  HOST_CHECK_EQ(fleet.za5.property(2, 1), 1);
+  HOST_CHECK_EQ(fleet.za5.property(6, 8), 50);
+  HOST_CHECK_EQ(fleet.za5.stats().setRequests, 1);
+  // The client is unbound again, so shifting the fan table cannot strand it
+  size_t count = 0;
+  HOST_CHECK(&SmartMiFanAsync.getSession() != &SmartMiFanAsync_getDiscoveredFans(count)[za5Idx].session);
+
+  // dmaker.fan.1c quantizes speed to fan_level 1..3
+  HOST_CHECK(SmartMiFanAsync_setFanState(fan1cIdx, true, 60));
+  bool on = false;
+  uint8_t percent = 0;
+  HOST_CHECK(SmartMiFanAsync_getCachedFanState(fan1cIdx, on, percent));
+  HOST_CHECK(on);
+  HOST_CHECK_EQ(percent, 66);
+
+  // A read picks up a change made on the device itself
+  fleet.za5.setProperty(2, 1, 0);
+  HOST_CHECK(SmartMiFanAsync_readFanState(za5Idx));
+  HOST_CHECK(SmartMiFanAsync_getCachedFanState(za5Idx, on, percent));
+  HOST_CHECK(!on);
+  HOST_CHECK_EQ(percent, 50);
+}
+
+void testFanOut(WiFiUDP& udp) {
+  resetLibrary();
+  Fleet fleet;
+  if (!discoverFleet(fleet, udp)) return;
+
+  HOST_CHECK(SmartMiFanAsync_startSetPowerAll(true));
+  runUntilIdle(10000);
+  HOST_CHECK(!SmartMiFanAsync_isFanOutInProgress());
+  for (MiioFanEmulator* emu : fleet.emulators) {
+    HOST_CHECK_EQ(emu->property(2, 1), 1);
+    HOST_CHECK_EQ(emu->stats().setRequests, 1);
+  }
+}
+
+// Two orchestrated calls inside the cooldown: the first is sent, the second
+// waits in the coalescing slots and SmartMiFanAsync_update() sends it once
+// the cooldown ends, so every fan ends on the latest value
+void testCoalescedTrailingEdge(WiFiUDP& udp) {
+  resetLibrary();
+  Fleet fleet;
+  if (!discoverFleet(fleet, udp)) return;
+
+  HOST_CHECK(SmartMiFanAsync_setPowerAllOrchestrated(true));
+  HOST_CHECK(SmartMiFanAsync_setPowerAllOrchestrated(false));
+  for (MiioFanEmulator* emu : fleet.emulators) HOST_CHECK_EQ(emu->property(2, 1), 1);
+  runUntilIdle(10000);
+  for (MiioFanEmulator* emu : fleet.emulators) {
+    HOST_CHECK_EQ(emu->property(2, 1), 0);
+    HOST_CHECK_EQ(emu->stats().setRequests, 2);
+  }
+}
+
+int g_errorCallbacks = 0;
+
+void countError(const FanErrorInfo&) { ++g_errorCallbacks; }
+
+// A blocking command to one fan while another fan's async command waits for
+// its reply: the blocking hello must not rebind the shared socket, and the
+// async fan's replies read by the blocking loop go to its command, not away
+void testBlockingDuringAsync(WiFiUDP& udp) {
+  resetLibrary();
+  Fleet fleet;
+  if (!discoverFleet(fleet, udp)) return;
+  uint8_t za5Idx = fanIndex(fleet.za5);
+  uint8_t fan1cIdx = fanIndex(fleet.fan1c);
+
+  g_errorCallbacks = 0;
+  SmartMiFanAsync_setErrorCallback(countError);
+  SmartMiFanAsync_prepareForSleep(false, true);  // Both commands start with a hello
+  unsigned long start = millis();
+  HOST_CHECK(SmartMiFanAsync_startSetFanPower(za5Idx, true));
+  HOST_CHECK(SmartMiFanAsync_setFanPower(fan1cIdx, true));
+  HOST_CHECK(SmartMiFanAsync_isCommandComplete(za5Idx));  // Finished inside the blocking call
+  HOST_CHECK(millis() - start < 100);
+  SmartMiFanAsync_setErrorCallback(nullptr);
+  HOST_CHECK_EQ(g_errorCallbacks, 0);
+  size_t count = 0;
+  const SmartMiFanDiscoveredDevice* fans = SmartMiFanAsync_getDiscoveredFans(count);
+  HOST_CHECK(fans[fan1cIdx].lastError == MiioErr::OK);
+  for (MiioFanEmulator* emu : {&fleet.za5, &fleet.fan1c}) {
+    HOST_CHECK_EQ(emu->property(2, 1), 1);
+    HOST_CHECK_EQ(emu->stats().hellos, 1);
+    HOST_CHECK_EQ(emu->stats().repeatedRequests, 0);
+  }
+}
+
+// The command times out instead of hanging
+void testOfflineFan(WiFiUDP& udp) {
+  resetLibrary();
+  Fleet fleet;
+  if (!discoverFleet(fleet, udp)) return;
+  uint8_t p11Idx = fanIndex(fleet.p11);
+
+  fleet.p11.setOnline(false);
+  HOST_CHECK(SmartMiFanAsync_startSetFanPower(p11Idx, true));
+  runUntilIdle(10000);
+  HOST_CHECK(!SmartMiFanAsync_isCommandInProgress(p11Idx));
+  HOST_CHECK(!SmartMiFanAsync_isCommandComplete(p11Idx));
+  HOST_CHECK_EQ(fleet.p11.property(2, 1), 0);
+}
+
+// A command replacing the reconciler's in flight is not taken as the
+// reconciler's result: its timeout puts the fan in no retry backoff
+void testReconcilerOwnership(WiFiUDP& udp) {
+  resetLibrary();
+  Fleet fleet;
+  if (!discoverFleet(fleet, udp)) return;
+  uint8_t za5Idx = fanIndex(fleet.za5);
+
+  SmartMiFanAsync_setDesiredPower(za5Idx, true);
+  SmartMiFanAsync_update();
+  HOST_CHECK(SmartMiFanAsync_isCommandInProgress(za5Idx));
+  fleet.za5.dropReplies(2 + SMART_MI_FAN_MAX_RETRANSMITS);  // The reconciler's request and every send of the new one
+  unsigned long start = millis();
+  HOST_CHECK(SmartMiFanAsync_startSetFanSpeed(za5Idx, 30));
+  while (!SmartMiFanAsync_isCommandComplete(za5Idx) && millis() - start < 5000) {
+    SmartMiFanAsync_update();
+    yield();
+  }
+  HOST_CHECK(SmartMiFanAsync_isCommandComplete(za5Idx));
+  HOST_CHECK(millis() - start < 2000);  // 1500 ms ACK timeout, then the retry without a 1 s backoff
+  HOST_CHECK_EQ(fleet.za5.property(2, 1), 1);
+  SmartMiFanAsync_clearDesiredState(za5Idx);
+}
+
+// =========================
+// Sessions
+// =========================
+
+// Idle past the TTL, every session is refreshed once in the background and
+// the next command needs no hello; in SLEEP nothing is sent
+void testKeepAlive(WiFiUDP& udp) {
+  resetLibrary();
+  Fleet fleet;
+  if (!discoverFleet(fleet, udp)) return;
+  uint8_t za5Idx = fanIndex(fleet.za5);
+
+  SmartMiFanAsync_setKeepAliveEnabled(true);
+  unsigned long start = millis();
+  while (millis() - start < SMART_MI_FAN_HANDSHAKE_TTL_MS + 10000) {
+    SmartMiFanAsync_update();
+    delay(10);
+  }
+  size_t count = 0;
+  const SmartMiFanDiscoveredDevice* fans = SmartMiFanAsync_getDiscoveredFans(count);
+  for (MiioFanEmulator* emu : fleet.emulators) HOST_CHECK_EQ(emu->stats().hellos, 1);
+  for (size_t i = 0; i < count; ++i) HOST_CHECK(fans[i].session.valid);
+  HOST_CHECK(SmartMiFanAsync_startSetFanPower(za5Idx, true));
+  runUntilIdle(10000);
+  HOST_CHECK(SmartMiFanAsync_isCommandComplete(za5Idx));
+  HOST_CHECK_EQ(fleet.za5.stats().hellos, 1);
+
+  SmartMiFanAsync_setSystemState(SystemState::SLEEP);
+  fleet.resetStats();
+  start = millis();
+  while (millis() - start < SMART_MI_FAN_HANDSHAKE_TTL_MS + 10000) {
+    SmartMiFanAsync_update();
+    delay(10);
+  }
+  for (MiioFanEmulator* emu : fleet.emulators) HOST_CHECK_EQ(emu->stats().hellos, 0);
+}
+
+// Past the TTL, commands use the session with the extrapolated device clock
+// and need no hello (the emulator ignores stale timestamps); past the
+// optimistic window they do a hello first
+void testOptimisticSessions(WiFiUDP& udp) {
+  resetLibrary();
+  Fleet fleet;
+  if (!discoverFleet(fleet, udp)) return;
+  uint8_t za5Idx = fanIndex(fleet.za5);
+  uint8_t fan1cIdx = fanIndex(fleet.fan1c);
+
+  delay(5 * 60 * 1000UL);
+  HOST_CHECK(SmartMiFanAsync_startSetFanPower(za5Idx, true));
+  runUntilIdle(10000);
+  HOST_CHECK(SmartMiFanAsync_isCommandComplete(za5Idx));
+  HOST_CHECK(SmartMiFanAsync_setFanPower(fan1cIdx, true));
+  HOST_CHECK_EQ(fleet.fan1c.property(2, 1), 1);
+  for (MiioFanEmulator* emu : fleet.emulators) {
+    HOST_CHECK_EQ(emu->stats().hellos, 0);
+    HOST_CHECK_EQ(emu->stats().staleTimestamp, 0);
+  }
+
+  delay(SMART_MI_FAN_OPTIMISTIC_SESSION_MS);
+  HOST_CHECK(SmartMiFanAsync_startSetFanPower(za5Idx, false));
+  runUntilIdle(10000);
+  HOST_CHECK(SmartMiFanAsync_isCommandComplete(za5Idx));
+  HOST_CHECK_EQ(fleet.za5.stats().hellos, 1);
+}
+
+// One broadcast hello answers every fan; a silent fan gets unicast hellos.
+// A hello reply is not authenticated: a fan's DID from another address is
+// only followed once that address answers miIO.info with the fan's token.
+void testBroadcastHandshake(WiFiUDP& udp) {
+  resetLibrary();
+  Fleet fleet;
+  if (!discoverFleet(fleet, udp)) return;
+  uint8_t za5Idx = fanIndex(fleet.za5);
+  size_t count = 0;
+  const SmartMiFanDiscoveredDevice* fans = SmartMiFanAsync_getDiscoveredFans(count);
+
+  SmartMiFanAsync_prepareForSleep(false, true);
+  unsigned long start = millis();
+  HOST_CHECK(SmartMiFanAsync_handshakeAll());
+  HOST_CHECK(millis() - start < 100);
+  for (size_t i = 0; i < count; ++i) HOST_CHECK(fans[i].session.valid);
+  for (MiioFanEmulator* emu : fleet.emulators) HOST_CHECK_EQ(emu->stats().hellos, 1);
+  HOST_CHECK_EQ(fleet.stranger.stats().hellos, 1);  // Only a broadcast reaches it
+
+  {
+    // Neither while za5 answers from its own address, nor when za5 is silent
+    // and the claim fails the encrypted miIO.info
+    MiioFanEmulator spoof({IPAddress(192, 168, 1, 61), 0x1001, "bbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbb",
+                           "zhimi.fan.za5", nullptr, nullptr});
+    IPAddress za5Ip = fleet.za5.nodeIp();
+    HOST_CHECK(SmartMiFanAsync_refreshSessionsAll());
+    HOST_CHECK(fans[za5Idx].ip == za5Ip);
+    HOST_CHECK_EQ(spoof.stats().infoRequests + spoof.stats().badChecksum, 0);
+    fleet.za5.setOnline(false);
+    HOST_CHECK(!SmartMiFanAsync_refreshSessionsAll());
+    HOST_CHECK(fans[za5Idx].ip == za5Ip);
+    HOST_CHECK(spoof.stats().badChecksum > 0);
+    fleet.za5.setOnline(true);
+  }
+
+  fleet.resetStats();
+  fleet.za5.setIp(IPAddress(192, 168, 1, 60));
+  fleet.p11.setOnline(false);
+  HOST_CHECK(!SmartMiFanAsync_refreshSessionsAll());
+  HOST_CHECK(fans[za5Idx].ip == fleet.za5.nodeIp());
+  HOST_CHECK(fans[za5Idx].session.valid);
+  HOST_CHECK_EQ(fleet.za5.stats().hellos, 2);
+  HOST_CHECK_EQ(fleet.za5.stats().infoRequests, 1);
+  HOST_CHECK_EQ(fleet.fan1c.stats().hellos, 1);
+  HOST_CHECK(!fans[fanIndexOf(fleet.p11)].session.valid);
+}
+
+// Lost reply: the same frame goes out again once the fan's RTO (a few round
+// trips on a healthy link) expires, not after the 1500 ms ACK wait. A reply
+// after a resend is ambiguous and not sampled.
+void testRetransmission(WiFiUDP& udp) {
+  resetLibrary();
+  Fleet fleet;
+  if (!discoverFleet(fleet, udp)) return;
+  uint8_t za5Idx = fanIndex(fleet.za5);
+  uint8_t fan1cIdx = fanIndex(fleet.fan1c);
+
+  // Clean round trips first, so both fans have an estimate
+  HOST_CHECK(SmartMiFanAsync_setFanPower(za5Idx, false));
+  HOST_CHECK(SmartMiFanAsync_setFanPower(fan1cIdx, false));
+  SmartMiFanRttStats rtt{};
+  HOST_CHECK(SmartMiFanAsync_getFanRttStats(za5Idx, rtt));
+  HOST_CHECK(rtt.samples > 0);
+  HOST_CHECK_EQ(rtt.rtoMs, SMART_MI_FAN_RTO_MIN_MS);
+  uint32_t samples = rtt.samples;
+  fleet.resetStats();
+
+  // Async path
+  fleet.za5.dropReplies(1);
+  unsigned long start = millis();
+  HOST_CHECK(SmartMiFanAsync_startSetFanPower(za5Idx, true));
+  runUntilIdle(10000);
+  HOST_CHECK(SmartMiFanAsync_isCommandComplete(za5Idx));
+  HOST_CHECK(millis() - start < 500);
+  HOST_CHECK_EQ(fleet.za5.stats().repeatedRequests, 1);
+  HOST_CHECK_EQ(fleet.za5.stats().hellos, 0);
+  HOST_CHECK(SmartMiFanAsync_getFanRttStats(za5Idx, rtt));
+  HOST_CHECK_EQ(rtt.samples, samples);
+  HOST_CHECK(SmartMiFanAsync_startSetFanPower(za5Idx, false));
+  runUntilIdle(10000);
+  HOST_CHECK(SmartMiFanAsync_getFanRttStats(za5Idx, rtt));
+  HOST_CHECK_EQ(rtt.samples, samples + 1);
+
+  // Blocking path
+  HOST_CHECK(SmartMiFanAsync_getFanRttStats(fan1cIdx, rtt));
+  samples = rtt.samples;
+  fleet.fan1c.dropReplies(1);
+  start = millis();
+  HOST_CHECK(SmartMiFanAsync_setFanPower(fan1cIdx, true));
+  HOST_CHECK(millis() - start < 500);
+  HOST_CHECK_EQ(fleet.fan1c.stats().repeatedRequests, 1);
+  HOST_CHECK(SmartMiFanAsync_setFanPower(fan1cIdx, false));
+  HOST_CHECK(SmartMiFanAsync_getFanRttStats(fan1cIdx, rtt));
+  HOST_CHECK_EQ(rtt.samples, samples + 1);
+  HOST_CHECK(rtt.retransmits >= 1);
+}
+
+// =========================
+// Fast Connect
+// =========================
+
+// The validating hello becomes the fan's session
+void testFastConnect(WiFiUDP& udp) {
+  resetLibrary();
+  Fleet fleet;
+  const SmartMiFanFastConnectEntry fastConnect[] = {{"192.168.1.51", kTokens[1], "dmaker.fan.1c"}};
+  HOST_CHECK(SmartMiFanAsync_setFastConnectConfig(fastConnect, 1));
+  HOST_CHECK(SmartMiFanAsync_registerFastConnectFans(udp));
+  HOST_CHECK(SmartMiFanAsync_validateFastConnectFans(udp));
+  HOST_CHECK(SmartMiFanAsync_setFanPower(0, true));
+  HOST_CHECK_EQ(fleet.fan1c.stats().hellos, 1);
+  HOST_CHECK_EQ(fleet.fan1c.stats().setRequests, 1);
+  HOST_CHECK_EQ(fleet.fan1c.property(2, 1), 1);
+  SmartMiFanAsync_clearFastConnectConfig();
+}
+
+}  // namespace
+
+int main() {
+  // One socket for the whole run, as in a sketch: the library keeps a pointer
+  // to it and stops the previous socket when it is handed a new one
+  WiFiUDP udp;
+  testDiscovery(udp);
+  testDiscoveryCache(udp);
+  testDiscoveryCacheRestore(udp);
+  testDiscoveryEarlyExit(udp);
+  testAesScheduleEviction(udp);
+  testWarmBootSnapshot(udp);
+  testDeepSleepResume(udp);
+  testBlockingCommands(udp);
+  testFanOut(udp);
+  testCoalescedTrailingEdge(udp);
+  testBlockingDuringAsync(udp);
+  testOfflineFan(udp);
+  testReconcilerOwnership(udp);
+  testKeepAlive(udp);
+  testOptimisticSessions(udp);
+  testBroadcastHandshake(udp);
+  testRetransmission(udp);
+  testFastConnect(udp);
+  return hostTestResult("smoke_test");
+}
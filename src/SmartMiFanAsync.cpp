@@ -17,5 +17,10 @@
 #include "internal/SmartMiFanCore.inl"
 #include "internal/SmartMiFanClient.inl"
 #include "internal/SmartMiFanDiscovery.inl"
+#include "internal/SmartMiFanDiscoveryCache.inl"
+#include "internal/SmartMiFanSnapshot.inl"
 #include "internal/SmartMiFanConnect.inl"
 #include "internal/SmartMiFanOrchestration.inl"
+#include "internal/SmartMiFanCommand.inl"
+#include "internal/SmartMiFanReconcile.inl"
+#include "internal/SmartMiFanKeepAlive.inl"
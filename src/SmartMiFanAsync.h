@@ -70,6 +70,121 @@
 #define SMART_MI_FAN_HANDSHAKE_TTL_MS 60000  // 60 seconds default
 #endif
 
+// Sessions past the TTL but younger than this are used without a hello: the
+// device clock is extrapolated from the last hello/reply, and a request the
+// device does not answer falls back to a hello and is sent again.
+// Set to 0 (or <= TTL) to always do a hello once the TTL has expired.
+#ifndef SMART_MI_FAN_OPTIMISTIC_SESSION_MS
+#define SMART_MI_FAN_OPTIMISTIC_SESSION_MS 3600000  // 1 hour default
+#endif
+
+// =========================
+// Adaptive Timeouts and Retransmission
+// =========================
+// Each fan keeps a smoothed round-trip time and its variance (TCP-style, from
+// replies to hellos and requests sent once). A hello or request that is not
+// answered within the retransmission timeout (RTO) is sent again unchanged
+// (same frame, same message id) with the timeout doubled each time. The old
+// fixed waits remain the upper bound: 2000 ms per handshake, 1500 ms per ACK.
+#ifndef SMART_MI_FAN_RTO_MIN_MS
+#define SMART_MI_FAN_RTO_MIN_MS 100
+#endif
+#ifndef SMART_MI_FAN_RTO_MAX_MS
+#define SMART_MI_FAN_RTO_MAX_MS 1000
+#endif
+// RTO for a fan without a round-trip sample yet
+#ifndef SMART_MI_FAN_RTO_INITIAL_MS
+#define SMART_MI_FAN_RTO_INITIAL_MS 500
+#endif
+// Resends of one hello or request before it times out (0 = never resend)
+#ifndef SMART_MI_FAN_MAX_RETRANSMITS
+#define SMART_MI_FAN_MAX_RETRANSMITS 3
+#endif
+
+// =========================
+// Session Keep-Alive (Optional)
+// =========================
+// SmartMiFanAsync_update() refreshes each idle fan's session with a hello
+// shortly before the TTL runs out, so commands find a warm session.
+// Paused while SmartMiFanAsync_setSystemState(SystemState::SLEEP).
+// Can also be enabled/disabled at runtime via SmartMiFanAsync_setKeepAliveEnabled()
+#ifndef SMART_MI_FAN_KEEPALIVE_ENABLED
+#define SMART_MI_FAN_KEEPALIVE_ENABLED 0
+#endif
+// Refresh window before TTL expiry; fans are spread over its first half
+#ifndef SMART_MI_FAN_KEEPALIVE_LEAD_MS
+#define SMART_MI_FAN_KEEPALIVE_LEAD_MS 10000
+#endif
+
+// =========================
+// Parallel Fan-Out
+// =========================
+// Orchestrated *All commands send to every ACTIVE fan back-to-back and
+// collect the ACKs in one receive loop instead of one fan after another.
+// Can also be enabled/disabled at runtime via SmartMiFanAsync_setFanOutEnabled()
+#ifndef SMART_MI_FAN_FANOUT_ENABLED
+#define SMART_MI_FAN_FANOUT_ENABLED 1
+#endif
+
+// Shared deadline for one fan-out (ms): covers a hello (2000) plus the ACK (1500)
+#ifndef SMART_MI_FAN_FANOUT_DEADLINE_MS
+#define SMART_MI_FAN_FANOUT_DEADLINE_MS 3500
+#endif
+
+// =========================
+// Pipelined Discovery
+// =========================
+// miIO.info probes kept in flight at once across candidates and tokens.
+// A probe with a wrong token is never answered and holds its slot for 2s.
+#ifndef SMART_MI_FAN_DISCOVERY_MAX_INFLIGHT
+#define SMART_MI_FAN_DISCOVERY_MAX_INFLIGHT 16
+#endif
+
+// 1 = send every token of a candidate back-to-back (the right one answers
+// within one RTT and the others are dropped); 0 = one token per candidate
+// per round, which spreads slots evenly when many candidates are unmanaged
+#ifndef SMART_MI_FAN_DISCOVERY_TOKEN_BURST
+#define SMART_MI_FAN_DISCOVERY_TOKEN_BURST 1
+#endif
+
+// Max tokens per discovery run. Key/IV and AES schedules of every token are
+// derived once in startDiscovery(); more tokens are rejected.
+#ifndef SMART_MI_FAN_DISCOVERY_MAX_TOKENS
+#define SMART_MI_FAN_DISCOVERY_MAX_TOKENS 16
+#endif
+
+// =========================
+// Discovery Knowledge Cache
+// =========================
+// Devices remembered across discovery runs, keyed by the hello deviceId:
+// the token/model that matched (probed first next time) and devices that are
+// not fans or matched no token (skipped while the token list is unchanged).
+// Can also be enabled/disabled at runtime via SmartMiFanAsync_setDiscoveryCacheEnabled()
+#ifndef SMART_MI_FAN_DISCOVERY_CACHE_SIZE
+#define SMART_MI_FAN_DISCOVERY_CACHE_SIZE 32
+#endif
+
+// =========================
+// Deep-Sleep Snapshot
+// =========================
+// Size of the caller's retained buffer for SmartMiFanAsync_saveSleepSnapshot()
+// (fan table + sessions of kMaxSmartMiFans fans), e.g. RTC_DATA_ATTR memory
+#define SMART_MI_FAN_SLEEP_SNAPSHOT_BYTES 2048
+
+// =========================
+// Multi-Property Commands
+// =========================
+// Max property writes encoded into one set_properties request
+// (4 x ~40 bytes of JSON still fits one 256-byte cipher block)
+#ifndef SMART_MI_FAN_MAX_PROPERTY_WRITES
+#define SMART_MI_FAN_MAX_PROPERTY_WRITES 4
+#endif
+
+// Property values kept per fan (read back via get_properties or acknowledged writes)
+#ifndef SMART_MI_FAN_PROPERTY_CACHE_SIZE
+#define SMART_MI_FAN_PROPERTY_CACHE_SIZE 6
+#endif
+
 /* Example: Async discovery mode
 #include <WiFi.h>
 #include <WiFiUdp.h>
@@ -141,6 +256,15 @@ enum class QueryState {
   TIMEOUT
 };
 
+enum class CommandState {
+  IDLE,
+  WAITING_HELLO,
+  WAITING_ACK,
+  COMPLETE,
+  ERROR,
+  TIMEOUT
+};
+
 enum class SmartConnectState {
   IDLE,
   VALIDATING_FAST_CONNECT,
@@ -171,7 +295,8 @@ enum class FanOp {
 // This enum is part of the public API for project-level system state management.
 // The library never sets or changes system state internally; it only exposes
 // hooks for project code to integrate with system state transitions.
-// Projects define their own state machines using this enum.
+// Projects define their own state machines using this enum and may report it
+// via SmartMiFanAsync_setSystemState() (the session keep-alive pauses in SLEEP).
 enum class SystemState {
   ACTIVE,   // BLE sensors connected OR Web/UI interaction OR first outgoing fan command
   IDLE,     // no BLE sensors, no UI interaction, system remains awake
@@ -225,6 +350,19 @@ inline void ipToStr(const IPAddress& ip, char* out, size_t outSize) {
   snprintf(out, outSize, "%u.%u.%u.%u", ip[0], ip[1], ip[2], ip[3]);
 }
 
+// Per-fan miIO session
+// Result of the last hello handshake with one fan. Kept per fan so that
+// switching the client between fans does not force a fresh handshake.
+struct SmartMiFanSession {
+  uint8_t deviceId[4];            // Device ID from hello reply
+  uint32_t deviceTimestamp;       // Last device timestamp used (hello reply or last request)
+  unsigned long handshakeMillis;  // millis() of last successful handshake or matched reply
+  uint32_t anchorTimestamp;       // Device clock (seconds) at handshakeMillis, for extrapolation
+  bool valid;                     // true after successful handshake, cleared on error/timeout
+  bool resumed;                   // Restored from a sleep snapshot or used past the TTL, and not
+                                  // answered since: a lost request falls back to a fresh hello
+};
+
 struct SmartMiFanDiscoveredDevice {
   IPAddress ip;
   uint32_t did;
@@ -233,18 +371,22 @@ struct SmartMiFanDiscoveredDevice {
   char fw_ver[16];
   char hw_ver[16];
   // Step 2: Per-fan readiness state
-  bool ready;          // true only after successful handshake
+  bool ready;          // true only after successful handshake (or discovery probe)
   MiioErr lastError;   // last error encountered
   // Step 3: Fan participation state
   bool userEnabled;   // user/project intent: true = enabled, false = disabled (default: true)
   
   // Phase 3: Cached crypto data (computed once, reused on every command)
-  // Saves ~250μs per command (2x MD5 + hex parsing)
+  // Saves 2x MD5 + hex parsing per command (microbench: uncachedFanCrypto)
   uint8_t tokenBytes[16];    // Parsed token bytes (from hex string)
   uint8_t cachedKey[16];     // AES key derived from token
   uint8_t cachedIv[16];      // AES IV derived from token
   FanModelType modelType;    // Cached model type for O(1) lookup
   bool cryptoCached;         // true if tokenBytes/cachedKey/cachedIv are valid
+
+  // Per-fan session (deviceId, device timestamp, handshake time)
+  // Used together with cachedKey/cachedIv when commands are addressed by fan index
+  SmartMiFanSession session;
 };
 
 // Fast Connect Configuration Entry
@@ -281,6 +423,81 @@ struct FanErrorInfo {
 // Callback must never block, trigger retries, or modify discovery/smart connect state
 typedef void (*FanErrorCallback)(const FanErrorInfo&);
 
+// One MIoT property write in a set_properties request
+// Several writes to the same fan are sent in one packet (one "params" array)
+struct FanPropertyWrite {
+  int siid;
+  int piid;
+  int value;
+  bool isBool;  // Encode value as JSON true/false
+};
+
+// One MIoT property to read in a get_properties request
+struct FanPropertyId {
+  int siid;
+  int piid;
+};
+
+// Property value from the per-fan cache
+struct FanPropertyValue {
+  int siid;
+  int piid;
+  int value;                    // Booleans as 0/1
+  unsigned long updatedMillis;  // millis() when read back or acknowledged
+};
+
+// Async Command Result
+// Reported once per command when it reaches COMPLETE, ERROR or TIMEOUT
+struct FanCommandResult {
+  uint8_t fanIndex;
+  CommandState state;
+  MiioErr error;
+  uint32_t elapsedMs;
+};
+
+// Async Command Callback Function Type
+// Called from SmartMiFanAsync_update(); must not block
+typedef void (*FanCommandCallback)(const FanCommandResult&);
+
+// Receive Statistics (miIO reply demultiplexer)
+// Every reply is decrypted once and routed by source IP and JSON "id" to the
+// request waiting for it; everything else is dropped and counted here.
+struct SmartMiFanRxStats {
+  uint32_t received;        // Packets read while requests were pending
+  uint32_t matched;         // Routed to a pending request (hello or id match)
+  uint32_t unknownSource;   // Sender is not a discovered fan / not the target
+  uint32_t unmatched;       // Known fan, but no pending request with that id (late/duplicate reply)
+  uint32_t decryptFailed;   // Payload did not decrypt to JSON with the fan's key
+  uint32_t malformed;       // Wrong length (too short, too long, not block aligned)
+};
+
+// Round-trip statistics of one fan (adaptive timeouts)
+struct SmartMiFanRttStats {
+  uint32_t srttMs;          // Smoothed round-trip time (0 before the first sample)
+  uint32_t rttVarMs;        // Smoothed mean deviation of the round-trip time
+  uint32_t rtoMs;           // Current retransmission timeout
+  uint32_t samples;         // Round trips measured (replies to hellos/requests sent once)
+  uint32_t retransmits;     // Hellos and requests resent after their RTO expired
+};
+
+// Fan-Out Callback
+// Called once per fan-out when every fan has answered or the deadline expired
+// Parameters: one result per fan that took part, count of results
+typedef void (*FanOutCallback)(const FanCommandResult results[], size_t count);
+
+// Fan Table Snapshot Storage
+// Backend for SmartMiFanAsync_saveFans()/restoreFans(): holds one opaque blob.
+// Ready-made backends: SmartMiFanPreferencesStorage.h (ESP32 NVS) and
+// SmartMiFanFileStorage.h (stdio file, e.g. LittleFS or the Linux host build).
+class SmartMiFanStorage {
+public:
+  virtual ~SmartMiFanStorage() {}
+  // Replace the stored blob. Returns false if it could not be written.
+  virtual bool write(const uint8_t *data, size_t len) = 0;
+  // Copy the stored blob into data. Returns its length, 0 if none or larger than cap.
+  virtual size_t read(uint8_t *data, size_t cap) = 0;
+};
+
 class SmartMiFanAsyncClient {
 public:
   SmartMiFanAsyncClient();
@@ -315,14 +532,30 @@ public:
 
   bool setPower(bool on);
   bool setSpeed(uint8_t percent);
+  // Power and speed in one set_properties request (one round trip, applied together)
+  bool setPowerAndSpeed(bool on, uint8_t percent);
+  // Up to SMART_MI_FAN_MAX_PROPERTY_WRITES writes in one set_properties request
+  bool setProperties(const FanPropertyWrite *props, size_t count);
+  // Read up to SMART_MI_FAN_MAX_PROPERTY_WRITES properties in one get_properties request
+  // out receives one entry per property the device reported (outCount)
+  bool getProperties(const FanPropertyId *props, size_t count, FanPropertyValue out[], size_t &outCount);
+  // Read power and speed (speed mapped back to percent for the model)
+  bool readPowerAndSpeed(bool &on, uint8_t &percent);
 
   void setGlobalSpeed(uint8_t percent);
   uint8_t getGlobalSpeed() const;
 
   bool setTokenFromHex(const char *tokenHex);
   void setToken(const uint8_t token[16]);
+  // Set token together with its already derived key/IV (skips 2x MD5)
+  void setTokenCached(const uint8_t token[16], const uint8_t key[16], const uint8_t iv[16]);
   const uint8_t *getToken() const { return _token; }
 
+  // Bind handshake state to an external per-fan session (nullptr = client's own session)
+  // A bound session is not invalidated by setFanAddress(); attachUdp() unbinds it
+  void useSession(SmartMiFanSession *session);
+  const SmartMiFanSession &getSession() const { return *_session; }
+
   void setFanAddress(const IPAddress &fanAddress);
   IPAddress getFanAddress() const { return _fanAddress; }
 
@@ -331,17 +564,15 @@ public:
   const char *getModel() const { return _model; }
   FanModelType getModelType() const { return _modelType; }
 
-  bool isReady() const { return _ready; }
+  bool isReady() const { return _session->valid; }
 
   void attachUdp(WiFiUDP &udp);
 
 private:
-  bool miotSetPropertyUint(const char *name, int siid, int piid, int value);
-  bool miotSetPropertyBool(const char *name, int siid, int piid, bool value);
+  bool exchangeRequest(const char *json, uint32_t msgId, const char *&reply);
   void closeSession();
   void deriveKeyIv();
   bool hexToBytes16(const char *hex, uint8_t *out16);
-  size_t encryptPayload(const uint8_t *plain, size_t len, uint8_t *out, size_t outCap);
   void cacheModelType();  // Convert model string to enum for O(1) lookup
 
   WiFiUDP *_udp;
@@ -349,11 +580,8 @@ private:
   uint8_t _token[16];
   uint8_t _key[16];
   uint8_t _iv0[16];
-  uint8_t _deviceId[4];
-  uint32_t _deviceTimestamp;
-  bool _ready;
-  bool _handshakeValid;  // Cache flag: handshake is valid until error
-  unsigned long _lastHandshakeMillis;  // Timestamp of last successful handshake
+  SmartMiFanSession _ownSession;  // Used when no per-fan session is bound
+  SmartMiFanSession *_session;    // Active session (never nullptr)
   uint8_t _globalSpeed;
   char _model[24];
   FanModelType _modelType;  // Cached for O(1) speed param lookup
@@ -373,6 +601,40 @@ bool SmartMiFanAsync_isDiscoveryComplete();
 bool SmartMiFanAsync_isDiscoveryInProgress();
 void SmartMiFanAsync_cancelDiscovery();
 
+// Expected Fans API (early exit)
+// Discovery completes as soon as every configured expectation is met instead
+// of waiting for the hello window and the remaining probes. Settings persist
+// across runs until cleared.
+void SmartMiFanAsync_setExpectedFanCount(size_t count);
+bool SmartMiFanAsync_setExpectedFanDids(const uint32_t dids[], size_t count);
+void SmartMiFanAsync_setExpectAllTokens(bool enabled);
+void SmartMiFanAsync_clearExpectedFans();
+
+// Discovery Knowledge Cache API (kept across discovery runs; across reboots
+// through saveDiscoveryCache()/restoreDiscoveryCache(), in its own storage blob)
+void SmartMiFanAsync_setDiscoveryCacheEnabled(bool enabled);
+bool SmartMiFanAsync_isDiscoveryCacheEnabled();
+void SmartMiFanAsync_clearDiscoveryCache();
+size_t SmartMiFanAsync_serializeDiscoveryCache(uint8_t *out, size_t cap);  // out == nullptr: required size
+bool SmartMiFanAsync_deserializeDiscoveryCache(const uint8_t *data, size_t len);
+bool SmartMiFanAsync_saveDiscoveryCache(SmartMiFanStorage &storage);
+bool SmartMiFanAsync_restoreDiscoveryCache(SmartMiFanStorage &storage);
+
+// Fan Table Snapshot API (warm boot: restore the table instead of Smart Connect)
+// Restored fans keep their cached crypto but no session; the first command
+// does a fresh hello and fails like any other if the fan moved or changed token.
+size_t SmartMiFanAsync_serializeFans(uint8_t *out, size_t cap);  // out == nullptr: required size
+bool SmartMiFanAsync_deserializeFans(const uint8_t *data, size_t len);
+bool SmartMiFanAsync_saveFans(SmartMiFanStorage &storage);
+bool SmartMiFanAsync_restoreFans(SmartMiFanStorage &storage);
+
+// Deep-Sleep Snapshot API (fan table + sessions into caller-provided retained memory)
+// Resumed sessions younger than SMART_MI_FAN_OPTIMISTIC_SESSION_MS (at least the TTL)
+// are used without a hello, past the TTL with an extrapolated device clock; if the
+// device no longer accepts one, the command falls back to a hello and completes.
+size_t SmartMiFanAsync_saveSleepSnapshot(uint8_t *out, size_t cap);  // out == nullptr: required size
+bool SmartMiFanAsync_resumeFromSleep(const uint8_t *data, size_t len, uint32_t sleptMs);
+
 // Async Query API
 bool SmartMiFanAsync_startQueryDevice(WiFiUDP &udp, const IPAddress &ip, const char *tokenHex);
 bool SmartMiFanAsync_updateQueryDevice();
@@ -385,10 +647,79 @@ void SmartMiFanAsync_cancelQuery();
 void SmartMiFanAsync_resetDiscoveredFans();
 const SmartMiFanDiscoveredDevice *SmartMiFanAsync_getDiscoveredFans(size_t &count);
 void SmartMiFanAsync_printDiscoveredFans();
+// Fans without a fresh session are handshaked with one broadcast hello
+// (unicast only for fans that do not answer it)
 bool SmartMiFanAsync_handshakeAll();
+// Fresh hello for every enabled fan, valid session or not: one broadcast, then
+// unicast for silent fans. Re-handshakes N fans in about one round trip.
+bool SmartMiFanAsync_refreshSessionsAll();
 bool SmartMiFanAsync_setPowerAll(bool on);
 bool SmartMiFanAsync_setSpeedAll(uint8_t percent);
 
+// Per-fan control (addressed by fan index, reuses the fan's session)
+bool SmartMiFanAsync_handshakeFan(uint8_t fanIndex);
+bool SmartMiFanAsync_setFanPower(uint8_t fanIndex, bool on);
+bool SmartMiFanAsync_setFanSpeed(uint8_t fanIndex, uint8_t percent);
+bool SmartMiFanAsync_setFanState(uint8_t fanIndex, bool on, uint8_t percent);
+bool SmartMiFanAsync_setFanProperties(uint8_t fanIndex, const FanPropertyWrite props[], size_t count);
+bool SmartMiFanAsync_readFanState(uint8_t fanIndex);
+bool SmartMiFanAsync_readFanProperties(uint8_t fanIndex, const FanPropertyId props[], size_t count);
+
+// Async Command API (non-blocking, one command in flight per fan)
+// start* sends immediately (or a hello first if the fan's session is stale);
+// SmartMiFanAsync_update() drives all pending commands from loop().
+// Starting a new command on a fan supersedes the one in flight.
+// Not available while discovery or a device query is running (shared socket).
+bool SmartMiFanAsync_startSetFanPower(uint8_t fanIndex, bool on);
+bool SmartMiFanAsync_startSetFanSpeed(uint8_t fanIndex, uint8_t percent);
+bool SmartMiFanAsync_startSetFanState(uint8_t fanIndex, bool on, uint8_t percent);
+bool SmartMiFanAsync_startSetFanProperties(uint8_t fanIndex, const FanPropertyWrite props[], size_t count);
+bool SmartMiFanAsync_startReadFanState(uint8_t fanIndex);
+bool SmartMiFanAsync_startReadFanProperties(uint8_t fanIndex, const FanPropertyId props[], size_t count);
+bool SmartMiFanAsync_update();
+CommandState SmartMiFanAsync_getCommandState(uint8_t fanIndex);
+bool SmartMiFanAsync_isCommandComplete(uint8_t fanIndex);
+bool SmartMiFanAsync_isCommandInProgress(uint8_t fanIndex);
+void SmartMiFanAsync_cancelCommand(uint8_t fanIndex);
+void SmartMiFanAsync_cancelAllCommands();
+void SmartMiFanAsync_setCommandCallback(FanCommandCallback cb);
+void SmartMiFanAsync_getRxStats(SmartMiFanRxStats &out);
+void SmartMiFanAsync_resetRxStats();
+bool SmartMiFanAsync_getFanRttStats(uint8_t fanIndex, SmartMiFanRttStats &out);
+
+// Property Cache API (no network traffic)
+// Filled by get_properties reads and by acknowledged set_properties writes.
+bool SmartMiFanAsync_getCachedProperty(uint8_t fanIndex, int siid, int piid, FanPropertyValue &out);
+bool SmartMiFanAsync_getCachedFanState(uint8_t fanIndex, bool &on, uint8_t &percent, uint32_t *ageMs = nullptr);
+void SmartMiFanAsync_clearPropertyCache(uint8_t fanIndex);
+
+// Desired State API (declarative control)
+// Set what a fan (or all fans) should be; SmartMiFanAsync_update() sends only
+// the writes that differ from the cached (acknowledged / read-back) state and
+// retries failed fans with backoff until they converge. Speed is compared after
+// model quantization. INACTIVE (user-disabled) fans are not reconciled.
+void SmartMiFanAsync_setDesiredPower(uint8_t fanIndex, bool on);
+void SmartMiFanAsync_setDesiredSpeed(uint8_t fanIndex, uint8_t percent);
+void SmartMiFanAsync_setDesiredState(uint8_t fanIndex, bool on, uint8_t percent);
+void SmartMiFanAsync_setDesiredPowerAll(bool on);
+void SmartMiFanAsync_setDesiredSpeedAll(uint8_t percent);
+void SmartMiFanAsync_setDesiredStateAll(bool on, uint8_t percent);
+void SmartMiFanAsync_clearDesiredState(uint8_t fanIndex);
+bool SmartMiFanAsync_isFanConverged(uint8_t fanIndex);
+bool SmartMiFanAsync_isConverged();
+
+// Parallel Fan-Out API (non-blocking)
+// Starts an async command on every ACTIVE fan at once; replies are collected
+// by SmartMiFanAsync_update() until all fans answered or deadlineMs expired.
+// A new fan-out replaces one still in progress.
+bool SmartMiFanAsync_startSetPowerAll(bool on, unsigned long deadlineMs = SMART_MI_FAN_FANOUT_DEADLINE_MS);
+bool SmartMiFanAsync_startSetSpeedAll(uint8_t percent, unsigned long deadlineMs = SMART_MI_FAN_FANOUT_DEADLINE_MS);
+bool SmartMiFanAsync_startSetStateAll(bool on, uint8_t percent, unsigned long deadlineMs = SMART_MI_FAN_FANOUT_DEADLINE_MS);
+bool SmartMiFanAsync_isFanOutInProgress();
+void SmartMiFanAsync_setFanOutCallback(FanOutCallback cb);
+bool SmartMiFanAsync_isFanOutEnabled();
+void SmartMiFanAsync_setFanOutEnabled(bool enabled);
+
 // Fast Connect API (Optional)
 bool SmartMiFanAsync_setFastConnectConfig(const SmartMiFanFastConnectEntry entries[], size_t count);
 void SmartMiFanAsync_clearFastConnectConfig();
@@ -419,6 +750,12 @@ bool SmartMiFanAsync_healthCheckAll(uint32_t timeoutMs);
 void SmartMiFanAsync_prepareForSleep(bool closeUdp, bool invalidateHandshake);
 void SmartMiFanAsync_softWakeUp();
 
+// Session Keep-Alive API (driven by SmartMiFanAsync_update())
+void SmartMiFanAsync_setKeepAliveEnabled(bool enabled);
+bool SmartMiFanAsync_isKeepAliveEnabled();
+void SmartMiFanAsync_setSystemState(SystemState state);
+SystemState SmartMiFanAsync_getSystemState();
+
 // Step 3: Fan Participation State API
 // Get fan participation state (derived from userEnabled and lastError)
 // ERROR state is derived ONLY from lastError != OK (not from ready==false)
@@ -439,8 +776,14 @@ void SmartMiFanAsync_setFanSoftActive(uint8_t fanIndex, bool enabled);
 // - Only ACTIVE fans receive commands
 // - INACTIVE and ERROR fans are skipped
 // - Commands are sent in deterministic order (Fan 0 → 1 → 2 → 3)
-// - Command coalescing: max 1 command per second
+// - With fan-out enabled all fans are sent to first, then ACKs are collected
+//   (blocks until all ACKs or SMART_MI_FAN_FANOUT_DEADLINE_MS)
+// - Command coalescing: max 1 send per 100ms. Calls within the cooldown
+//   return true and store the value per fan and property (latest wins); the
+//   last value is sent when the cooldown ends (next call or SmartMiFanAsync_update())
 bool SmartMiFanAsync_setPowerAllOrchestrated(bool on);
 bool SmartMiFanAsync_setSpeedAllOrchestrated(uint8_t percent);
+// Power and speed in one request per fan (halves packets for "turn on at N%")
+bool SmartMiFanAsync_setStateAllOrchestrated(bool on, uint8_t percent);
 bool SmartMiFanAsync_handshakeAllOrchestrated();
 
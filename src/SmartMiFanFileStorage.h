@@ -0,0 +1,37 @@
+#pragma once
+
+// =============================================================================
+// SmartMiFanAsync - File snapshot storage (stdio)
+// =============================================================================
+// Keeps the fan table snapshot in one file. Works with any mounted VFS path on
+// the ESP32 (e.g. "/littlefs/fans.bin" after LittleFS.begin()) and on the
+// Linux host build.
+// =============================================================================
+
+#include <stdio.h>
+
+#include "SmartMiFanAsync.h"
+
+class SmartMiFanFileStorage : public SmartMiFanStorage {
+public:
+  explicit SmartMiFanFileStorage(const char *path) : _path(path) {}
+
+  bool write(const uint8_t *data, size_t len) override {
+    FILE *f = fopen(_path, "wb");
+    if (!f) return false;
+    bool ok = fwrite(data, 1, len, f) == len;
+    return fclose(f) == 0 && ok;
+  }
+
+  size_t read(uint8_t *data, size_t cap) override {
+    FILE *f = fopen(_path, "rb");
+    if (!f) return 0;
+    size_t len = fread(data, 1, cap, f);
+    bool truncated = len == cap && fgetc(f) != EOF;  // Larger than cap: reject, do not cut
+    fclose(f);
+    return truncated ? 0 : len;
+  }
+
+private:
+  const char *_path;
+};
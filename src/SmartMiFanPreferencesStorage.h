@@ -0,0 +1,44 @@
+#pragma once
+
+// =============================================================================
+// SmartMiFanAsync - NVS snapshot storage (ESP32 Preferences)
+// =============================================================================
+// Keeps the fan table snapshot as one Preferences bytes entry:
+//
+//   SmartMiFanPreferencesStorage storage;            // namespace "smartmifan", key "fans"
+//   if (!SmartMiFanAsync_restoreFans(storage)) {
+//     ... Smart Connect, then SmartMiFanAsync_saveFans(storage);
+//   }
+// =============================================================================
+
+#include <Preferences.h>
+
+#include "SmartMiFanAsync.h"
+
+class SmartMiFanPreferencesStorage : public SmartMiFanStorage {
+public:
+  explicit SmartMiFanPreferencesStorage(const char *ns = "smartmifan", const char *key = "fans")
+      : _ns(ns), _key(key) {}
+
+  bool write(const uint8_t *data, size_t len) override {
+    Preferences prefs;
+    if (!prefs.begin(_ns, false)) return false;
+    size_t written = prefs.putBytes(_key, data, len);
+    prefs.end();
+    return written == len;
+  }
+
+  size_t read(uint8_t *data, size_t cap) override {
+    Preferences prefs;
+    if (!prefs.begin(_ns, true)) return 0;  // Namespace does not exist yet
+    size_t len = prefs.getBytesLength(_key);
+    if (len > cap) len = 0;
+    if (len > 0) len = prefs.getBytes(_key, data, len);
+    prefs.end();
+    return len;
+  }
+
+private:
+  const char *_ns;
+  const char *_key;
+};
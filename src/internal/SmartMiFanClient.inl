@@ -14,22 +14,20 @@ SmartMiFanAsyncClient SmartMiFanAsync;
 SmartMiFanAsyncClient::SmartMiFanAsyncClient()
     : _udp(nullptr),
       _fanAddress(),
-      _deviceTimestamp(0),
-      _ready(false),
-      _handshakeValid(false),
-      _lastHandshakeMillis(0),
+      _session(&_ownSession),
       _globalSpeed(30),
       _modelType(FanModelType::UNKNOWN) {
   memset(_token, 0, sizeof(_token));
   memset(_key, 0, sizeof(_key));
   memset(_iv0, 0, sizeof(_iv0));
-  memset(_deviceId, 0, sizeof(_deviceId));
+  memset(&_ownSession, 0, sizeof(_ownSession));
   memset(_model, 0, sizeof(_model));
 }
 
 bool SmartMiFanAsyncClient::begin(WiFiUDP &udp, const IPAddress &fanAddress, const uint8_t token[16]) {
   _udp = &udp;
-  _udp->begin(0);
+  openUdp(_udp);
+  _session = &_ownSession;
   setFanAddress(fanAddress);
   if (token != nullptr) {
     if (token != _token) {
@@ -37,11 +35,7 @@ bool SmartMiFanAsyncClient::begin(WiFiUDP &udp, const IPAddress &fanAddress, con
     }
     deriveKeyIv();
   }
-  memset(_deviceId, 0, sizeof(_deviceId));
-  _deviceTimestamp = 0;
-  _ready = false;
-  _handshakeValid = false;
-  _lastHandshakeMillis = 0;
+  memset(_session, 0, sizeof(*_session));
   return handshake();
 }
 
@@ -61,41 +55,46 @@ bool SmartMiFanAsyncClient::handshake(uint32_t timeoutMs) {
   }
 
   // Check cache first - if handshake is valid AND within TTL, reuse it
-  if (_handshakeValid && _ready) {
-    uint32_t age = millis() - _lastHandshakeMillis;
+  if (_session->valid) {
+    uint32_t age = millis() - _session->handshakeMillis;
     if (age < SMART_MI_FAN_HANDSHAKE_TTL_MS) {
       return true;
     }
     FAN_LOGI_F("Handshake cache expired (age=%lu ms), refreshing", age);
   }
 
-  _ready = false;
-  _handshakeValid = false;
-  
-  if (_udp) {
-    _udp->begin(0);
-  }
+  _session->valid = false;
+  openUdp(_udp);  // No-op once bound: replies to async commands keep arriving
 
   uint8_t hello[32] = {0x21, 0x31, 0x00, 0x20};
   memset(hello + 4, 0xFF, 28);
 
+  // Hello resent on the fan's RTO (doubling), at most SMART_MI_FAN_MAX_RETRANSMITS times
+  RttEstimator *rtt = rttEstimatorFor(_fanAddress);
+  uint8_t sends = 0;
   uint32_t lastSend = 0;
   uint32_t start = millis();
   bool wrongSourceIpSeen = false;
   
   while (millis() - start < timeoutMs) {
     uint32_t now = millis();
-    if (lastSend == 0 || (now - lastSend) >= 500) {
+    if (sends == 0 || (now - lastSend) >= retransmitWaitMs(rtt, sends)) {
+      if (sends > SMART_MI_FAN_MAX_RETRANSMITS) break;
+      if (sends > 0 && rtt) rtt->retransmits++;
       _udp->beginPacket(_fanAddress, kMiioPort);
       _udp->write(hello, sizeof(hello));
       _udp->endPacket();
       lastSend = now;
+      sends++;
     }
     int len = _udp->parsePacket();
     if (len > 0) {
       IPAddress sender = _udp->remoteIP();
       if (sender != _fanAddress) {
-        if (!wrongSourceIpSeen) {
+        // Another fan's reply (async command, keep-alive) goes to the demultiplexer;
+        // only an unknown sender suggests the target moved
+        if (routeForeignReply(_udp, len)) continue;
+        if (!wrongSourceIpSeen && findFanIndexByIp(sender) < 0) {
           wrongSourceIpSeen = true;
           int fanIndex = findFanIndexByIp(_fanAddress);
           if (fanIndex >= 0) {
@@ -115,12 +114,8 @@ bool SmartMiFanAsyncClient::handshake(uint32_t timeoutMs) {
       if (len == 32) {
         uint8_t buf[32];
         _udp->read(buf, 32);
-        memcpy(_deviceId, buf + 8, 4);
-        _deviceTimestamp = (uint32_t(buf[12]) << 24) | (uint32_t(buf[13]) << 16) |
-                           (uint32_t(buf[14]) << 8) | uint32_t(buf[15]);
-        _ready = true;
-        _handshakeValid = true;
-        _lastHandshakeMillis = millis();
+        applyHelloReply(*_session, buf);
+        if (sends == 1 && rtt) rtt->addSample(millis() - lastSend);
         
         int fanIndex = findFanIndexByIp(_fanAddress);
         if (fanIndex >= 0) {
@@ -136,8 +131,7 @@ bool SmartMiFanAsyncClient::handshake(uint32_t timeoutMs) {
     yield();
   }
 
-  _ready = false;
-  _handshakeValid = false;
+  _session->valid = false;
   int fanIndex = findFanIndexByIp(_fanAddress);
   if (fanIndex >= 0) {
     g_discoveredFans[fanIndex].ready = false;
@@ -164,24 +158,23 @@ bool SmartMiFanAsyncClient::ensureHandshake(uint32_t ttlMs, uint32_t timeoutMs)
 }
 
 bool SmartMiFanAsyncClient::isHandshakeValid(uint32_t ttlMs) const {
-  if (!_handshakeValid || !_ready) {
+  if (!_session->valid) {
     return false;
   }
-  uint32_t age = millis() - _lastHandshakeMillis;
+  uint32_t age = millis() - _session->handshakeMillis;
   return (age < ttlMs);
 }
 
 void SmartMiFanAsyncClient::invalidateHandshake() {
-  _ready = false;
-  _handshakeValid = false;
-  _lastHandshakeMillis = 0;
+  _session->valid = false;
+  _session->handshakeMillis = 0;
 }
 
 uint32_t SmartMiFanAsyncClient::getHandshakeAge() const {
-  if (!_handshakeValid || !_ready) {
+  if (!_session->valid) {
     return 0;
   }
-  return millis() - _lastHandshakeMillis;
+  return millis() - _session->handshakeMillis;
 }
 
 bool SmartMiFanAsyncClient::queryInfo(char *outModel, size_t modelSize,
@@ -191,126 +184,93 @@ bool SmartMiFanAsyncClient::queryInfo(char *outModel, size_t modelSize,
                                        uint32_t timeoutMs) {
   using namespace SmartMiFanInternal;
   
-  if (!_ready || !_udp) {
+  if (!_session->valid || !_udp) {
     return false;
   }
   
   const char *cmd = "{\"id\":1,\"method\":\"miIO.info\",\"params\":[]}";
-  size_t cmdLen = strlen(cmd);
-  
-  size_t extra0 = 1;
-  size_t raw = cmdLen + extra0;
-  size_t pad = 16 - (raw % 16);
-  size_t padLen = raw + pad;
-  
-  uint8_t plainPadded[256];
-  memcpy(plainPadded, cmd, cmdLen);
-  plainPadded[cmdLen] = 0x00;
-  memset(plainPadded + cmdLen + 1, static_cast<uint8_t>(pad), pad);
   
-  uint8_t cipher[256];
-  mbedtls_aes_context aes;
-  mbedtls_aes_init(&aes);
-  mbedtls_aes_setkey_enc(&aes, _key, 128);
-  uint8_t iv[16];
-  memcpy(iv, _iv0, sizeof(iv));
-  mbedtls_aes_crypt_cbc(&aes, MBEDTLS_AES_ENCRYPT, padLen, iv, plainPadded, cipher);
-  mbedtls_aes_free(&aes);
-  
-  uint32_t ts = _deviceTimestamp + 1;
-  MiioHeader header;
-  header.magic = to_be16(0x2131);
-  header.length = to_be16(32 + padLen);
-  header.unknown = 0;
-  memcpy(header.device_id, _deviceId, 4);
-  header.ts_be = to_be32(ts);
-  
-  uint8_t tmp[16 + 16 + 256];
-  memcpy(tmp, &header, 16);
-  memcpy(tmp + 16, _token, 16);
-  memcpy(tmp + 32, cipher, padLen);
-  md5(tmp, 16 + 16 + padLen, header.checksum);
+  uint8_t frame[96];
+  uint32_t ts = nextRequestTimestamp(*_session);
+  size_t frameLen = encodeMiioFrame(_token, _key, _iv0, _session->deviceId, ts, cmd, frame, sizeof(frame));
+  if (frameLen == 0) return false;
   
   _udp->beginPacket(_fanAddress, kMiioPort);
-  _udp->write(reinterpret_cast<uint8_t *>(&header), 32);
-  _udp->write(cipher, padLen);
+  _udp->write(frame, frameLen);
   _udp->endPacket();
   
-  _deviceTimestamp = ts;
+  _session->deviceTimestamp = ts;
   
+  // The same frame is resent on the fan's RTO, like a request (see exchangeRequest())
+  RttEstimator *rtt = rttEstimatorFor(_fanAddress);
+  uint8_t sends = 1;
   uint32_t start = millis();
+  uint32_t lastSend = start;
   while (millis() - start < timeoutMs) {
+    uint32_t now = millis();
+    if (now - lastSend >= retransmitWaitMs(rtt, sends)) {
+      if (sends > SMART_MI_FAN_MAX_RETRANSMITS) break;
+      _udp->beginPacket(_fanAddress, kMiioPort);
+      _udp->write(frame, frameLen);
+      _udp->endPacket();
+      lastSend = now;
+      sends++;
+      if (rtt) rtt->retransmits++;
+    }
     int len = _udp->parsePacket();
+    if (len > 0 && _udp->remoteIP() != _fanAddress && routeForeignReply(_udp, len)) continue;
     if (len > 32) {
       IPAddress sender = _udp->remoteIP();
       if (sender == _fanAddress) {
-        uint8_t buffer[512];
-        if (len <= static_cast<int>(sizeof(buffer))) {
-          int readLen = _udp->read(buffer, len);
-          if (readLen == len) {
-            size_t payloadLen = len - 32;
-            uint8_t *respCipher = buffer + 32;
+        const char *plain = nullptr;
+        if (readMiioReply(_udp, len, _key, _iv0, plain)) {
+          char model[24] = {0};
+          char fw[16] = {0};
+          char hw[16] = {0};
+          
+          if (jsonExtractString(plain, "model", model, sizeof(model))) {
+            if (sends == 1 && rtt) rtt->addSample(millis() - lastSend);
+            safeCopyStr(_model, sizeof(_model), model);
+            cacheModelType();
             
-            uint8_t plain[512];
-            mbedtls_aes_init(&aes);
-            mbedtls_aes_setkey_dec(&aes, _key, 128);
-            memcpy(iv, _iv0, sizeof(iv));
-            if (mbedtls_aes_crypt_cbc(&aes, MBEDTLS_AES_DECRYPT, payloadLen, iv, respCipher, plain) == 0) {
-              mbedtls_aes_free(&aes);
-              
-              size_t plainLen = pkcs7Unpad(plain, payloadLen);
-              plain[plainLen] = '\0';
-              
-              char model[24] = {0};
-              char fw[16] = {0};
-              char hw[16] = {0};
-              
-              if (jsonExtractString(reinterpret_cast<char *>(plain), "model", model, sizeof(model))) {
-                safeCopyStr(_model, sizeof(_model), model);
-                cacheModelType();
-                
-                if (outModel && modelSize > 0) {
-                  safeCopyStr(outModel, modelSize, model);
-                }
-                
-                jsonExtractString(reinterpret_cast<char *>(plain), "fw_ver", fw, sizeof(fw));
-                jsonExtractString(reinterpret_cast<char *>(plain), "hw_ver", hw, sizeof(hw));
-                
-                if (outFwVer && fwSize > 0) {
-                  safeCopyStr(outFwVer, fwSize, fw);
-                }
-                if (outHwVer && hwSize > 0) {
-                  safeCopyStr(outHwVer, hwSize, hw);
-                }
-                
-                if (outDid) {
-                  char idBuffer[24];
-                  if (jsonExtractString(reinterpret_cast<char *>(plain), "did", idBuffer, sizeof(idBuffer))) {
+            if (outModel && modelSize > 0) {
+              safeCopyStr(outModel, modelSize, model);
+            }
+            
+            jsonExtractString(plain, "fw_ver", fw, sizeof(fw));
+            jsonExtractString(plain, "hw_ver", hw, sizeof(hw));
+            
+            if (outFwVer && fwSize > 0) {
+              safeCopyStr(outFwVer, fwSize, fw);
+            }
+            if (outHwVer && hwSize > 0) {
+              safeCopyStr(outHwVer, hwSize, hw);
+            }
+            
+            if (outDid) {
+              char idBuffer[24];
+              if (jsonExtractString(plain, "did", idBuffer, sizeof(idBuffer))) {
+                *outDid = strtoul(idBuffer, nullptr, 10);
+              } else {
+                const char *didKeyNumeric = "\"did\":";
+                const char *p = strstr(plain, didKeyNumeric);
+                if (p) {
+                  p += strlen(didKeyNumeric);
+                  while (*p == ' ' || *p == '\t') ++p;
+                  size_t lenDigits = 0;
+                  while (isdigit(static_cast<unsigned char>(p[lenDigits])) && lenDigits < sizeof(idBuffer) - 1) {
+                    idBuffer[lenDigits] = p[lenDigits];
+                    ++lenDigits;
+                  }
+                  idBuffer[lenDigits] = '\0';
+                  if (lenDigits > 0) {
                     *outDid = strtoul(idBuffer, nullptr, 10);
-                  } else {
-                    const char *didKeyNumeric = "\"did\":";
-                    const char *p = strstr(reinterpret_cast<char *>(plain), didKeyNumeric);
-                    if (p) {
-                      p += strlen(didKeyNumeric);
-                      while (*p == ' ' || *p == '\t') ++p;
-                      size_t lenDigits = 0;
-                      while (isdigit(static_cast<unsigned char>(p[lenDigits])) && lenDigits < sizeof(idBuffer) - 1) {
-                        idBuffer[lenDigits] = p[lenDigits];
-                        ++lenDigits;
-                      }
-                      idBuffer[lenDigits] = '\0';
-                      if (lenDigits > 0) {
-                        *outDid = strtoul(idBuffer, nullptr, 10);
-                      }
-                    }
                   }
                 }
-                
-                return true;
               }
-            } else {
-              mbedtls_aes_free(&aes);
             }
+            
+            return true;
           }
         }
       } else {
@@ -326,30 +286,26 @@ bool SmartMiFanAsyncClient::queryInfo(char *outModel, size_t modelSize,
 }
 
 bool SmartMiFanAsyncClient::setPower(bool on) {
-  return miotSetPropertyBool("power", 2, 1, on);
+  FanPropertyWrite prop = powerPropertyWrite(on);
+  return setProperties(&prop, 1);
 }
 
 bool SmartMiFanAsyncClient::setSpeed(uint8_t percent) {
   using namespace SmartMiFanInternal;
   
-  uint8_t p = percent;
-  if (p < 1) p = 1;
-  if (p > 100) p = 100;
-  _globalSpeed = p;
+  setGlobalSpeed(percent);
   
-  int siid = 6;
-  int piid = 8;
-  bool useFanLevel = false;
-  getSpeedParamsByType(_modelType, siid, piid, useFanLevel);
+  FanPropertyWrite prop = speedPropertyWrite(_modelType, percent);
+  return setProperties(&prop, 1);
+}
+
+bool SmartMiFanAsyncClient::setPowerAndSpeed(bool on, uint8_t percent) {
+  using namespace SmartMiFanInternal;
   
-  if (useFanLevel) {
-    uint8_t level = 1;
-    if (p > 66) level = 3;
-    else if (p > 33) level = 2;
-    return miotSetPropertyUint("fan_level", siid, piid, level);
-  }
+  setGlobalSpeed(percent);
   
-  return miotSetPropertyUint("fan_speed", siid, piid, p);
+  FanPropertyWrite props[2] = {powerPropertyWrite(on), speedPropertyWrite(_modelType, percent)};
+  return setProperties(props, 2);
 }
 
 void SmartMiFanAsyncClient::setGlobalSpeed(uint8_t percent) {
@@ -365,23 +321,45 @@ uint8_t SmartMiFanAsyncClient::getGlobalSpeed() const {
 
 bool SmartMiFanAsyncClient::setTokenFromHex(const char *tokenHex) {
   if (tokenHex == nullptr) return false;
-  if (!hexToBytes16(tokenHex, _token)) return false;
-  deriveKeyIv();
+  uint8_t token[16];
+  if (!hexToBytes16(tokenHex, token)) return false;
+  setToken(token);
   return true;
 }
 
 void SmartMiFanAsyncClient::setToken(const uint8_t token[16]) {
   if (token == nullptr) return;
   if (token != _token) {
+    // A bound per-fan session was keyed with the old token - fall back to our own
+    if (_session != &_ownSession && memcmp(_token, token, 16) != 0) {
+      _session = &_ownSession;
+      _ownSession.valid = false;
+    }
     memmove(_token, token, 16);
   }
   deriveKeyIv();
 }
 
+void SmartMiFanAsyncClient::setTokenCached(const uint8_t token[16], const uint8_t key[16], const uint8_t iv[16]) {
+  if (token == nullptr || key == nullptr || iv == nullptr) return;
+  memcpy(_token, token, 16);
+  memcpy(_key, key, 16);
+  memcpy(_iv0, iv, 16);
+}
+
+void SmartMiFanAsyncClient::useSession(SmartMiFanSession *session) {
+  _session = (session != nullptr) ? session : &_ownSession;
+}
+
 void SmartMiFanAsyncClient::setFanAddress(const IPAddress &fanAddress) {
+  // A bound per-fan session belongs to the old address - fall back to our own
+  if (_session != &_ownSession && !(fanAddress == _fanAddress)) {
+    _session = &_ownSession;
+  }
   _fanAddress = fanAddress;
-  _ready = false;
-  _handshakeValid = false;
+  if (_session == &_ownSession) {
+    _ownSession.valid = false;
+  }
 }
 
 void SmartMiFanAsyncClient::setModel(const char *model) {
@@ -401,181 +379,182 @@ void SmartMiFanAsyncClient::cacheModelType() {
   _modelType = modelStringToType(_model);
 }
 
-bool SmartMiFanAsyncClient::miotSetPropertyUint(const char * /*name*/, int siid, int piid, int value) {
+bool SmartMiFanAsyncClient::setProperties(const FanPropertyWrite *props, size_t count) {
   using namespace SmartMiFanInternal;
   
   if (_udp == nullptr) return false;
-  if (!handshake()) return false;
-
-  char json[196];
-  snprintf(json, sizeof(json),
-           "{\"id\":%u,\"method\":\"set_properties\",\"params\":[{\"siid\":%d,\"piid\":%d,\"value\":%d}]}",
-           g_msgId++, siid, piid, value);
-
-  uint8_t cipher[256];
-  size_t clen = encryptPayload(reinterpret_cast<const uint8_t *>(json), strlen(json), cipher, sizeof(cipher));
-  if (clen == 0) return false;
-
-  MiioHeader header{};
-  header.magic = to_be16(0x2131);
-  header.length = to_be16(32 + static_cast<uint16_t>(clen));
-  header.unknown = 0;
-  memcpy(header.device_id, _deviceId, sizeof(_deviceId));
-  uint32_t ts = _deviceTimestamp + 1;
-  header.ts_be = to_be32(ts);
-
-  uint8_t tmp[16 + 16 + sizeof(cipher)];
-  memcpy(tmp, &header, 16);
-  memcpy(tmp + 16, _token, 16);
-  memcpy(tmp + 32, cipher, clen);
-  md5(tmp, 16 + 16 + clen, header.checksum);
-  _deviceTimestamp = ts;
+  if (!extrapolateSession(*_session) && !handshake()) return false;
 
-  _udp->beginPacket(_fanAddress, kMiioPort);
-  _udp->write(reinterpret_cast<uint8_t *>(&header), 32);
-  _udp->write(cipher, clen);
-  _udp->endPacket();
+  uint32_t msgId = g_msgId++;
+  char json[240];
+  if (buildSetPropertiesJson(msgId, props, count, json, sizeof(json)) == 0) return false;
 
-  uint32_t start = millis();
-  bool wrongSourceIpSeen = false;
-  bool responseReceived = false;
-  
-  while (millis() - start < 1500) {
-    int len = _udp->parsePacket();
-    if (len > 0) {
-      IPAddress sender = _udp->remoteIP();
-      if (sender == _fanAddress) {
-        discardUdpPacket(_udp);  // Safe discard of response
-        responseReceived = true;
-        
-        int fanIndex = findFanIndexByIp(_fanAddress);
-        if (fanIndex >= 0) {
-          g_discoveredFans[fanIndex].ready = true;
-          g_discoveredFans[fanIndex].lastError = MiioErr::OK;
-        }
-        break;
-      } else {
-        if (!wrongSourceIpSeen) {
-          wrongSourceIpSeen = true;
-          int fanIndex = findFanIndexByIp(_fanAddress);
-          if (fanIndex >= 0) {
-            g_discoveredFans[fanIndex].lastError = MiioErr::WRONG_SOURCE_IP;
-            g_discoveredFans[fanIndex].ready = false;
-            // DBG_FAN_TIMEOUT: log unexpected response sender during set_properties (uint)
-            FAN_LOGW_F("[DBG_FAN_TIMEOUT] setProperty(uint) wrong source IP: fanIndex=%d ip=%d.%d.%d.%d t=%lums",
-                       fanIndex, sender[0], sender[1], sender[2], sender[3], (unsigned long)millis());
-            emitErrorCallback(static_cast<uint8_t>(fanIndex), _fanAddress, FanOp::ReceiveResponse, 
-                            MiioErr::WRONG_SOURCE_IP, millis() - start, false);
-          }
-        }
-        discardUdpPacket(_udp);  // Safe discard instead of flush()
-      }
+  const char *reply = nullptr;
+  if (!exchangeRequest(json, msgId, reply)) return false;
+
+  // Acknowledged writes are the fan's current state
+  int fanIndex = findFanIndexByIp(_fanAddress);
+  if (fanIndex >= 0) {
+    for (size_t i = 0; i < count; ++i) {
+      storeCachedProperty(static_cast<uint8_t>(fanIndex), props[i].siid, props[i].piid, props[i].value);
     }
-    yield();
   }
+  return true;
+}
+
+bool SmartMiFanAsyncClient::getProperties(const FanPropertyId *props, size_t count,
+                                          FanPropertyValue out[], size_t &outCount) {
+  using namespace SmartMiFanInternal;
   
-  if (!responseReceived) {
-    int fanIndex = findFanIndexByIp(_fanAddress);
-    if (fanIndex >= 0) {
-      g_discoveredFans[fanIndex].ready = false;
-      g_discoveredFans[fanIndex].lastError = MiioErr::TIMEOUT;
-      // DBG_FAN_TIMEOUT: log timeout waiting for set_properties (uint) response
-      FAN_LOGW_F("[DBG_FAN_TIMEOUT] setProperty(uint) timeout: fanIndex=%d ip=%d.%d.%d.%d timeoutMs=%u t=%lums",
-                 fanIndex, _fanAddress[0], _fanAddress[1], _fanAddress[2], _fanAddress[3], 1500,
-                 (unsigned long)millis());
-      emitErrorCallback(static_cast<uint8_t>(fanIndex), _fanAddress, FanOp::ReceiveResponse, 
-                      MiioErr::TIMEOUT, 1500, false);
+  outCount = 0;
+  if (_udp == nullptr) return false;
+  if (!extrapolateSession(*_session) && !handshake()) return false;
+
+  uint32_t msgId = g_msgId++;
+  char json[240];
+  if (buildGetPropertiesJson(msgId, props, count, json, sizeof(json)) == 0) return false;
+
+  const char *reply = nullptr;
+  if (!exchangeRequest(json, msgId, reply)) return false;
+
+  outCount = parseGetPropertiesResult(reply, out, count);
+  int fanIndex = findFanIndexByIp(_fanAddress);
+  if (fanIndex >= 0) {
+    for (size_t i = 0; i < outCount; ++i) {
+      storeCachedProperty(static_cast<uint8_t>(fanIndex), out[i].siid, out[i].piid, out[i].value);
     }
-    return false;
   }
+  return outCount > 0;
+}
 
-  return true;
+bool SmartMiFanAsyncClient::readPowerAndSpeed(bool &on, uint8_t &percent) {
+  using namespace SmartMiFanInternal;
+  
+  FanPropertyId props[2];
+  bool useFanLevel = false;
+  props[0].siid = 2;
+  props[0].piid = 1;
+  getSpeedParamsByType(_modelType, props[1].siid, props[1].piid, useFanLevel);
+
+  FanPropertyValue values[2];
+  size_t found = 0;
+  if (!getProperties(props, 2, values, found)) return false;
+
+  bool havePower = false;
+  bool haveSpeed = false;
+  for (size_t i = 0; i < found; ++i) {
+    if (values[i].siid == props[0].siid && values[i].piid == props[0].piid) {
+      on = values[i].value != 0;
+      havePower = true;
+    } else if (values[i].siid == props[1].siid && values[i].piid == props[1].piid) {
+      percent = speedPropertyToPercent(_modelType, values[i].value);
+      haveSpeed = true;
+    }
+  }
+  return havePower && haveSpeed;
 }
 
-bool SmartMiFanAsyncClient::miotSetPropertyBool(const char * /*name*/, int siid, int piid, bool value) {
+// Send one encrypted request and wait for the reply carrying msgId.
+// On success reply points at the decrypted JSON (valid until the next receive).
+bool SmartMiFanAsyncClient::exchangeRequest(const char *json, uint32_t msgId, const char *&reply) {
   using namespace SmartMiFanInternal;
   
-  if (_udp == nullptr) return false;
-  if (!handshake()) return false;
-
-  char json[196];
-  snprintf(json, sizeof(json),
-           "{\"id\":%u,\"method\":\"set_properties\",\"params\":[{\"siid\":%d,\"piid\":%d,\"value\":%s}]}",
-           g_msgId++, siid, piid, value ? "true" : "false");
-
-  uint8_t cipher[256];
-  size_t clen = encryptPayload(reinterpret_cast<const uint8_t *>(json), strlen(json), cipher, sizeof(cipher));
-  if (clen == 0) return false;
-
-  MiioHeader header{};
-  header.magic = to_be16(0x2131);
-  header.length = to_be16(32 + static_cast<uint16_t>(clen));
-  header.unknown = 0;
-  memcpy(header.device_id, _deviceId, sizeof(_deviceId));
-  uint32_t ts = _deviceTimestamp + 1;
-  header.ts_be = to_be32(ts);
-
-  uint8_t tmp[16 + 16 + sizeof(cipher)];
-  memcpy(tmp, &header, 16);
-  memcpy(tmp + 16, _token, 16);
-  memcpy(tmp + 32, cipher, clen);
-  md5(tmp, 16 + 16 + clen, header.checksum);
-  _deviceTimestamp = ts;
+  uint8_t frame[kMiioMaxFrameLen];
+  bool resumed = _session->resumed;
+  uint32_t ts = nextRequestTimestamp(*_session);
+  size_t frameLen = encodeMiioFrame(_token, _key, _iv0, _session->deviceId, ts, json, frame, sizeof(frame));
+  if (frameLen == 0) return false;
+  _session->deviceTimestamp = ts;
 
   _udp->beginPacket(_fanAddress, kMiioPort);
-  _udp->write(reinterpret_cast<uint8_t *>(&header), 32);
-  _udp->write(cipher, clen);
+  _udp->write(frame, frameLen);
   _udp->endPacket();
 
+  // Unanswered within the fan's RTO: the same frame again (same id and timestamp),
+  // with the RTO doubled each time. A resumed session is not repeated but
+  // re-handshaked below, since the device may have dropped it.
+  RttEstimator *rtt = rttEstimatorFor(_fanAddress);
+  uint8_t sends = 1;
   uint32_t start = millis();
+  uint32_t lastSend = start;
   bool wrongSourceIpSeen = false;
   bool responseReceived = false;
   
-  while (millis() - start < 1500) {
+  while (millis() - start < kCommandAckTimeoutMs) {
+    uint32_t now = millis();
+    if (now - lastSend >= retransmitWaitMs(rtt, sends)) {
+      if (resumed || sends > SMART_MI_FAN_MAX_RETRANSMITS) break;
+      _udp->beginPacket(_fanAddress, kMiioPort);
+      _udp->write(frame, frameLen);
+      _udp->endPacket();
+      lastSend = now;
+      sends++;
+      if (rtt) rtt->retransmits++;
+    }
     int len = _udp->parsePacket();
     if (len > 0) {
       IPAddress sender = _udp->remoteIP();
+      // Another fan's reply goes to the demultiplexer (which counts it)
+      if (sender != _fanAddress && routeForeignReply(_udp, len)) continue;
+      g_rxStats.received++;
       if (sender == _fanAddress) {
-        discardUdpPacket(_udp);  // Safe discard of response
-        responseReceived = true;
-        
-        int fanIndex = findFanIndexByIp(_fanAddress);
-        if (fanIndex >= 0) {
-          g_discoveredFans[fanIndex].ready = true;
-          g_discoveredFans[fanIndex].lastError = MiioErr::OK;
+        // Only the reply carrying our id counts (not a late reply to an earlier command)
+        if (readMiioReply(_udp, len, _key, _iv0, reply)) {
+          if (jsonExtractId(reply) == msgId) {
+            g_rxStats.matched++;
+            responseReceived = true;
+            renewSessionFromReply(*_session);
+            if (sends == 1 && rtt) rtt->addSample(millis() - lastSend);
+            
+            int fanIndex = findFanIndexByIp(_fanAddress);
+            if (fanIndex >= 0) {
+              g_discoveredFans[fanIndex].ready = true;
+              g_discoveredFans[fanIndex].lastError = MiioErr::OK;
+            }
+            break;
+          }
+          g_rxStats.unmatched++;
         }
-        break;
       } else {
-        if (!wrongSourceIpSeen) {
+        if (!wrongSourceIpSeen && findFanIndexByIp(sender) < 0) {
           wrongSourceIpSeen = true;
           int fanIndex = findFanIndexByIp(_fanAddress);
           if (fanIndex >= 0) {
             g_discoveredFans[fanIndex].lastError = MiioErr::WRONG_SOURCE_IP;
             g_discoveredFans[fanIndex].ready = false;
-            // DBG_FAN_TIMEOUT: log unexpected response sender during set_properties (bool)
-            FAN_LOGW_F("[DBG_FAN_TIMEOUT] setProperty(bool) wrong source IP: fanIndex=%d ip=%d.%d.%d.%d t=%lums",
+            // DBG_FAN_TIMEOUT: log unexpected response sender during request
+            FAN_LOGW_F("[DBG_FAN_TIMEOUT] Request wrong source IP: fanIndex=%d ip=%d.%d.%d.%d t=%lums",
                        fanIndex, sender[0], sender[1], sender[2], sender[3], (unsigned long)millis());
             emitErrorCallback(static_cast<uint8_t>(fanIndex), _fanAddress, FanOp::ReceiveResponse, 
                             MiioErr::WRONG_SOURCE_IP, millis() - start, false);
           }
         }
         discardUdpPacket(_udp);  // Safe discard instead of flush()
+        g_rxStats.unknownSource++;
       }
     }
     yield();
   }
   
   if (!responseReceived) {
+    // Stale session (device rebooted / IP reused) - force fresh hello next time
+    _session->valid = false;
+    if (resumed) {
+      // Resumed or extrapolated session no longer accepted: hello, then the same request once more
+      _session->resumed = false;
+      FAN_LOGI_F("Resumed session not answered, re-handshaking");
+      return handshake() && exchangeRequest(json, msgId, reply);
+    }
     int fanIndex = findFanIndexByIp(_fanAddress);
     if (fanIndex >= 0) {
       g_discoveredFans[fanIndex].ready = false;
       g_discoveredFans[fanIndex].lastError = MiioErr::TIMEOUT;
-      // DBG_FAN_TIMEOUT: log timeout waiting for set_properties (bool) response
-      FAN_LOGW_F("[DBG_FAN_TIMEOUT] setProperty(bool) timeout: fanIndex=%d ip=%d.%d.%d.%d timeoutMs=%u t=%lums",
-                 fanIndex, _fanAddress[0], _fanAddress[1], _fanAddress[2], _fanAddress[3], 1500,
-                 (unsigned long)millis());
+      // DBG_FAN_TIMEOUT: log timeout waiting for request response
+      FAN_LOGW_F("[DBG_FAN_TIMEOUT] Request timeout: fanIndex=%d ip=%d.%d.%d.%d waitedMs=%lu sends=%u t=%lums",
+                 fanIndex, _fanAddress[0], _fanAddress[1], _fanAddress[2], _fanAddress[3],
+                 (unsigned long)(millis() - start), (unsigned)sends, (unsigned long)millis());
       emitErrorCallback(static_cast<uint8_t>(fanIndex), _fanAddress, FanOp::ReceiveResponse, 
-                      MiioErr::TIMEOUT, 1500, false);
+                      MiioErr::TIMEOUT, millis() - start, false);
     }
     return false;
   }
@@ -584,17 +563,17 @@ bool SmartMiFanAsyncClient::miotSetPropertyBool(const char * /*name*/, int siid,
 }
 
 void SmartMiFanAsyncClient::closeSession() {
-  _ready = false;
-  _handshakeValid = false;
+  _session->valid = false;
 }
 
 void SmartMiFanAsyncClient::attachUdp(WiFiUDP &udp) {
   if (_udp && _udp != &udp) {
-    _udp->stop();
+    stopUdp(_udp);
   }
   _udp = &udp;
-  _ready = false;
-  _handshakeValid = false;
+  // New context: fall back to the client's own (invalidated) session
+  _session = &_ownSession;
+  _ownSession.valid = false;
 }
 
 void SmartMiFanAsyncClient::deriveKeyIv() {
@@ -624,29 +603,6 @@ bool SmartMiFanAsyncClient::hexToBytes16(const char *hex, uint8_t *out16) {
   return true;
 }
 
-size_t SmartMiFanAsyncClient::encryptPayload(const uint8_t *plain, size_t len, uint8_t *out, size_t outCap) {
-  const size_t extra0 = 1;
-  size_t raw = len + extra0;
-  size_t pad = 16 - (raw % 16);
-  size_t total = raw + pad;
-  if (total > outCap) return 0;
-
-  memcpy(out, plain, len);
-  out[len] = 0x00;
-  memset(out + len + 1, static_cast<uint8_t>(pad), pad);
-
-  mbedtls_aes_context aes;
-  mbedtls_aes_init(&aes);
-  mbedtls_aes_setkey_enc(&aes, _key, 128);
-  uint8_t iv[16];
-  memcpy(iv, _iv0, sizeof(iv));
-  for (size_t off = 0; off < total; off += 16) {
-    mbedtls_aes_crypt_cbc(&aes, MBEDTLS_AES_ENCRYPT, 16, iv, out + off, out + off);
-  }
-  mbedtls_aes_free(&aes);
-  return total;
-}
-
 // Legacy C-style wrappers
 bool fan_set_speed(uint8_t percent) {
   return SmartMiFanAsync.setSpeed(percent);
@@ -0,0 +1,621 @@
+// =============================================================================
+// SmartMiFanAsync - Command Module
+// =============================================================================
+// Contains: Non-blocking set_properties engine (per-fan command state machines),
+//           parallel fan-out over all ACTIVE fans
+// =============================================================================
+
+#include "SmartMiFanInternal.h"
+
+using namespace SmartMiFanInternal;
+
+namespace {
+
+bool isCommandPending(const CommandContext &ctx) {
+  return ctx.state == CommandState::WAITING_HELLO ||
+         ctx.state == CommandState::WAITING_ACK;
+}
+
+void finishCommand(uint8_t fanIndex, CommandState state, MiioErr error, FanOp operation) {
+  CommandContext &ctx = g_commandContexts[fanIndex];
+  SmartMiFanDiscoveredDevice &fan = g_discoveredFans[fanIndex];
+  uint32_t elapsedMs = millis() - ctx.startTime;
+
+  ctx.state = state;
+  ctx.error = error;
+  ctx.elapsedMs = elapsedMs;
+
+  if (error == MiioErr::OK) {
+    fan.ready = true;
+    fan.lastError = MiioErr::OK;
+    fan.session.resumed = false;
+  } else {
+    // Stale session (device rebooted / IP reused) - force fresh hello next time
+    fan.session.valid = false;
+    fan.ready = false;
+    fan.lastError = error;
+    // DBG_FAN_TIMEOUT: log async command failure
+    FAN_LOGW_F("[DBG_FAN_TIMEOUT] Async command failed: fanIndex=%u ip=%d.%d.%d.%d op=%d elapsed=%lums",
+               (unsigned)fanIndex, fan.ip[0], fan.ip[1], fan.ip[2], fan.ip[3],
+               static_cast<int>(operation), (unsigned long)elapsedMs);
+    emitErrorCallback(fanIndex, fan.ip, operation, error, elapsedMs, true);
+  }
+
+  if (g_commandCallback != nullptr) {
+    FanCommandResult result{};
+    result.fanIndex = fanIndex;
+    result.state = state;
+    result.error = error;
+    result.elapsedMs = elapsedMs;
+    g_commandCallback(result);
+  }
+}
+
+// Send the command's request and keep its encoded frame; with resend = true
+// the kept frame goes out again unchanged
+bool sendCommandRequest(uint8_t fanIndex, bool resend = false) {
+  CommandContext &ctx = g_commandContexts[fanIndex];
+  SmartMiFanDiscoveredDevice &fan = g_discoveredFans[fanIndex];
+
+  if (resend) {
+    // Same bytes (id, timestamp, cipher text) as the first send: no JSON, AES or MD5 again
+    if (ctx.frameLen == 0) return false;
+    g_udpContext->beginPacket(fan.ip, kMiioPort);
+    g_udpContext->write(ctx.frame, ctx.frameLen);
+    g_udpContext->endPacket();
+    ctx.lastSend = millis();
+    ctx.sends++;
+    g_rttEstimators[fanIndex].retransmits++;
+    return true;
+  }
+
+  uint32_t msgId = g_msgId++;
+  char json[240];
+  size_t jsonLen = 0;
+  if (ctx.isRead) {
+    FanPropertyId ids[SMART_MI_FAN_MAX_PROPERTY_WRITES];
+    for (size_t i = 0; i < ctx.propCount; ++i) {
+      ids[i].siid = ctx.props[i].siid;
+      ids[i].piid = ctx.props[i].piid;
+    }
+    jsonLen = buildGetPropertiesJson(msgId, ids, ctx.propCount, json, sizeof(json));
+  } else {
+    jsonLen = buildSetPropertiesJson(msgId, ctx.props, ctx.propCount, json, sizeof(json));
+  }
+  if (jsonLen == 0) return false;
+
+  size_t frameLen = buildMiioRequest(fan, fan.session, json, ctx.frame, sizeof(ctx.frame));
+  if (frameLen == 0) return false;
+  ctx.frameLen = static_cast<uint16_t>(frameLen);
+
+  g_udpContext->beginPacket(fan.ip, kMiioPort);
+  g_udpContext->write(ctx.frame, ctx.frameLen);
+  g_udpContext->endPacket();
+
+  ctx.lastSend = millis();
+  ctx.state = CommandState::WAITING_ACK;
+  ctx.msgId = msgId;
+  ctx.requestStart = ctx.lastSend;
+  ctx.sends = 1;
+  return true;
+}
+
+void sendCommandHello(uint8_t fanIndex, unsigned long now) {
+  CommandContext &ctx = g_commandContexts[fanIndex];
+  sendMiioHello(g_udpContext, g_discoveredFans[fanIndex].ip);
+  ctx.state = CommandState::WAITING_HELLO;
+  ctx.lastSend = now;
+  ctx.helloStart = now;
+  ctx.sends = 1;
+}
+
+bool startCommand(uint8_t fanIndex, const FanPropertyWrite *props, size_t count, bool isRead) {
+  if (fanIndex >= g_discoveredFanCount) return false;
+  if (!g_udpContext) return false;
+  if (!props || count == 0 || count > SMART_MI_FAN_MAX_PROPERTY_WRITES) return false;
+  // Discovery and device queries read the same socket
+  if (SmartMiFanAsync_isDiscoveryInProgress() || SmartMiFanAsync_isQueryInProgress()) return false;
+
+  SmartMiFanDiscoveredDevice &fan = g_discoveredFans[fanIndex];
+  cacheFanCrypto(fan);
+  if (!fan.cryptoCached) return false;
+
+  CommandContext &ctx = g_commandContexts[fanIndex];
+  ctx.reset();
+  memcpy(ctx.props, props, count * sizeof(FanPropertyWrite));
+  ctx.propCount = static_cast<uint8_t>(count);
+  ctx.isRead = isRead;
+  ctx.startTime = millis();
+
+  bool sessionValid = (fan.session.valid &&
+                       (millis() - fan.session.handshakeMillis) < SMART_MI_FAN_HANDSHAKE_TTL_MS) ||
+                      extrapolateSession(fan.session);
+  if (sessionValid) {
+    if (!sendCommandRequest(fanIndex)) {
+      finishCommand(fanIndex, CommandState::ERROR, MiioErr::INVALID_RESPONSE, FanOp::SendCommand);
+      return false;
+    }
+    return true;
+  }
+
+  fan.session.valid = false;
+  sendCommandHello(fanIndex, millis());
+  return true;
+}
+
+// Route one received packet to the request waiting for it.
+// Hello replies go to the fan's pending hello; encrypted replies are decrypted
+// once with the sender's key and matched by JSON id. Anything else is dropped.
+void dispatchCommandReply(int len) {
+  g_rxStats.received++;
+
+  IPAddress sender = g_udpContext->remoteIP();
+  int fanIndex = findFanIndexByIp(sender);
+  if (fanIndex < 0) {
+    discardUdpPacket(g_udpContext);
+    g_rxStats.unknownSource++;
+    return;
+  }
+
+  CommandContext &ctx = g_commandContexts[fanIndex];
+  SmartMiFanDiscoveredDevice &fan = g_discoveredFans[fanIndex];
+
+  if (len == 32) {
+    uint8_t buf[32];
+    g_udpContext->read(buf, 32);
+    if (ctx.state != CommandState::WAITING_HELLO) {
+      // Keep-alive hello, or a duplicate reply to a resent hello
+      if (handleKeepAliveHello(static_cast<uint8_t>(fanIndex), buf)) {
+        g_rxStats.matched++;
+      } else {
+        g_rxStats.unmatched++;
+      }
+      return;
+    }
+    applyHelloReply(fan.session, buf);
+    g_keepAliveSlots[fanIndex].reset();  // Answers a keep-alive hello as well
+    g_rxStats.matched++;
+    if (ctx.sends == 1) g_rttEstimators[fanIndex].addSample(millis() - ctx.lastSend);
+
+    if (!sendCommandRequest(static_cast<uint8_t>(fanIndex))) {
+      finishCommand(static_cast<uint8_t>(fanIndex), CommandState::ERROR,
+                    MiioErr::INVALID_RESPONSE, FanOp::SendCommand);
+    }
+    return;
+  }
+
+  if (ctx.state != CommandState::WAITING_ACK) {
+    discardUdpPacket(g_udpContext);  // Nothing outstanding for this fan
+    g_rxStats.unmatched++;
+    return;
+  }
+
+  const char *reply = nullptr;
+  if (!readMiioReply(g_udpContext, len, fan.cachedKey, fan.cachedIv, reply)) return;
+
+  uint32_t replyId = jsonExtractId(reply);
+  if (replyId != ctx.msgId) {
+    // Late reply to a superseded or timed-out request
+    g_rxStats.unmatched++;
+    FAN_LOGNET_F("Dropped reply id=%lu (waiting for %lu) from fanIndex=%d",
+                 (unsigned long)replyId, (unsigned long)ctx.msgId, fanIndex);
+    return;
+  }
+
+  g_rxStats.matched++;
+  renewSessionFromReply(fan.session);
+  if (ctx.sends == 1) g_rttEstimators[fanIndex].addSample(millis() - ctx.lastSend);
+  uint8_t index = static_cast<uint8_t>(fanIndex);
+  if (ctx.isRead) {
+    // Partial results are fine: properties the model lacks are simply not cached
+    FanPropertyValue values[SMART_MI_FAN_MAX_PROPERTY_WRITES];
+    size_t found = parseGetPropertiesResult(reply, values, ctx.propCount);
+    if (found == 0) {
+      finishCommand(index, CommandState::ERROR, MiioErr::INVALID_RESPONSE, FanOp::ReceiveResponse);
+      return;
+    }
+    for (size_t i = 0; i < found; ++i) {
+      storeCachedProperty(index, values[i].siid, values[i].piid, values[i].value);
+    }
+  } else {
+    if (replyHasPropertyError(reply)) {
+      finishCommand(index, CommandState::ERROR, MiioErr::INVALID_RESPONSE, FanOp::ReceiveResponse);
+      return;
+    }
+    // Acknowledged writes are the fan's current state
+    for (size_t i = 0; i < ctx.propCount; ++i) {
+      storeCachedProperty(index, ctx.props[i].siid, ctx.props[i].piid, ctx.props[i].value);
+    }
+  }
+  finishCommand(index, CommandState::COMPLETE, MiioErr::OK, FanOp::ReceiveResponse);
+}
+
+bool isFanOutMember(size_t fanIndex) {
+  return (g_fanOutContext.members & (1UL << fanIndex)) != 0;
+}
+
+// Expire members at the shared deadline; report once nothing is pending
+void updateFanOut(unsigned long now) {
+  if (!g_fanOutContext.active) return;
+
+  bool expired = (now - g_fanOutContext.startTime) >= g_fanOutContext.deadlineMs;
+  bool anyPending = false;
+  for (size_t i = 0; i < g_discoveredFanCount; ++i) {
+    if (!isFanOutMember(i) || !isCommandPending(g_commandContexts[i])) continue;
+    if (expired) {
+      FanOp op = (g_commandContexts[i].state == CommandState::WAITING_HELLO) ? FanOp::Handshake
+                                                                             : FanOp::ReceiveResponse;
+      finishCommand(static_cast<uint8_t>(i), CommandState::TIMEOUT, MiioErr::TIMEOUT, op);
+    } else {
+      anyPending = true;
+    }
+  }
+  if (anyPending) return;
+
+  FanCommandResult results[kMaxSmartMiFans];
+  size_t count = 0;
+  for (size_t i = 0; i < g_discoveredFanCount; ++i) {
+    if (!isFanOutMember(i)) continue;
+    const CommandContext &ctx = g_commandContexts[i];
+    results[count].fanIndex = static_cast<uint8_t>(i);
+    results[count].state = ctx.state;
+    results[count].error = ctx.error;
+    results[count].elapsedMs = ctx.elapsedMs;
+    count++;
+  }
+  g_fanOutContext.reset();
+
+  if (g_fanOutCallback != nullptr) {
+    g_fanOutCallback(results, count);
+  }
+}
+
+// Power and/or speed for one fan as one property list (speed mapped per model)
+size_t buildFanState(uint8_t fanIndex, bool setPower, bool on, bool setSpeed, uint8_t percent,
+                     FanPropertyWrite props[2]) {
+  SmartMiFanDiscoveredDevice &fan = g_discoveredFans[fanIndex];
+  cacheFanCrypto(fan);
+
+  size_t count = 0;
+  if (setPower) props[count++] = powerPropertyWrite(on);
+  if (setSpeed) props[count++] = speedPropertyWrite(fan.modelType, percent);
+  return count;
+}
+
+bool startFanState(uint8_t fanIndex, bool setPower, bool on, bool setSpeed, uint8_t percent) {
+  if (fanIndex >= g_discoveredFanCount) return false;
+  FanPropertyWrite props[2];
+  size_t count = buildFanState(fanIndex, setPower, on, setSpeed, percent, props);
+  return startCommand(fanIndex, props, count, false);
+}
+
+// get_properties for the given ids; the reply fills the fan's property cache
+bool startRead(uint8_t fanIndex, const FanPropertyId *props, size_t count) {
+  if (!props || count == 0 || count > SMART_MI_FAN_MAX_PROPERTY_WRITES) return false;
+  FanPropertyWrite reads[SMART_MI_FAN_MAX_PROPERTY_WRITES] = {};
+  for (size_t i = 0; i < count; ++i) {
+    reads[i].siid = props[i].siid;
+    reads[i].piid = props[i].piid;
+  }
+  return startCommand(fanIndex, reads, count, true);
+}
+
+bool startFanOut(bool setPower, bool on, bool setSpeed, uint8_t percent, unsigned long deadlineMs) {
+  if (!beginFanOut(deadlineMs)) return false;
+
+  // Send phase: every ACTIVE fan back-to-back, no waiting in between
+  for (size_t i = 0; i < g_discoveredFanCount; ++i) {
+    uint8_t fanIndex = static_cast<uint8_t>(i);
+    if (SmartMiFanAsync_getFanParticipationState(fanIndex) != FanParticipationState::ACTIVE) continue;
+
+    FanPropertyWrite props[2];
+    size_t count = buildFanState(fanIndex, setPower, on, setSpeed, percent, props);
+    addFanOutMember(fanIndex, props, count);
+  }
+
+  return commitFanOut();
+}
+
+}  // namespace
+
+namespace SmartMiFanInternal {
+
+// Fan-out in three steps so every member can carry its own property list:
+// beginFanOut() replaces any running fan-out, addFanOutMember() sends to one
+// fan right away, commitFanOut() arms the shared deadline.
+bool beginFanOut(unsigned long deadlineMs) {
+  if (!g_udpContext) return false;
+  if (SmartMiFanAsync_isDiscoveryInProgress() || SmartMiFanAsync_isQueryInProgress()) return false;
+
+  g_fanOutContext.reset();
+  g_fanOutContext.startTime = millis();
+  g_fanOutContext.deadlineMs = deadlineMs;
+  return true;
+}
+
+bool addFanOutMember(uint8_t fanIndex, const FanPropertyWrite *props, size_t count) {
+  if (fanIndex >= g_discoveredFanCount) return false;
+
+  if (startCommand(fanIndex, props, count, false)) {
+    g_fanOutContext.members |= (1UL << fanIndex);
+    return true;
+  }
+
+  SmartMiFanDiscoveredDevice &fan = g_discoveredFans[fanIndex];
+  fan.lastError = MiioErr::TIMEOUT;
+  // DBG_FAN_TIMEOUT: log fan-out start failure
+  FAN_LOGW_F("[DBG_FAN_TIMEOUT] Fan-out start failed: fanIndex=%u ip=%d.%d.%d.%d t=%lums",
+             (unsigned)fanIndex, fan.ip[0], fan.ip[1], fan.ip[2], fan.ip[3], (unsigned long)millis());
+  return false;
+}
+
+bool commitFanOut() {
+  g_fanOutContext.active = (g_fanOutContext.members != 0);
+  return g_fanOutContext.active;
+}
+
+// Block until the running fan-out has reported (used by orchestrated *All).
+// Returns true if at least one fan acknowledged.
+bool waitForFanOut() {
+  uint32_t members = g_fanOutContext.members;
+  while (g_fanOutContext.active) {
+    SmartMiFanAsync_update();
+    yield();
+  }
+
+  for (size_t i = 0; i < g_discoveredFanCount; ++i) {
+    if ((members & (1UL << i)) && g_commandContexts[i].state == CommandState::COMPLETE) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Blocking calls read the shared socket too: a packet from another known fan
+// goes to the demultiplexer instead of being dropped. Returns false for
+// unknown senders and other sockets; the caller keeps those.
+bool routeForeignReply(WiFiUDP *udp, int len) {
+  if (udp != g_udpContext || findFanIndexByIp(udp->remoteIP()) < 0) return false;
+  dispatchCommandReply(len);
+  return true;
+}
+
+}  // namespace SmartMiFanInternal
+
+// =========================
+// Async Command API
+// =========================
+
+bool SmartMiFanAsync_startSetFanPower(uint8_t fanIndex, bool on) {
+  return startFanState(fanIndex, true, on, false, 0);
+}
+
+bool SmartMiFanAsync_startSetFanSpeed(uint8_t fanIndex, uint8_t percent) {
+  return startFanState(fanIndex, false, false, true, percent);
+}
+
+bool SmartMiFanAsync_startSetFanState(uint8_t fanIndex, bool on, uint8_t percent) {
+  return startFanState(fanIndex, true, on, true, percent);
+}
+
+bool SmartMiFanAsync_startSetFanProperties(uint8_t fanIndex, const FanPropertyWrite props[], size_t count) {
+  return startCommand(fanIndex, props, count, false);
+}
+
+bool SmartMiFanAsync_startReadFanState(uint8_t fanIndex) {
+  if (fanIndex >= g_discoveredFanCount) return false;
+  SmartMiFanDiscoveredDevice &fan = g_discoveredFans[fanIndex];
+  cacheFanCrypto(fan);
+
+  FanPropertyId props[2];
+  bool useFanLevel = false;
+  props[0].siid = 2;
+  props[0].piid = 1;
+  getSpeedParamsByType(fan.modelType, props[1].siid, props[1].piid, useFanLevel);
+  return startRead(fanIndex, props, 2);
+}
+
+bool SmartMiFanAsync_startReadFanProperties(uint8_t fanIndex, const FanPropertyId props[], size_t count) {
+  return startRead(fanIndex, props, count);
+}
+
+bool SmartMiFanAsync_update() {
+  bool anyPending = false;
+  for (size_t i = 0; i < g_discoveredFanCount; ++i) {
+    if (isCommandPending(g_commandContexts[i])) {
+      anyPending = true;
+      break;
+    }
+  }
+  if (!g_udpContext) return false;
+  // Nothing in flight: only coalesced writes, the reconciler and keep-alive may have work
+  if (!anyPending && !g_fanOutContext.active && !keepAliveInFlight()) {
+    unsigned long now = millis();
+    bool work = flushCoalescedCommands(now);
+    if (reconcileDesiredStates(now)) work = true;
+    if (updateKeepAlive(now)) work = true;
+    return work;
+  }
+
+  // Drain replies first so a packet that arrived in time is not reported as timeout
+  for (size_t n = 0; n < kMaxSmartMiFans * 2; ++n) {
+    int len = g_udpContext->parsePacket();
+    if (len <= 0) break;
+    dispatchCommandReply(len);
+  }
+
+  unsigned long now = millis();
+  anyPending = false;
+  for (size_t i = 0; i < g_discoveredFanCount; ++i) {
+    CommandContext &ctx = g_commandContexts[i];
+    uint8_t fanIndex = static_cast<uint8_t>(i);
+
+    RttEstimator &rtt = g_rttEstimators[i];
+    if (ctx.state == CommandState::WAITING_HELLO) {
+      bool rtoExpired = now - ctx.lastSend >= retransmitWaitMs(&rtt, ctx.sends);
+      if (now - ctx.helloStart >= kHandshakeTimeoutMs ||
+          (rtoExpired && ctx.sends > SMART_MI_FAN_MAX_RETRANSMITS)) {
+        finishCommand(fanIndex, CommandState::TIMEOUT, MiioErr::TIMEOUT, FanOp::Handshake);
+        continue;
+      }
+      if (rtoExpired) {
+        sendMiioHello(g_udpContext, g_discoveredFans[i].ip);
+        ctx.lastSend = now;
+        ctx.sends++;
+        rtt.retransmits++;
+      }
+    } else if (ctx.state == CommandState::WAITING_ACK) {
+      bool capped = now - ctx.requestStart >= kCommandAckTimeoutMs;
+      if (capped || now - ctx.lastSend >= retransmitWaitMs(&rtt, ctx.sends)) {
+        SmartMiFanSession &session = g_discoveredFans[i].session;
+        if (session.resumed) {
+          // Resumed or extrapolated session not answered within one RTO: the
+          // device may have dropped it, so hello and resend instead of repeating
+          session.resumed = false;
+          session.valid = false;
+          sendCommandHello(fanIndex, now);
+          anyPending = true;
+          continue;
+        }
+        if (capped || ctx.sends > SMART_MI_FAN_MAX_RETRANSMITS) {
+          finishCommand(fanIndex, CommandState::TIMEOUT, MiioErr::TIMEOUT, FanOp::ReceiveResponse);
+          continue;
+        }
+        if (!sendCommandRequest(fanIndex, true)) {
+          finishCommand(fanIndex, CommandState::ERROR, MiioErr::INVALID_RESPONSE, FanOp::SendCommand);
+          continue;
+        }
+      }
+    }
+
+    if (isCommandPending(ctx)) anyPending = true;
+  }
+
+  updateFanOut(now);
+  if (flushCoalescedCommands(now)) anyPending = true;
+  if (reconcileDesiredStates(now)) anyPending = true;
+  if (updateKeepAlive(now)) anyPending = true;
+  return anyPending;
+}
+
+CommandState SmartMiFanAsync_getCommandState(uint8_t fanIndex) {
+  if (fanIndex >= g_discoveredFanCount) return CommandState::IDLE;
+  return g_commandContexts[fanIndex].state;
+}
+
+bool SmartMiFanAsync_isCommandComplete(uint8_t fanIndex) {
+  return SmartMiFanAsync_getCommandState(fanIndex) == CommandState::COMPLETE;
+}
+
+bool SmartMiFanAsync_isCommandInProgress(uint8_t fanIndex) {
+  if (fanIndex >= g_discoveredFanCount) return false;
+  return isCommandPending(g_commandContexts[fanIndex]);
+}
+
+void SmartMiFanAsync_cancelCommand(uint8_t fanIndex) {
+  if (fanIndex >= kMaxSmartMiFans) return;
+  g_commandContexts[fanIndex].reset();
+}
+
+void SmartMiFanAsync_cancelAllCommands() {
+  for (size_t i = 0; i < kMaxSmartMiFans; ++i) {
+    g_commandContexts[i].reset();
+  }
+  g_fanOutContext.reset();
+}
+
+void SmartMiFanAsync_setCommandCallback(FanCommandCallback cb) {
+  g_commandCallback = cb;
+}
+
+void SmartMiFanAsync_getRxStats(SmartMiFanRxStats &out) {
+  out = g_rxStats;
+}
+
+void SmartMiFanAsync_resetRxStats() {
+  memset(&g_rxStats, 0, sizeof(g_rxStats));
+}
+
+bool SmartMiFanAsync_getFanRttStats(uint8_t fanIndex, SmartMiFanRttStats &out) {
+  if (fanIndex >= g_discoveredFanCount) return false;
+  const RttEstimator &rtt = g_rttEstimators[fanIndex];
+  out.srttMs = rtt.srttMs;
+  out.rttVarMs = rtt.rttVarMs;
+  out.rtoMs = rtt.rto();
+  out.samples = rtt.samples;
+  out.retransmits = rtt.retransmits;
+  return true;
+}
+
+// =========================
+// Property Cache API
+// =========================
+
+bool SmartMiFanAsync_getCachedProperty(uint8_t fanIndex, int siid, int piid, FanPropertyValue &out) {
+  const FanPropertyValue *cached = findCachedProperty(fanIndex, siid, piid);
+  if (!cached) return false;
+  out = *cached;
+  return true;
+}
+
+bool SmartMiFanAsync_getCachedFanState(uint8_t fanIndex, bool &on, uint8_t &percent, uint32_t *ageMs) {
+  if (fanIndex >= g_discoveredFanCount) return false;
+  const SmartMiFanDiscoveredDevice &fan = g_discoveredFans[fanIndex];
+
+  int siid = 0;
+  int piid = 0;
+  bool useFanLevel = false;
+  getSpeedParamsByType(fan.modelType, siid, piid, useFanLevel);
+
+  const FanPropertyValue *power = findCachedProperty(fanIndex, 2, 1);
+  const FanPropertyValue *speed = findCachedProperty(fanIndex, siid, piid);
+  if (!power || !speed) return false;
+
+  on = power->value != 0;
+  percent = speedPropertyToPercent(fan.modelType, speed->value);
+  if (ageMs) {
+    // Age of the older of the two values
+    unsigned long now = millis();
+    uint32_t powerAge = now - power->updatedMillis;
+    uint32_t speedAge = now - speed->updatedMillis;
+    *ageMs = (powerAge > speedAge) ? powerAge : speedAge;
+  }
+  return true;
+}
+
+void SmartMiFanAsync_clearPropertyCache(uint8_t fanIndex) {
+  if (fanIndex >= kMaxSmartMiFans) return;
+  g_propertyCaches[fanIndex].reset();
+}
+
+// =========================
+// Parallel Fan-Out API
+// =========================
+
+bool SmartMiFanAsync_startSetPowerAll(bool on, unsigned long deadlineMs) {
+  return startFanOut(true, on, false, 0, deadlineMs);
+}
+
+bool SmartMiFanAsync_startSetSpeedAll(uint8_t percent, unsigned long deadlineMs) {
+  return startFanOut(false, false, true, percent, deadlineMs);
+}
+
+bool SmartMiFanAsync_startSetStateAll(bool on, uint8_t percent, unsigned long deadlineMs) {
+  return startFanOut(true, on, true, percent, deadlineMs);
+}
+
+bool SmartMiFanAsync_isFanOutInProgress() {
+  return g_fanOutContext.active;
+}
+
+void SmartMiFanAsync_setFanOutCallback(FanOutCallback cb) {
+  g_fanOutCallback = cb;
+}
+
+bool SmartMiFanAsync_isFanOutEnabled() {
+  return g_useFanOut;
+}
+
+void SmartMiFanAsync_setFanOutEnabled(bool enabled) {
+  g_useFanOut = enabled;
+}
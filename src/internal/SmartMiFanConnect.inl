@@ -133,9 +133,9 @@ bool SmartMiFanAsync_validateFastConnectFans(WiFiUDP &udp) {
       continue;
     }
     SmartMiFanAsync.setFanAddress(fan.ip);
-    
-    udp.stop();
-    udp.begin(0);
+    // Validate with a real hello into the fan's own session, kept for its first command
+    fan.session.valid = false;
+    SmartMiFanAsync.useSession(&fan.session);
     
     if (!SmartMiFanAsync.handshake()) {
       fan.ready = false;
@@ -188,6 +188,7 @@ bool SmartMiFanAsync_validateFastConnectFans(WiFiUDP &udp) {
     
     results[resultCount++] = result;
   }
+  releaseFanContext();
   
   // Invoke callback if set
   if (g_fastConnectCallback && resultCount > 0) {
@@ -221,11 +222,8 @@ static void SmartConnectCollectFailedFans(const SmartMiFanFastConnectResult resu
       // Remove failed fan from discovered list
       for (size_t k = 0; k < g_discoveredFanCount; ++k) {
         if (g_discoveredFans[k].ip == results[i].ip) {
-          // Shift remaining fans down
-          for (size_t m = k; m < g_discoveredFanCount - 1; ++m) {
-            g_discoveredFans[m] = g_discoveredFans[m + 1];
-          }
-          g_discoveredFanCount--;
+          // Shift remaining fans (and their per-slot state) down
+          removeDiscoveredFan(k);
           break;
         }
       }
@@ -15,10 +15,22 @@ namespace SmartMiFanInternal {
 SmartMiFanDiscoveredDevice g_discoveredFans[kMaxSmartMiFans];
 size_t g_discoveredFanCount = 0;
 WiFiUDP* g_udpContext = nullptr;
+WiFiUDP* g_udpOpen = nullptr;
 
 // Soft-active overrides (application-level retry logic)
 bool g_softActive[kMaxSmartMiFans] = {false};
 
+// Session keep-alive (SmartMiFanKeepAlive.inl)
+KeepAliveSlot g_keepAliveSlots[kMaxSmartMiFans];
+unsigned long g_keepAliveLastSend = 0;
+SystemState g_systemState = SystemState::ACTIVE;
+
+#if SMART_MI_FAN_KEEPALIVE_ENABLED
+bool g_useKeepAlive = true;
+#else
+bool g_useKeepAlive = false;
+#endif
+
 FanErrorCallback g_errorCallback = nullptr;
 
 FastConnectConfigEntry g_fastConnectConfig[kMaxFastConnectFans];
@@ -36,17 +48,41 @@ SmartConnectContext g_smartConnectContext;
 FastConnectValidationCallback g_originalFastConnectCallback = nullptr;
 
 DiscoveryContext g_discoveryContext;
+DiscoveryTokenKey g_discoveryTokenKeys[SMART_MI_FAN_DISCOVERY_MAX_TOKENS];
+DiscoveryExpectation g_discoveryExpectation = {};
+DiscoveryKnowledge g_discoveryKnowledge[SMART_MI_FAN_DISCOVERY_CACHE_SIZE];
+uint32_t g_discoveryRun = 0;
+bool g_useDiscoveryCache = true;
 QueryContext g_queryContext;
 
+// Async command engine (one context per fan slot)
+CommandContext g_commandContexts[kMaxSmartMiFans];
+FanCommandCallback g_commandCallback = nullptr;
+PropertyCache g_propertyCaches[kMaxSmartMiFans];
+DesiredState g_desiredStates[kMaxSmartMiFans];
+CoalesceSlot g_coalesceSlots[kMaxSmartMiFans];
+RttEstimator g_rttEstimators[kMaxSmartMiFans];
+FanOutContext g_fanOutContext;
+FanOutCallback g_fanOutCallback = nullptr;
+
+#if SMART_MI_FAN_FANOUT_ENABLED
+bool g_useFanOut = true;
+#else
+bool g_useFanOut = false;
+#endif
+
 // Shared static buffers (RAM optimization)
 uint8_t g_sharedUdpBuffer[512];
-uint8_t g_sharedPlainBuffer[512];
-uint8_t g_sharedCipherBuffer[256];
 uint8_t g_sharedQueryKey[16];
 uint8_t g_sharedQueryIv[16];
 
 uint32_t g_msgId = 1;
 
+// Persistent AES key schedules (built once per key, reused for every packet)
+AesKeySchedule g_aesSchedules[kAesScheduleSlots];
+size_t g_aesNextSlot = 0;
+SmartMiFanRxStats g_rxStats = {};
+
 // Supported models list
 const char* kSupportedModels[] = {
     "zhimi.fan.za5",
@@ -67,37 +103,39 @@ const char* kSupportedModels[] = {
     "dmaker.fan.p33",
     "dmaker.fan.p220",
 };
+const size_t kSupportedModelCount = sizeof(kSupportedModels) / sizeof(kSupportedModels[0]);
 
 // =========================
 // Context Accessor Implementations
 // =========================
 
-uint8_t* DiscoveryContext::queryKey() { return g_sharedQueryKey; }
-uint8_t* DiscoveryContext::queryIv() { return g_sharedQueryIv; }
-uint8_t* DiscoveryContext::queryCipher() { return g_sharedCipherBuffer; }
-
 void DiscoveryContext::reset() {
   state = DiscoveryState::IDLE;
   startTime = 0;
   discoveryMs = 0;
   tokens = nullptr;
   tokenCount = 0;
-  currentTokenIndex = 0;
-  currentCandidateIndex = 0;
   candidateCount = 0;
+  memset(progress, 0, sizeof(progress));
+  memset(probes, 0, sizeof(probes));
+  nextProbeCandidate = 0;
+  tokenSetHash = 0;
   udp = nullptr;
   lastHelloSend = 0;
   helloSent = false;
-  queryStartTime = 0;
-  querySent = false;
-  queryCipherLen = 0;
-  memset(&currentQueryCandidate, 0, sizeof(currentQueryCandidate));
-  currentQueryToken = nullptr;
+  helloIntervalMs = kDiscoveryHelloMinMs;
+  candidatesAtLastHello = 0;
+}
+
+void DiscoveryExpectation::reset() {
+  fanCount = 0;
+  memset(dids, 0, sizeof(dids));
+  didCount = 0;
+  allTokens = false;
 }
 
 uint8_t* QueryContext::queryKey() { return g_sharedQueryKey; }
 uint8_t* QueryContext::queryIv() { return g_sharedQueryIv; }
-uint8_t* QueryContext::queryCipher() { return g_sharedCipherBuffer; }
 
 void QueryContext::reset() {
   state = QueryState::IDLE;
@@ -109,10 +147,94 @@ void QueryContext::reset() {
   lastHelloSend = 0;
   queryStartTime = 0;
   querySent = false;
-  queryCipherLen = 0;
   memset(&candidate, 0, sizeof(candidate));
 }
 
+void CommandContext::reset() {
+  state = CommandState::IDLE;
+  memset(props, 0, sizeof(props));
+  propCount = 0;
+  isRead = false;
+  byReconciler = false;
+  startTime = 0;
+  lastSend = 0;
+  helloStart = 0;
+  requestStart = 0;
+  sends = 0;
+  msgId = 0;
+  frameLen = 0;
+  error = MiioErr::OK;
+  elapsedMs = 0;
+}
+
+void PropertyCache::reset() {
+  memset(entries, 0, sizeof(entries));
+  count = 0;
+}
+
+void CoalesceSlot::reset() {
+  hasPower = false;
+  power = false;
+  hasSpeed = false;
+  percent = 0;
+}
+
+void DesiredState::reset() {
+  hasPower = false;
+  power = false;
+  hasSpeed = false;
+  percent = 0;
+  inFlight = false;
+  failures = 0;
+  nextAttempt = 0;
+}
+
+void KeepAliveSlot::reset() {
+  pending = false;
+  failed = false;
+  sessionStamp = 0;
+  sentAt = 0;
+  lastSend = 0;
+  sends = 0;
+}
+
+void RttEstimator::reset() {
+  srttMs = 0;
+  rttVarMs = 0;
+  samples = 0;
+  retransmits = 0;
+}
+
+void RttEstimator::addSample(unsigned long rttMs) {
+  uint32_t r = (rttMs > 0xFFFF) ? 0xFFFF : static_cast<uint32_t>(rttMs);
+  if (samples == 0) {
+    srttMs = static_cast<uint16_t>(r);
+    rttVarMs = static_cast<uint16_t>(r / 2);
+  } else {
+    // RTTVAR = 3/4 RTTVAR + 1/4 |SRTT - R|, then SRTT = 7/8 SRTT + 1/8 R (rounded)
+    uint32_t err = (srttMs > r) ? srttMs - r : r - srttMs;
+    rttVarMs = static_cast<uint16_t>((3 * rttVarMs + err + 2) / 4);
+    srttMs = static_cast<uint16_t>((7 * srttMs + r + 4) / 8);
+  }
+  samples++;
+}
+
+unsigned long RttEstimator::rto() const {
+  if (samples == 0) return SMART_MI_FAN_RTO_INITIAL_MS;
+  unsigned long var = 4UL * rttVarMs;
+  unsigned long rto = srttMs + ((var > kRttClockGranularityMs) ? var : kRttClockGranularityMs);
+  if (rto < SMART_MI_FAN_RTO_MIN_MS) return SMART_MI_FAN_RTO_MIN_MS;
+  if (rto > SMART_MI_FAN_RTO_MAX_MS) return SMART_MI_FAN_RTO_MAX_MS;
+  return rto;
+}
+
+void FanOutContext::reset() {
+  active = false;
+  members = 0;
+  startTime = 0;
+  deadlineMs = 0;
+}
+
 // =========================
 // UDP Helpers
 // =========================
@@ -125,6 +247,20 @@ void discardUdpPacket(WiFiUDP* udp) {
   }
 }
 
+// Bind the socket once. WiFiUDP::begin() closes and rebinds on a new port,
+// which would drop every reply still on its way to the old one.
+void openUdp(WiFiUDP* udp) {
+  if (!udp || udp == g_udpOpen) return;
+  udp->begin(0);
+  g_udpOpen = udp;
+}
+
+void stopUdp(WiFiUDP* udp) {
+  if (!udp) return;
+  udp->stop();
+  if (udp == g_udpOpen) g_udpOpen = nullptr;
+}
+
 // =========================
 // Crypto Functions
 // =========================
@@ -165,6 +301,74 @@ void computeKeyIv(const uint8_t token[16], uint8_t key[16], uint8_t iv[16]) {
   md5(tmp, 32, iv);
 }
 
+// (Re)expand slot for key, releasing the schedules it held before
+void aesScheduleExpand(AesKeySchedule& slot, const uint8_t key[16]) {
+  if (slot.valid) {
+    mbedtls_aes_free(&slot.enc);
+    mbedtls_aes_free(&slot.dec);
+  }
+  mbedtls_aes_init(&slot.enc);
+  mbedtls_aes_init(&slot.dec);
+  mbedtls_aes_setkey_enc(&slot.enc, key, 128);
+  mbedtls_aes_setkey_dec(&slot.dec, key, 128);
+  memcpy(slot.key, key, 16);
+  slot.valid = true;
+}
+
+bool aesKeyOfDiscoveredFan(const uint8_t key[16]) {
+  for (size_t i = 0; i < g_discoveredFanCount; ++i) {
+    const SmartMiFanDiscoveredDevice& fan = g_discoveredFans[i];
+    if (fan.cryptoCached && memcmp(fan.cachedKey, key, 16) == 0) return true;
+  }
+  return false;
+}
+
+// Find the key schedule for key, expanding it into a slot on a miss. The victim
+// is the next empty slot or slot whose key belongs to no discovered fan (query
+// keys, standalone clients, removed fans), round-robin; with two more slots
+// than fans there always is one, so a fan's schedule is never re-expanded.
+AesKeySchedule& aesScheduleFor(const uint8_t key[16]) {
+  for (size_t i = 0; i < kAesScheduleSlots; ++i) {
+    if (g_aesSchedules[i].valid && memcmp(g_aesSchedules[i].key, key, 16) == 0) {
+      return g_aesSchedules[i];
+    }
+  }
+  
+  size_t victim = g_aesNextSlot;
+  for (size_t n = 0; n < kAesScheduleSlots; ++n) {
+    size_t i = (g_aesNextSlot + n) % kAesScheduleSlots;
+    if (!g_aesSchedules[i].valid || !aesKeyOfDiscoveredFan(g_aesSchedules[i].key)) {
+      victim = i;
+      break;
+    }
+  }
+  g_aesNextSlot = (victim + 1) % kAesScheduleSlots;
+  AesKeySchedule& slot = g_aesSchedules[victim];
+  aesScheduleExpand(slot, key);
+  return slot;
+}
+
+// One CBC call over the whole (block aligned) buffer; iv is not modified
+int aesCbcEncrypt(AesKeySchedule& sched, const uint8_t iv[16], const uint8_t* in, uint8_t* out, size_t len) {
+  uint8_t ivCopy[16];
+  memcpy(ivCopy, iv, sizeof(ivCopy));
+  return mbedtls_aes_crypt_cbc(&sched.enc, MBEDTLS_AES_ENCRYPT, len, ivCopy, in, out);
+}
+
+int aesCbcDecrypt(AesKeySchedule& sched, const uint8_t iv[16], const uint8_t* in, uint8_t* out, size_t len) {
+  uint8_t ivCopy[16];
+  memcpy(ivCopy, iv, sizeof(ivCopy));
+  return mbedtls_aes_crypt_cbc(&sched.dec, MBEDTLS_AES_DECRYPT, len, ivCopy, in, out);
+}
+
+int aesCbcEncrypt(const uint8_t key[16], const uint8_t iv[16], const uint8_t* in, uint8_t* out, size_t len) {
+  return aesCbcEncrypt(aesScheduleFor(key), iv, in, out, len);
+}
+
+int aesCbcDecrypt(const uint8_t key[16], const uint8_t iv[16], const uint8_t* in, uint8_t* out, size_t len) {
+  return aesCbcDecrypt(aesScheduleFor(key), iv, in, out, len);
+}
+
 // =========================
 // Model Helpers
 // =========================
@@ -260,6 +464,52 @@ void getSpeedParamsByType(FanModelType type, int& siid, int& piid, bool& useFanL
   }
 }
 
+// Map a speed percentage to the model's speed property.
+// DMAKER_FAN_1C only knows fan_level 1..3; all other models take 1..100.
+void speedPercentToProperty(FanModelType type, uint8_t percent, int& siid, int& piid, int& value) {
+  uint8_t p = percent;
+  if (p < 1) p = 1;
+  if (p > 100) p = 100;
+  
+  bool useFanLevel = false;
+  getSpeedParamsByType(type, siid, piid, useFanLevel);
+  
+  if (useFanLevel) {
+    value = (p > 66) ? 3 : (p > 33) ? 2 : 1;
+  } else {
+    value = p;
+  }
+}
+
+FanPropertyWrite powerPropertyWrite(bool on) {
+  FanPropertyWrite prop{};
+  prop.siid = 2;
+  prop.piid = 1;
+  prop.value = on ? 1 : 0;
+  prop.isBool = true;
+  return prop;
+}
+
+FanPropertyWrite speedPropertyWrite(FanModelType type, uint8_t percent) {
+  FanPropertyWrite prop{};
+  speedPercentToProperty(type, percent, prop.siid, prop.piid, prop.value);
+  prop.isBool = false;
+  return prop;
+}
+
+// Inverse of speedPercentToProperty(): fan_level 1..3 maps to 33/66/100 %
+uint8_t speedPropertyToPercent(FanModelType type, int value) {
+  int siid = 0;
+  int piid = 0;
+  bool useFanLevel = false;
+  getSpeedParamsByType(type, siid, piid, useFanLevel);
+  
+  int p = useFanLevel ? ((value >= 3) ? 100 : (value == 2) ? 66 : 33) : value;
+  if (p < 1) p = 1;
+  if (p > 100) p = 100;
+  return static_cast<uint8_t>(p);
+}
+
 // Suffix key macros for O(1) lookup (replaces strcmp chain)
 #define SKEY2(a,b) (((uint16_t)(a)<<8)|(b))
 #define SKEY3(a,b,c) (((uint32_t)(a)<<16)|((uint32_t)(b)<<8)|(c))
@@ -334,15 +584,89 @@ void cacheFanCrypto(SmartMiFanDiscoveredDevice& fan) {
   }
   
   computeKeyIv(fan.tokenBytes, fan.cachedKey, fan.cachedIv);
+  aesScheduleFor(fan.cachedKey);  // Expand key schedules now, not on the first command
   fan.modelType = modelStringToType(fan.model);
   fan.cryptoCached = true;
 }
 
+// Remove a fan and shift everything indexed by fan slot down with it
+void removeDiscoveredFan(size_t index) {
+  if (index >= g_discoveredFanCount) return;
+  releaseFanContext();  // The shift below moves sessions under a bound client
+  for (size_t m = index; m < g_discoveredFanCount - 1; ++m) {
+    g_discoveredFans[m] = g_discoveredFans[m + 1];
+    g_softActive[m] = g_softActive[m + 1];
+    g_commandContexts[m] = g_commandContexts[m + 1];
+    g_propertyCaches[m] = g_propertyCaches[m + 1];
+    g_desiredStates[m] = g_desiredStates[m + 1];
+    g_coalesceSlots[m] = g_coalesceSlots[m + 1];
+    g_keepAliveSlots[m] = g_keepAliveSlots[m + 1];
+    g_rttEstimators[m] = g_rttEstimators[m + 1];
+  }
+  g_discoveredFanCount--;
+  g_softActive[g_discoveredFanCount] = false;
+  g_commandContexts[g_discoveredFanCount].reset();
+  g_propertyCaches[g_discoveredFanCount].reset();
+  g_desiredStates[g_discoveredFanCount].reset();
+  g_coalesceSlots[g_discoveredFanCount].reset();
+  g_keepAliveSlots[g_discoveredFanCount].reset();
+  g_rttEstimators[g_discoveredFanCount].reset();
+  
+  // Keep fan-out membership bits aligned with the shifted slots
+  uint32_t below = g_fanOutContext.members & ((1UL << index) - 1);
+  uint32_t above = (g_fanOutContext.members >> (index + 1)) << index;
+  g_fanOutContext.members = below | above;
+}
+
+// Insert or update one cached value; a full cache replaces its oldest entry
+void storeCachedProperty(uint8_t fanIndex, int siid, int piid, int value) {
+  if (fanIndex >= kMaxSmartMiFans) return;
+  PropertyCache& cache = g_propertyCaches[fanIndex];
+  
+  FanPropertyValue* slot = nullptr;
+  for (size_t i = 0; i < cache.count; ++i) {
+    if (cache.entries[i].siid == siid && cache.entries[i].piid == piid) {
+      slot = &cache.entries[i];
+      break;
+    }
+  }
+  if (!slot) {
+    if (cache.count < SMART_MI_FAN_PROPERTY_CACHE_SIZE) {
+      slot = &cache.entries[cache.count++];
+    } else {
+      slot = &cache.entries[0];
+      for (size_t i = 1; i < cache.count; ++i) {
+        if (cache.entries[i].updatedMillis < slot->updatedMillis) slot = &cache.entries[i];
+      }
+    }
+  }
+  
+  slot->siid = siid;
+  slot->piid = piid;
+  slot->value = value;
+  slot->updatedMillis = millis();
+}
+
+const FanPropertyValue* findCachedProperty(uint8_t fanIndex, int siid, int piid) {
+  if (fanIndex >= g_discoveredFanCount) return nullptr;
+  const PropertyCache& cache = g_propertyCaches[fanIndex];
+  for (size_t i = 0; i < cache.count; ++i) {
+    if (cache.entries[i].siid == siid && cache.entries[i].piid == piid) {
+      return &cache.entries[i];
+    }
+  }
+  return nullptr;
+}
+
 void appendDiscoveredFan(const SmartMiFanDiscoveredDevice& fan) {
   if (g_discoveredFanCount >= kMaxSmartMiFans) return;
   if (fanAlreadyStored(fan.did, fan.ip)) return;
   g_discoveredFans[g_discoveredFanCount] = fan;
   cacheFanCrypto(g_discoveredFans[g_discoveredFanCount]);
+  g_propertyCaches[g_discoveredFanCount].reset();
+  g_desiredStates[g_discoveredFanCount].reset();
+  g_coalesceSlots[g_discoveredFanCount].reset();
+  g_rttEstimators[g_discoveredFanCount].reset();
   g_discoveredFanCount++;
 }
 
@@ -376,27 +700,274 @@ int findFanIndexByIp(const IPAddress& ip) {
 // Context Preparation
 // =========================
 
-bool prepareFanContextCached(const SmartMiFanDiscoveredDevice& fan) {
+// Binds the global client to the fan's cached crypto and per-fan session.
+// No MD5 and no handshake reset: a valid session is reused within its TTL.
+// Pair every call with releaseFanContext() once the exchange is done.
+bool prepareFanContextCached(SmartMiFanDiscoveredDevice& fan) {
   if (!g_udpContext) return false;
   if (!fan.cryptoCached) return false;
   
   SmartMiFanAsync.attachUdp(*g_udpContext);
-  SmartMiFanAsync.setToken(fan.tokenBytes);
+  SmartMiFanAsync.setTokenCached(fan.tokenBytes, fan.cachedKey, fan.cachedIv);
   SmartMiFanAsync.setFanAddress(fan.ip);
   SmartMiFanAsync.setModelType(fan.modelType);
+  SmartMiFanAsync.useSession(&fan.session);  // Bind last: address changes drop a bound session
   return true;
 }
 
-bool prepareFanContext(const SmartMiFanDiscoveredDevice& fan) {
-  if (fan.cryptoCached) {
-    return prepareFanContextCached(fan);
+bool prepareFanContext(SmartMiFanDiscoveredDevice& fan) {
+  if (!fan.cryptoCached) {
+    cacheFanCrypto(fan);
+  }
+  return prepareFanContextCached(fan);
+}
+
+bool prepareFanContext(uint8_t fanIndex) {
+  if (fanIndex >= g_discoveredFanCount) return false;
+  return prepareFanContext(g_discoveredFans[fanIndex]);
+}
+
+// Unbind the client from the fan table; removing or shifting fans must never
+// leave it pointing at another fan's session
+void releaseFanContext() {
+  SmartMiFanAsync.useSession(nullptr);
+}
+
+void invalidateFanSessions() {
+  for (size_t i = 0; i < g_discoveredFanCount; ++i) {
+    g_discoveredFans[i].session.valid = false;
   }
+}
+
+// Start a session from a 32-byte hello reply (device id + device timestamp)
+void applyHelloReply(SmartMiFanSession& session, const uint8_t hello[32]) {
+  memcpy(session.deviceId, hello + 8, 4);
+  session.deviceTimestamp = (uint32_t(hello[12]) << 24) | (uint32_t(hello[13]) << 16) |
+                            (uint32_t(hello[14]) << 8) | uint32_t(hello[15]);
+  session.anchorTimestamp = session.deviceTimestamp;
+  session.handshakeMillis = millis();
+  session.valid = true;
+  session.resumed = false;
+}
+
+// A matched reply proves the device still accepts the session: renew it like a
+// hello would. Uses the header readMiioReply() left in g_sharedUdpBuffer.
+void renewSessionFromReply(SmartMiFanSession& session) {
+  const uint8_t* header = g_sharedUdpBuffer;
+  uint32_t ts = (uint32_t(header[12]) << 24) | (uint32_t(header[13]) << 16) |
+                (uint32_t(header[14]) << 8) | uint32_t(header[15]);
+  if (ts > session.deviceTimestamp) session.deviceTimestamp = ts;
+  session.anchorTimestamp = ts;
+  session.handshakeMillis = millis();
+  session.resumed = false;
+}
+
+// A miIO.info probe sent on the candidate's hello (timestamp + 1) was answered:
+// that is a live session, so keep it instead of a fresh hello on the first command.
+// Uses the reply header left in g_sharedUdpBuffer, like renewSessionFromReply().
+void seedSessionFromProbe(SmartMiFanSession& session, const DiscoveryCandidate& candidate) {
+  memcpy(session.deviceId, candidate.deviceId, 4);
+  session.deviceTimestamp = candidate.timestamp + 1;
+  session.valid = true;
+  renewSessionFromReply(session);
+}
+
+// Timestamp for the next request: one past the last one sent, but never behind
+// the device clock extrapolated from the anchor (it keeps running while idle)
+uint32_t nextRequestTimestamp(const SmartMiFanSession& session) {
+  uint32_t clock = session.anchorTimestamp + (millis() - session.handshakeMillis) / 1000;
+  uint32_t ts = session.deviceTimestamp + 1;
+  return (clock > ts) ? clock : ts;
+}
+
+// Keep using a session past the TTL (up to kSessionMaxAgeMs) instead of a hello.
+// Marked resumed, so a request the device does not answer falls back to one.
+// Returns true if the session was extended.
+bool extrapolateSession(SmartMiFanSession& session) {
+  if (!session.valid) return false;
+  unsigned long age = millis() - session.handshakeMillis;
+  if (age < SMART_MI_FAN_HANDSHAKE_TTL_MS || age >= kSessionMaxAgeMs) return false;
+  session.resumed = true;
+  return true;
+}
+
+// Round-trip estimate of the discovered fan at ip (nullptr for other addresses)
+RttEstimator* rttEstimatorFor(const IPAddress& ip) {
+  int fanIndex = findFanIndexByIp(ip);
+  return (fanIndex >= 0) ? &g_rttEstimators[fanIndex] : nullptr;
+}
+
+// Wait after the sends-th transmission of a hello or request before it is resent
+// (or, after the last resend, given up): the RTO doubled per resend, capped.
+// Without an estimate (rtt == nullptr) the initial RTO is used.
+unsigned long retransmitWaitMs(const RttEstimator* rtt, uint8_t sends) {
+  unsigned long wait = rtt ? rtt->rto() : SMART_MI_FAN_RTO_INITIAL_MS;
+  if (sends > 1) wait <<= (sends - 1);
+  return (wait > SMART_MI_FAN_RTO_MAX_MS) ? SMART_MI_FAN_RTO_MAX_MS : wait;
+}
+
+// =========================
+// miIO Framing
+// =========================
+
+void sendMiioHello(WiFiUDP* udp, const IPAddress& ip) {
+  if (!udp) return;
+  uint8_t hello[32] = {0x21, 0x31, 0x00, 0x20};
+  memset(hello + 4, 0xFF, 28);
+  udp->beginPacket(ip, kMiioPort);
+  udp->write(hello, sizeof(hello));
+  udp->endPacket();
+}
+
+// miIO checksum: MD5(header[0..15] + token + cipher), streamed without a staging copy
+void miioChecksum(const uint8_t* frame, const uint8_t token[16], size_t cipherLen, uint8_t out[16]) {
+  mbedtls_md5_context ctx;
+  mbedtls_md5_init(&ctx);
+  mbedtls_md5_starts(&ctx);
+  mbedtls_md5_update(&ctx, frame, 16);
+  mbedtls_md5_update(&ctx, token, 16);
+  mbedtls_md5_update(&ctx, frame + 32, cipherLen);
+  mbedtls_md5_finish(&ctx, out);
+  mbedtls_md5_free(&ctx);
+}
+
+// Encode one request into a contiguous frame: json is padded and encrypted in
+// place at frame+32, then the header (incl. checksum) is filled in front of it.
+// Returns frame length, 0 if it does not fit.
+size_t encodeMiioFrame(const uint8_t token[16], AesKeySchedule& sched, const uint8_t iv[16],
+                       const uint8_t deviceId[4], uint32_t ts, const char* json,
+                       uint8_t* frame, size_t frameCap) {
+  if (!json || !frame) return 0;
   
-  if (!g_udpContext) return false;
-  SmartMiFanAsync.attachUdp(*g_udpContext);
-  if (!SmartMiFanAsync.setTokenFromHex(fan.token)) return false;
-  SmartMiFanAsync.setFanAddress(fan.ip);
-  SmartMiFanAsync.setModel(fan.model);
+  size_t len = strlen(json);
+  size_t raw = len + 1;
+  size_t pad = 16 - (raw % 16);
+  size_t cipherLen = raw + pad;
+  if (32 + cipherLen > frameCap || 32 + cipherLen > kMiioMaxFrameLen) return 0;
+  
+  uint8_t* cipher = frame + 32;
+  memcpy(cipher, json, len);
+  cipher[len] = 0x00;
+  memset(cipher + len + 1, static_cast<uint8_t>(pad), pad);
+  aesCbcEncrypt(sched, iv, cipher, cipher, cipherLen);
+  
+  MiioHeader* header = reinterpret_cast<MiioHeader*>(frame);
+  header->magic = to_be16(0x2131);
+  header->length = to_be16(32 + static_cast<uint16_t>(cipherLen));
+  header->unknown = 0;
+  memcpy(header->device_id, deviceId, 4);
+  header->ts_be = to_be32(ts);
+  miioChecksum(frame, token, cipherLen, header->checksum);
+  
+  return 32 + cipherLen;
+}
+
+size_t encodeMiioFrame(const uint8_t token[16], const uint8_t key[16], const uint8_t iv[16],
+                       const uint8_t deviceId[4], uint32_t ts, const char* json,
+                       uint8_t* frame, size_t frameCap) {
+  return encodeMiioFrame(token, aesScheduleFor(key), iv, deviceId, ts, json, frame, frameCap);
+}
+
+// Build {"id":..,"method":"set_properties","params":[{..},{..}]} with all writes
+// in one params array. Returns strlen, 0 if it does not fit.
+size_t buildSetPropertiesJson(uint32_t msgId, const FanPropertyWrite* props, size_t count,
+                             char* out, size_t outCap) {
+  if (!props || !out || count == 0 || count > SMART_MI_FAN_MAX_PROPERTY_WRITES) return 0;
+  
+  int n = snprintf(out, outCap, "{\"id\":%u,\"method\":\"set_properties\",\"params\":[", msgId);
+  if (n < 0 || static_cast<size_t>(n) >= outCap) return 0;
+  size_t pos = static_cast<size_t>(n);
+  
+  for (size_t i = 0; i < count; ++i) {
+    const FanPropertyWrite& prop = props[i];
+    if (prop.isBool) {
+      n = snprintf(out + pos, outCap - pos, "%s{\"siid\":%d,\"piid\":%d,\"value\":%s}",
+                   i > 0 ? "," : "", prop.siid, prop.piid, prop.value ? "true" : "false");
+    } else {
+      n = snprintf(out + pos, outCap - pos, "%s{\"siid\":%d,\"piid\":%d,\"value\":%d}",
+                   i > 0 ? "," : "", prop.siid, prop.piid, prop.value);
+    }
+    if (n < 0 || static_cast<size_t>(n) >= outCap - pos) return 0;
+    pos += static_cast<size_t>(n);
+  }
+  
+  n = snprintf(out + pos, outCap - pos, "]}");
+  if (n < 0 || static_cast<size_t>(n) >= outCap - pos) return 0;
+  return pos + static_cast<size_t>(n);
+}
+
+// Build {"id":..,"method":"get_properties","params":[{"siid":..,"piid":..},..]}.
+// Returns strlen, 0 if it does not fit.
+size_t buildGetPropertiesJson(uint32_t msgId, const FanPropertyId* props, size_t count,
+                             char* out, size_t outCap) {
+  if (!props || !out || count == 0 || count > SMART_MI_FAN_MAX_PROPERTY_WRITES) return 0;
+  
+  int n = snprintf(out, outCap, "{\"id\":%u,\"method\":\"get_properties\",\"params\":[", msgId);
+  if (n < 0 || static_cast<size_t>(n) >= outCap) return 0;
+  size_t pos = static_cast<size_t>(n);
+  
+  for (size_t i = 0; i < count; ++i) {
+    n = snprintf(out + pos, outCap - pos, "%s{\"siid\":%d,\"piid\":%d}",
+                 i > 0 ? "," : "", props[i].siid, props[i].piid);
+    if (n < 0 || static_cast<size_t>(n) >= outCap - pos) return 0;
+    pos += static_cast<size_t>(n);
+  }
+  
+  n = snprintf(out + pos, outCap - pos, "]}");
+  if (n < 0 || static_cast<size_t>(n) >= outCap - pos) return 0;
+  return pos + static_cast<size_t>(n);
+}
+
+// A set_properties reply reports a per-property "code"; any negative code
+// (or a top-level "error") means at least one write was rejected.
+bool replyHasPropertyError(const char* json) {
+  if (!json) return true;
+  return strstr(json, "\"error\"") != nullptr || strstr(json, "\"code\":-") != nullptr;
+}
+
+// Encode json for the fan's cached crypto and session. Advances session.deviceTimestamp.
+size_t buildMiioRequest(const SmartMiFanDiscoveredDevice& fan, SmartMiFanSession& session,
+                        const char* json, uint8_t* out, size_t outCap) {
+  if (!fan.cryptoCached) return 0;
+  
+  uint32_t ts = nextRequestTimestamp(session);
+  size_t frameLen = encodeMiioFrame(fan.tokenBytes, fan.cachedKey, fan.cachedIv,
+                                    session.deviceId, ts, json, out, outCap);
+  if (frameLen == 0) return 0;
+  
+  session.deviceTimestamp = ts;
+  return frameLen;
+}
+
+// Read one encrypted reply into g_sharedUdpBuffer and decrypt it in place.
+// Returns false (and counts the drop) if it is malformed or does not decrypt
+// to JSON with the given key. The packet is consumed either way.
+bool readMiioReply(WiFiUDP* udp, int len, const uint8_t key[16], const uint8_t iv[16],
+                   const char*& json) {
+  if (!udp) return false;
+  // Strictly smaller than the buffer: the NUL terminator goes after the payload
+  if (len <= 32 || len >= static_cast<int>(sizeof(g_sharedUdpBuffer)) || ((len - 32) % 16) != 0) {
+    discardUdpPacket(udp);
+    g_rxStats.malformed++;
+    return false;
+  }
+  if (udp->read(g_sharedUdpBuffer, len) != len) {
+    g_rxStats.malformed++;
+    return false;
+  }
+  
+  uint8_t* payload = g_sharedUdpBuffer + 32;
+  size_t payloadLen = len - 32;
+  int rc = aesCbcDecrypt(key, iv, payload, payload, payloadLen);
+  
+  size_t plainLen = pkcs7Unpad(payload, payloadLen);
+  payload[plainLen] = '\0';
+  if (rc != 0 || payload[0] != '{') {
+    g_rxStats.decryptFailed++;
+    return false;
+  }
+  
+  json = reinterpret_cast<const char*>(payload);
   return true;
 }
 
@@ -456,6 +1027,71 @@ uint32_t jsonExtractUint(const char* json, const char* key) {
   return strtoul(buffer, nullptr, 10);
 }
 
+// Request id echoed by the device ("did" never matches the "id" pattern)
+uint32_t jsonExtractId(const char* json) {
+  return jsonExtractUint(json, "id");
+}
+
+// Integer (or true/false) value of "key" between begin and end, no copies.
+// Fails for strings and missing keys.
+static bool jsonFindIntInRange(const char* begin, const char* end, const char* key, int& out) {
+  char pattern[16];
+  int n = snprintf(pattern, sizeof(pattern), "\"%s\":", key);
+  if (n < 0 || static_cast<size_t>(n) >= sizeof(pattern)) return false;
+  
+  const char* hit = strstr(begin, pattern);
+  if (!hit || hit >= end) return false;
+  hit += n;
+  while (hit < end && (*hit == ' ' || *hit == '\t')) hit++;
+  
+  if (strncmp(hit, "true", 4) == 0) { out = 1; return true; }
+  if (strncmp(hit, "false", 5) == 0) { out = 0; return true; }
+  
+  char* numEnd = nullptr;
+  long value = strtol(hit, &numEnd, 10);
+  if (numEnd == hit || numEnd > end) return false;
+  out = static_cast<int>(value);
+  return true;
+}
+
+// Parse the "result" array of a get_properties reply in place:
+// [{"did":"..","siid":2,"piid":1,"code":0,"value":true},...]
+// Entries with a non-zero code or a non-numeric value are skipped.
+// Returns the number of values written to out.
+size_t parseGetPropertiesResult(const char* json, FanPropertyValue* out, size_t outCap) {
+  if (!json || !out || outCap == 0) return 0;
+  
+  const char* p = strstr(json, "\"result\":[");
+  if (!p) return 0;
+  p += 10;
+  
+  size_t count = 0;
+  while (count < outCap) {
+    const char* objStart = strchr(p, '{');
+    const char* arrayEnd = strchr(p, ']');
+    if (!objStart || (arrayEnd && arrayEnd < objStart)) break;
+    const char* objEnd = strchr(objStart, '}');
+    if (!objEnd) break;
+    
+    int siid = 0;
+    int piid = 0;
+    int code = 0;
+    int value = 0;
+    if (jsonFindIntInRange(objStart, objEnd, "siid", siid) &&
+        jsonFindIntInRange(objStart, objEnd, "piid", piid) &&
+        (!jsonFindIntInRange(objStart, objEnd, "code", code) || code == 0) &&
+        jsonFindIntInRange(objStart, objEnd, "value", value)) {
+      out[count].siid = siid;
+      out[count].piid = piid;
+      out[count].value = value;
+      out[count].updatedMillis = millis();
+      count++;
+    }
+    p = objEnd + 1;
+  }
+  return count;
+}
+
 uint32_t extractDidFromJson(const char* json, const uint8_t deviceId[4]) {
   if (!json) return 0;
   
@@ -574,47 +1210,14 @@ bool sendMiioInfoQuery(MiioQueryParams& p) {
   computeKeyIv(token, p.queryKey, p.queryIv);
   
   const char* json = "{\"id\":1,\"method\":\"miIO.info\",\"params\":[]}";
-  size_t len = strlen(json);
-  size_t extra0 = 1;
-  size_t raw = len + extra0;
-  size_t pad = 16 - (raw % 16);
-  *p.queryCipherLen = raw + pad;
-  if (*p.queryCipherLen > 256) return false;
-  
-  uint8_t buffer[256];
-  memcpy(buffer, json, len);
-  buffer[len] = 0x00;
-  memset(buffer + len + 1, static_cast<uint8_t>(pad), pad);
-  
-  mbedtls_aes_context aes;
-  mbedtls_aes_init(&aes);
-  mbedtls_aes_setkey_enc(&aes, p.queryKey, 128);
-  uint8_t iv[16];
-  memcpy(iv, p.queryIv, sizeof(iv));
-  for (size_t off = 0; off < *p.queryCipherLen; off += 16) {
-    mbedtls_aes_crypt_cbc(&aes, MBEDTLS_AES_ENCRYPT, 16, iv, buffer + off, buffer + off);
-  }
-  mbedtls_aes_free(&aes);
-  memcpy(p.queryCipher, buffer, *p.queryCipherLen);
-  
-  p.queryHeader->magic = to_be16(0x2131);
-  p.queryHeader->length = to_be16(32 + static_cast<uint16_t>(*p.queryCipherLen));
-  p.queryHeader->unknown = 0;
-  memcpy(p.queryHeader->device_id, p.candidate->deviceId, 4);
-  uint32_t ts = p.candidate->timestamp + 1;
-  p.queryHeader->ts_be = to_be32(ts);
-  
-  uint8_t tmp[16 + 16 + 256];
-  memcpy(tmp, p.queryHeader, 16);
-  memcpy(tmp + 16, token, 16);
-  memcpy(tmp + 32, p.queryCipher, *p.queryCipherLen);
-  md5(tmp, 16 + 16 + *p.queryCipherLen, p.queryHeader->checksum);
+  uint8_t frame[96];
+  size_t frameLen = encodeMiioFrame(token, p.queryKey, p.queryIv, p.candidate->deviceId,
+                                    p.candidate->timestamp + 1, json, frame, sizeof(frame));
+  if (frameLen == 0) return false;
   
-  p.udp->stop();
-  p.udp->begin(0);
+  openUdp(p.udp);
   p.udp->beginPacket(p.candidate->ip, kMiioPort);
-  p.udp->write(reinterpret_cast<uint8_t*>(p.queryHeader), 32);
-  p.udp->write(p.queryCipher, *p.queryCipherLen);
+  p.udp->write(frame, frameLen);
   p.udp->endPacket();
   
   *p.querySent = true;
@@ -643,7 +1246,7 @@ QueryInfoResult processMiioResponse(MiioQueryParams& p, bool checkSupportedModel
       continue;
     }
     
-    if (len > static_cast<int>(sizeof(g_sharedUdpBuffer))) {
+    if (len >= static_cast<int>(sizeof(g_sharedUdpBuffer))) {
       discardUdpPacket(p.udp);  // Safe discard instead of flush()
       return QueryInfoResult::IN_PROGRESS;
     }
@@ -651,87 +1254,62 @@ QueryInfoResult processMiioResponse(MiioQueryParams& p, bool checkSupportedModel
     int readLen = p.udp->read(g_sharedUdpBuffer, len);
     if (readLen != len || len <= 32) return QueryInfoResult::IN_PROGRESS;
     
+    // Decrypt in place behind the header
     size_t payloadLen = len - 32;
-    uint8_t* respCipher = g_sharedUdpBuffer + 32;
-    
-    if (payloadLen > sizeof(g_sharedPlainBuffer)) return QueryInfoResult::IN_PROGRESS;
-    
-    mbedtls_aes_context aes;
-    mbedtls_aes_init(&aes);
-    mbedtls_aes_setkey_dec(&aes, p.queryKey, 128);
-    uint8_t iv[16];
-    memcpy(iv, p.queryIv, sizeof(iv));
-    memcpy(g_sharedPlainBuffer, respCipher, payloadLen);
-    if (mbedtls_aes_crypt_cbc(&aes, MBEDTLS_AES_DECRYPT, payloadLen, iv, respCipher, g_sharedPlainBuffer) != 0) {
-      mbedtls_aes_free(&aes);
+    uint8_t* payload = g_sharedUdpBuffer + 32;
+    if (aesCbcDecrypt(p.queryKey, p.queryIv, payload, payload, payloadLen) != 0) {
       return QueryInfoResult::IN_PROGRESS;
     }
-    mbedtls_aes_free(&aes);
-    
-    size_t plainLen = pkcs7Unpad(g_sharedPlainBuffer, payloadLen);
-    g_sharedPlainBuffer[plainLen] = '\0';
     
-    // Use proven jsonExtractString method (more reliable than single-pass parser)
-    char model[24] = {0};
-    char fw[16] = {0};
-    char hw[16] = {0};
+    size_t plainLen = pkcs7Unpad(payload, payloadLen);
+    payload[plainLen] = '\0';
+    const char* reply = reinterpret_cast<const char*>(payload);
     
-    if (!jsonExtractString(reinterpret_cast<char*>(g_sharedPlainBuffer), "model", model, sizeof(model))) {
+    if (!registerMiioInfoReply(reply, *p.candidate, p.tokenHex, checkSupportedModel)) {
       return QueryInfoResult::IN_PROGRESS;
     }
-    if (checkSupportedModel && !isSupportedModel(model)) {
-      return QueryInfoResult::IN_PROGRESS;
-    }
-    
-    // Extract fw_ver and hw_ver (optional fields)
-    jsonExtractString(reinterpret_cast<char*>(g_sharedPlainBuffer), "fw_ver", fw, sizeof(fw));
-    jsonExtractString(reinterpret_cast<char*>(g_sharedPlainBuffer), "hw_ver", hw, sizeof(hw));
-    
-    // Extract DID
-    uint32_t did = jsonExtractUint(reinterpret_cast<char*>(g_sharedPlainBuffer), "did");
-    if (did == 0 && p.candidate->deviceId) {
-      did = (p.candidate->deviceId[0] << 24) | (p.candidate->deviceId[1] << 16) | 
-            (p.candidate->deviceId[2] << 8) | p.candidate->deviceId[3];
-    }
-    
-    SmartMiFanDiscoveredDevice fan{};
-    fan.ip = p.candidate->ip;
-    fan.did = did;
-    safeCopyStr(fan.model, sizeof(fan.model), model);
-    safeCopyStr(fan.token, sizeof(fan.token), p.tokenHex);
-    safeCopyStr(fan.fw_ver, sizeof(fan.fw_ver), fw);
-    safeCopyStr(fan.hw_ver, sizeof(fan.hw_ver), hw);
-    fan.ready = false;
-    fan.lastError = MiioErr::OK;
-    fan.userEnabled = true;
-    
-    appendDiscoveredFan(fan);
     return QueryInfoResult::SUCCESS;
   }
   
   return QueryInfoResult::IN_PROGRESS;
 }
 
-QueryInfoResult attemptMiioInfoAsync(DiscoveryContext& ctx) {
-  MiioQueryParams params = {
-    ctx.udp,
-    &ctx.currentQueryCandidate,
-    ctx.currentQueryToken,
-    ctx.queryKey(),
-    ctx.queryIv(),
-    ctx.queryCipher(),
-    &ctx.queryCipherLen,
-    &ctx.queryHeader,
-    &ctx.queryStartTime,
-    &ctx.querySent
-  };
+// Parse a decrypted miIO.info reply and add the fan to the table
+bool registerMiioInfoReply(const char* reply, const DiscoveryCandidate& candidate, const char* tokenHex,
+                           bool checkSupportedModel) {
+  // Use proven jsonExtractString method (more reliable than single-pass parser)
+  char model[24] = {0};
+  char fw[16] = {0};
+  char hw[16] = {0};
   
-  if (!ctx.querySent) {
-    if (!sendMiioInfoQuery(params)) return QueryInfoResult::FAILED;
-    return QueryInfoResult::IN_PROGRESS;
+  if (!jsonExtractString(reply, "model", model, sizeof(model))) return false;
+  if (checkSupportedModel && !isSupportedModel(model)) return false;
+  
+  // Extract fw_ver and hw_ver (optional fields)
+  jsonExtractString(reply, "fw_ver", fw, sizeof(fw));
+  jsonExtractString(reply, "hw_ver", hw, sizeof(hw));
+  
+  // Extract DID
+  uint32_t did = jsonExtractUint(reply, "did");
+  if (did == 0) {
+    did = (candidate.deviceId[0] << 24) | (candidate.deviceId[1] << 16) | 
+          (candidate.deviceId[2] << 8) | candidate.deviceId[3];
   }
   
-  return processMiioResponse(params, true);
+  SmartMiFanDiscoveredDevice fan{};
+  fan.ip = candidate.ip;
+  fan.did = did;
+  safeCopyStr(fan.model, sizeof(fan.model), model);
+  safeCopyStr(fan.token, sizeof(fan.token), tokenHex);
+  safeCopyStr(fan.fw_ver, sizeof(fan.fw_ver), fw);
+  safeCopyStr(fan.hw_ver, sizeof(fan.hw_ver), hw);
+  fan.lastError = MiioErr::OK;
+  fan.userEnabled = true;
+  seedSessionFromProbe(fan.session, candidate);
+  fan.ready = true;
+  
+  appendDiscoveredFan(fan);
+  return true;
 }
 
 QueryInfoResult attemptMiioInfoAsync(QueryContext& ctx) {
@@ -741,9 +1319,6 @@ QueryInfoResult attemptMiioInfoAsync(QueryContext& ctx) {
     ctx.tokenHex,
     ctx.queryKey(),
     ctx.queryIv(),
-    ctx.queryCipher(),
-    &ctx.queryCipherLen,
-    &ctx.queryHeader,
     &ctx.queryStartTime,
     &ctx.querySent
   };
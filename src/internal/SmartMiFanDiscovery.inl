@@ -8,25 +8,361 @@
 
 using namespace SmartMiFanInternal;
 
+namespace {
+
+// =========================
+// Discovery Token Keys
+// =========================
+
+// Parse every token and derive key/IV and AES schedules once per run;
+// probes then only index the table (no hex parsing or MD5 per probe)
+void buildDiscoveryTokenKeys(const char *const tokens[], size_t tokenCount) {
+  uint32_t hash = 2166136261u;  // FNV-1a over the valid tokens (knowledge cache)
+  for (size_t i = 0; i < tokenCount; ++i) {
+    DiscoveryTokenKey &entry = g_discoveryTokenKeys[i];
+    entry.valid = hexToBytes16Helper(tokens[i], entry.token);
+    if (!entry.valid) {
+      FAN_LOGW_F("Discovery token %u is not 32 hex chars - skipped", (unsigned)i);
+      continue;
+    }
+    uint8_t key[16];
+    computeKeyIv(entry.token, key, entry.iv);
+    aesScheduleExpand(entry.aes, key);
+    for (size_t b = 0; b < sizeof(entry.token); ++b) {
+      hash = (hash ^ entry.token[b]) * 16777619u;
+    }
+  }
+  g_discoveryContext.tokenSetHash = hash;
+}
+
+// =========================
+// Discovery Probes
+// =========================
+
+void releaseProbe(DiscoveryProbe &probe) {
+  if (!probe.active) return;
+  DiscoveryCandidateProgress &progress = g_discoveryContext.progress[probe.candidate];
+  if (progress.pending > 0) progress.pending--;
+  probe.active = false;
+}
+
+void releaseAllProbes() {
+  for (size_t i = 0; i < SMART_MI_FAN_DISCOVERY_MAX_INFLIGHT; ++i) {
+    releaseProbe(g_discoveryContext.probes[i]);
+  }
+}
+
+// Skip tokens that did not parse
+size_t nextValidToken(size_t tokenIndex) {
+  while (tokenIndex < g_discoveryContext.tokenCount && !g_discoveryTokenKeys[tokenIndex].valid) tokenIndex++;
+  return tokenIndex;
+}
+
+bool tokensLeft(const DiscoveryCandidateProgress &progress) {
+  if (progress.resolved) return false;
+  if (progress.hintToken != kNoDiscoveryToken && !progress.hintSent) return true;
+  for (size_t t = nextValidToken(progress.nextToken); t < g_discoveryContext.tokenCount; t = nextValidToken(t + 1)) {
+    if (t != progress.hintToken) return true;
+  }
+  return false;
+}
+
+// Next token to probe for a candidate. A token remembered from an earlier
+// run goes first and alone; the others follow only if it stays unanswered.
+bool nextCandidateToken(DiscoveryCandidateProgress &progress, size_t &tokenIndex) {
+  if (progress.resolved) return false;
+  if (progress.hintToken != kNoDiscoveryToken) {
+    if (!progress.hintSent) {
+      progress.hintSent = true;
+      tokenIndex = progress.hintToken;
+      return true;
+    }
+    if (!progress.hintExpired) {
+      if (progress.pending > 0) return false;
+      progress.hintExpired = true;
+    }
+  }
+  for (;;) {
+    progress.nextToken = nextValidToken(progress.nextToken);
+    if (progress.nextToken >= g_discoveryContext.tokenCount) return false;
+    tokenIndex = progress.nextToken++;
+    if (tokenIndex != progress.hintToken) return true;
+  }
+}
+
+// Probes in flight or tokens still to try for some candidate
+bool probesOutstanding() {
+  for (size_t i = 0; i < g_discoveryContext.candidateCount; ++i) {
+    const DiscoveryCandidateProgress &progress = g_discoveryContext.progress[i];
+    if (progress.pending > 0 || tokensLeft(progress)) return true;
+  }
+  return false;
+}
+
+// Encode and send a probe's miIO.info request (first send and the one resend)
+bool transmitProbe(const DiscoveryProbe &probe) {
+  const DiscoveryCandidate &candidate = g_discoveryContext.candidates[probe.candidate];
+  DiscoveryTokenKey &tokenKey = g_discoveryTokenKeys[probe.token];
+  
+  char json[64];
+  snprintf(json, sizeof(json), "{\"id\":%lu,\"method\":\"miIO.info\",\"params\":[]}",
+           (unsigned long)probe.msgId);
+  uint8_t frame[96];
+  size_t frameLen = encodeMiioFrame(tokenKey.token, tokenKey.aes, tokenKey.iv, candidate.deviceId,
+                                    candidate.timestamp + 1, json, frame, sizeof(frame));
+  if (frameLen == 0) return false;
+  
+  // No socket restart here: other probes are still waiting for replies
+  g_discoveryContext.udp->beginPacket(candidate.ip, kMiioPort);
+  g_discoveryContext.udp->write(frame, frameLen);
+  g_discoveryContext.udp->endPacket();
+  return true;
+}
+
+bool sendProbe(uint8_t candidateIndex, size_t tokenIndex, DiscoveryProbe &probe, unsigned long now) {
+  probe.candidate = candidateIndex;
+  probe.token = static_cast<uint8_t>(tokenIndex);
+  probe.msgId = g_msgId++;
+  if (!transmitProbe(probe)) return false;
+  
+  probe.active = true;
+  probe.resent = false;
+  probe.sentAt = now;
+  g_discoveryContext.progress[candidateIndex].pending++;
+  return true;
+}
+
+DiscoveryProbe *freeProbeSlot() {
+  for (size_t i = 0; i < SMART_MI_FAN_DISCOVERY_MAX_INFLIGHT; ++i) {
+    if (!g_discoveryContext.probes[i].active) return &g_discoveryContext.probes[i];
+  }
+  return nullptr;
+}
+
+// Fill free slots. Burst: all tokens of a candidate back-to-back, oldest
+// candidate first. Otherwise breadth-first: one token per candidate per pass,
+// so every candidate gets its first probe before any gets its second.
+void sendProbes(unsigned long now) {
+  if (!g_discoveryContext.udp || g_discoveryContext.candidateCount == 0) return;
+  
+#if SMART_MI_FAN_DISCOVERY_TOKEN_BURST
+  for (size_t c = 0; c < g_discoveryContext.candidateCount; ++c) {
+    DiscoveryCandidateProgress &progress = g_discoveryContext.progress[c];
+    for (;;) {
+      DiscoveryProbe *probe = freeProbeSlot();
+      if (!probe) return;
+      size_t tokenIndex = 0;
+      if (!nextCandidateToken(progress, tokenIndex)) break;
+      sendProbe(static_cast<uint8_t>(c), tokenIndex, *probe, now);
+    }
+  }
+#else
+  bool sent = true;
+  while (sent) {
+    sent = false;
+    for (size_t n = 0; n < g_discoveryContext.candidateCount; ++n) {
+      DiscoveryProbe *probe = freeProbeSlot();
+      if (!probe) return;
+      
+      size_t c = (g_discoveryContext.nextProbeCandidate + n) % g_discoveryContext.candidateCount;
+      size_t tokenIndex = 0;
+      if (!nextCandidateToken(g_discoveryContext.progress[c], tokenIndex)) continue;
+      if (sendProbe(static_cast<uint8_t>(c), tokenIndex, *probe, now)) sent = true;
+    }
+    g_discoveryContext.nextProbeCandidate =
+        (g_discoveryContext.nextProbeCandidate + 1) % g_discoveryContext.candidateCount;
+  }
+#endif
+}
+
+// A wrong token gets no reply at all: give up on the probe after the timeout.
+// Halfway through, the request is sent once more (same id) so that a single
+// lost datagram does not cost the fan; this adds no waiting time.
+void expireProbes(unsigned long now) {
+  for (size_t i = 0; i < SMART_MI_FAN_DISCOVERY_MAX_INFLIGHT; ++i) {
+    DiscoveryProbe &probe = g_discoveryContext.probes[i];
+    if (!probe.active) continue;
+    unsigned long age = now - probe.sentAt;
+    if (age > kDiscoveryProbeTimeoutMs) {
+      releaseProbe(probe);
+    } else if (!probe.resent && age >= kDiscoveryProbeTimeoutMs / 2) {
+      probe.resent = true;
+      transmitProbe(probe);
+    }
+  }
+}
+
+void addCandidate(const IPAddress &sender, const uint8_t *hello) {
+  if (g_discoveryContext.candidateCount >= kMaxSmartMiFans) return;
+  if (candidateExists(g_discoveryContext.candidates, g_discoveryContext.candidateCount, sender)) return;
+  
+  DiscoveryCandidate candidate{};
+  if (!storeHelloCandidate(sender, hello, 32, candidate)) return;
+  DiscoveryCandidateProgress progress{};
+  if (!applyDiscoveryKnowledge(candidate, progress)) return;  // Known non-fan: keep the slot free
+  size_t index = g_discoveryContext.candidateCount++;
+  g_discoveryContext.candidates[index] = candidate;
+  g_discoveryContext.progress[index] = progress;
+}
+
+bool fanDiscovered(uint32_t did) {
+  for (size_t i = 0; i < g_discoveredFanCount; ++i) {
+    if (g_discoveredFans[i].did == did) return true;
+  }
+  return false;
+}
+
+bool tokenDiscovered(const uint8_t token[16]) {
+  for (size_t i = 0; i < g_discoveredFanCount; ++i) {
+    if (memcmp(g_discoveredFans[i].tokenBytes, token, 16) == 0) return true;
+  }
+  return false;
+}
+
+bool expectationSet() {
+  const DiscoveryExpectation &expect = g_discoveryExpectation;
+  return expect.fanCount > 0 || expect.didCount > 0 || expect.allTokens;
+}
+
+// True once every configured expectation is met (false if none is set)
+bool expectationMet() {
+  const DiscoveryExpectation &expect = g_discoveryExpectation;
+  if (!expectationSet()) return false;
+  
+  if (g_discoveredFanCount < expect.fanCount) return false;
+  for (size_t i = 0; i < expect.didCount; ++i) {
+    if (!fanDiscovered(expect.dids[i])) return false;
+  }
+  if (expect.allTokens) {
+    for (size_t t = 0; t < g_discoveryContext.tokenCount; ++t) {
+      if (g_discoveryTokenKeys[t].valid && !tokenDiscovered(g_discoveryTokenKeys[t].token)) return false;
+    }
+  }
+  return true;
+}
+
+// Hello re-broadcast backs off while no new device answers (each broadcast
+// is answered by every miIO device on the network). It stays at the minimum
+// while new candidates keep arriving or expected fans are still missing.
+void backOffHello() {
+  if (g_discoveryContext.candidateCount > g_discoveryContext.candidatesAtLastHello || expectationSet()) {
+    g_discoveryContext.helloIntervalMs = kDiscoveryHelloMinMs;
+  } else if (g_discoveryContext.helloIntervalMs < kDiscoveryHelloMaxMs) {
+    g_discoveryContext.helloIntervalMs *= 2;
+    if (g_discoveryContext.helloIntervalMs > kDiscoveryHelloMaxMs) g_discoveryContext.helloIntervalMs = kDiscoveryHelloMaxMs;
+  }
+  g_discoveryContext.candidatesAtLastHello = g_discoveryContext.candidateCount;
+}
+
+// End of a run: remember candidates that answered none of the tokens
+void finishDiscovery(DiscoveryState state) {
+  for (size_t i = 0; i < g_discoveryContext.candidateCount; ++i) {
+    const DiscoveryCandidateProgress &progress = g_discoveryContext.progress[i];
+    if (progress.resolved || progress.pending > 0 || tokensLeft(progress)) continue;
+    rememberNoToken(g_discoveryContext.candidates[i]);
+  }
+  releaseAllProbes();
+  g_discoveryContext.state = state;
+}
+
+// The reply checksum is MD5(header + device token + cipher): only the token
+// of the probe that was answered reproduces it
+bool checksumMatchesToken(const uint8_t *frame, size_t cipherLen, const DiscoveryProbe &probe) {
+  uint8_t checksum[16];
+  miioChecksum(frame, g_discoveryTokenKeys[probe.token].token, cipherLen, checksum);
+  return memcmp(checksum, frame + 16, sizeof(checksum)) == 0;
+}
+
+// miIO.info reply: match by source IP, then by token checksum and JSON id
+void handleProbeReply(const IPAddress &sender, int len) {
+  WiFiUDP *udp = g_discoveryContext.udp;
+  int candidateIndex = -1;
+  for (size_t i = 0; i < g_discoveryContext.candidateCount; ++i) {
+    if (g_discoveryContext.candidates[i].ip == sender) {
+      candidateIndex = static_cast<int>(i);
+      break;
+    }
+  }
+  if (candidateIndex < 0 || g_discoveryContext.progress[candidateIndex].pending == 0 ||
+      len <= 32 || len >= static_cast<int>(sizeof(g_sharedUdpBuffer)) || (len - 32) % 16 != 0) {
+    discardUdpPacket(udp);  // Safe discard instead of flush()
+    return;
+  }
+  if (udp->read(g_sharedUdpBuffer, len) != len) return;
+  
+  uint8_t *payload = g_sharedUdpBuffer + 32;
+  size_t payloadLen = len - 32;
+  for (size_t i = 0; i < SMART_MI_FAN_DISCOVERY_MAX_INFLIGHT; ++i) {
+    DiscoveryProbe &probe = g_discoveryContext.probes[i];
+    if (!probe.active || probe.candidate != static_cast<uint8_t>(candidateIndex)) continue;
+    if (!checksumMatchesToken(g_sharedUdpBuffer, payloadLen, probe)) continue;
+    
+    // Decrypt in place behind the header
+    DiscoveryTokenKey &tokenKey = g_discoveryTokenKeys[probe.token];
+    if (aesCbcDecrypt(tokenKey.aes, tokenKey.iv, payload, payload, payloadLen) != 0) return;
+    size_t plainLen = pkcs7Unpad(payload, payloadLen);
+    payload[plainLen] = '\0';
+    const char *reply = reinterpret_cast<const char *>(payload);
+    if (jsonExtractId(reply) != probe.msgId) return;  // Duplicate / late reply
+    
+    // The token is right whether or not the model is supported: stop probing this candidate
+    DiscoveryCandidateProgress &progress = g_discoveryContext.progress[candidateIndex];
+    progress.resolved = true;
+    const DiscoveryCandidate &candidate = g_discoveryContext.candidates[candidateIndex];
+    if (registerMiioInfoReply(reply, candidate, g_discoveryContext.tokens[probe.token], true)) {
+      char model[24] = {0};
+      jsonExtractString(reply, "model", model, sizeof(model));
+      rememberDiscoveredFan(candidate, probe.token, model);
+    } else {
+      rememberNotAFan(candidate);
+    }
+    for (size_t j = 0; j < SMART_MI_FAN_DISCOVERY_MAX_INFLIGHT; ++j) {
+      if (g_discoveryContext.probes[j].candidate == static_cast<uint8_t>(candidateIndex)) releaseProbe(g_discoveryContext.probes[j]);
+    }
+    return;
+  }
+}
+
+}  // namespace
+
 // =========================
 // Discovery API
 // =========================
 
 void SmartMiFanAsync_resetDiscoveredFans() {
+  // Client may still point at a per-fan session in the table
+  releaseFanContext();
   g_discoveredFanCount = 0;
   // Reset soft-active overrides
   for (size_t i = 0; i < kMaxSmartMiFans; ++i) {
     g_softActive[i] = false;
   }
+  // Drop async commands, cached values and desired states of the old fan table
+  SmartMiFanAsync_cancelAllCommands();
+  for (size_t i = 0; i < kMaxSmartMiFans; ++i) {
+    g_propertyCaches[i].reset();
+    g_desiredStates[i].reset();
+    g_coalesceSlots[i].reset();
+    g_keepAliveSlots[i].reset();
+    g_rttEstimators[i].reset();
+  }
 }
 
 bool SmartMiFanAsync_startDiscovery(WiFiUDP &udp, const char *const tokens[], size_t tokenCount, unsigned long discoveryMs) {
   // Note: g_useFastConnect no longer blocks discovery - Smart Connect needs both
   if (tokens == nullptr || tokenCount == 0) return false;
-  if (g_discoveryContext.state != DiscoveryState::IDLE) return false;
+  if (tokenCount > SMART_MI_FAN_DISCOVERY_MAX_TOKENS) {
+    FAN_LOGW_F("Discovery rejected: %u tokens (max %u)", (unsigned)tokenCount,
+               (unsigned)SMART_MI_FAN_DISCOVERY_MAX_TOKENS);
+    return false;
+  }
+  // A finished run (COMPLETE / ERROR / TIMEOUT) may be restarted directly
+  if (SmartMiFanAsync_isDiscoveryInProgress()) return false;
   
   g_udpContext = &udp;
   g_discoveryContext.reset();
+  buildDiscoveryTokenKeys(tokens, tokenCount);
+  g_discoveryRun++;
   g_discoveryContext.udp = &udp;
   g_discoveryContext.tokens = tokens;
   g_discoveryContext.tokenCount = tokenCount;
@@ -34,8 +370,7 @@ bool SmartMiFanAsync_startDiscovery(WiFiUDP &udp, const char *const tokens[], si
   g_discoveryContext.startTime = millis();
   g_discoveryContext.state = DiscoveryState::SENDING_HELLO;
   
-  udp.stop();
-  udp.begin(0);
+  openUdp(&udp);
   
   uint8_t hello[32] = {0x21, 0x31, 0x00, 0x20};
   memset(hello + 4, 0xFF, 28);
@@ -49,6 +384,32 @@ bool SmartMiFanAsync_startDiscovery(WiFiUDP &udp, const char *const tokens[], si
   return true;
 }
 
+// =========================
+// Expected Fans API
+// =========================
+
+void SmartMiFanAsync_setExpectedFanCount(size_t count) {
+  g_discoveryExpectation.fanCount = count > kMaxSmartMiFans ? kMaxSmartMiFans : count;
+}
+
+bool SmartMiFanAsync_setExpectedFanDids(const uint32_t dids[], size_t count) {
+  if (count > kMaxSmartMiFans || (count > 0 && dids == nullptr)) return false;
+  memset(g_discoveryExpectation.dids, 0, sizeof(g_discoveryExpectation.dids));
+  for (size_t i = 0; i < count; ++i) {
+    g_discoveryExpectation.dids[i] = dids[i];
+  }
+  g_discoveryExpectation.didCount = count;
+  return true;
+}
+
+void SmartMiFanAsync_setExpectAllTokens(bool enabled) {
+  g_discoveryExpectation.allTokens = enabled;
+}
+
+void SmartMiFanAsync_clearExpectedFans() {
+  g_discoveryExpectation.reset();
+}
+
 bool SmartMiFanAsync_startDiscovery(WiFiUDP &udp, const char *tokenHex, unsigned long discoveryMs) {
   return SmartMiFanAsync_startDiscovery(udp, &tokenHex, tokenHex ? 1 : 0, discoveryMs);
 }
@@ -62,21 +423,22 @@ bool SmartMiFanAsync_updateDiscovery() {
     return false;
   }
   
+  unsigned long now = millis();
+  
   // Check timeout for querying phase
   if (g_discoveryContext.state == DiscoveryState::QUERYING_DEVICES) {
     unsigned long minTimeout = g_discoveryContext.discoveryMs * 3;
     unsigned long queryTimeout = g_discoveryContext.discoveryMs + 
                                  (g_discoveryContext.candidateCount * g_discoveryContext.tokenCount * 2500UL);
     if (queryTimeout < minTimeout) queryTimeout = minTimeout;
-    if (millis() - g_discoveryContext.startTime > queryTimeout) {
-      g_discoveryContext.state = DiscoveryState::TIMEOUT;
+    if (now - g_discoveryContext.startTime > queryTimeout) {
+      finishDiscovery(DiscoveryState::TIMEOUT);
       return false;
     }
   }
   
   if (g_discoveryContext.state == DiscoveryState::SENDING_HELLO) {
-    unsigned long now = millis();
-    if (now - g_discoveryContext.lastHelloSend >= 500) {
+    if (now - g_discoveryContext.lastHelloSend >= g_discoveryContext.helloIntervalMs) {
       if (g_discoveryContext.udp) {
         uint8_t hello[32] = {0x21, 0x31, 0x00, 0x20};
         memset(hello + 4, 0xFF, 28);
@@ -84,78 +446,48 @@ bool SmartMiFanAsync_updateDiscovery() {
         g_discoveryContext.udp->write(hello, sizeof(hello));
         g_discoveryContext.udp->endPacket();
         g_discoveryContext.lastHelloSend = now;
+        backOffHello();
       }
     }
-    
-    if (g_discoveryContext.udp) {
+  }
+  
+  // Hellos and probe replies share the socket: drain a few per call
+  if (g_discoveryContext.udp) {
+    for (size_t n = 0; n < kDiscoveryRxPerUpdate; ++n) {
       int len = g_discoveryContext.udp->parsePacket();
-      if (len == 32 && g_discoveryContext.candidateCount < kMaxSmartMiFans) {
+      if (len <= 0) break;
+      IPAddress sender = g_discoveryContext.udp->remoteIP();
+      if (len == 32) {
         uint8_t buf[32];
         g_discoveryContext.udp->read(buf, 32);
-        IPAddress sender = g_discoveryContext.udp->remoteIP();
-        if (!candidateExists(g_discoveryContext.candidates, g_discoveryContext.candidateCount, sender)) {
-          DiscoveryCandidate candidate{};
-          if (storeHelloCandidate(sender, buf, 32, candidate)) {
-            g_discoveryContext.candidates[g_discoveryContext.candidateCount++] = candidate;
-          }
-        }
-      } else if (len > 0) {
-        discardUdpPacket(g_discoveryContext.udp);  // Safe discard instead of flush()
+        if (g_discoveryContext.state == DiscoveryState::SENDING_HELLO) addCandidate(sender, buf);
+      } else {
+        handleProbeReply(sender, len);
       }
     }
-    
-    if (millis() - g_discoveryContext.startTime >= g_discoveryContext.discoveryMs) {
-      g_discoveryContext.state = DiscoveryState::QUERYING_DEVICES;
-      g_discoveryContext.currentCandidateIndex = 0;
-      g_discoveryContext.currentTokenIndex = 0;
-    }
-    
-    return true;
   }
   
-  if (g_discoveryContext.state == DiscoveryState::QUERYING_DEVICES) {
-    if (g_discoveredFanCount >= kMaxSmartMiFans) {
-      g_discoveryContext.state = DiscoveryState::COMPLETE;
-      return false;
-    }
-    
-    if (g_discoveryContext.candidateCount == 0 || 
-        g_discoveryContext.currentCandidateIndex >= g_discoveryContext.candidateCount) {
-      g_discoveryContext.state = DiscoveryState::COMPLETE;
-      return false;
-    }
-    
-    const DiscoveryCandidate &candidate = g_discoveryContext.candidates[g_discoveryContext.currentCandidateIndex];
-    const char *token = g_discoveryContext.tokens[g_discoveryContext.currentTokenIndex];
-    
-    if (!g_discoveryContext.querySent) {
-      g_discoveryContext.currentQueryCandidate = candidate;
-      g_discoveryContext.currentQueryToken = token;
-      g_discoveryContext.queryStartTime = 0;
-    }
-    
-    QueryInfoResult result = attemptMiioInfoAsync(g_discoveryContext);
-    
-    if (result == QueryInfoResult::SUCCESS) {
-      g_discoveryContext.querySent = false;
-      g_discoveryContext.currentTokenIndex++;
-      if (g_discoveryContext.currentTokenIndex >= g_discoveryContext.tokenCount) {
-        g_discoveryContext.currentTokenIndex = 0;
-        g_discoveryContext.currentCandidateIndex++;
-      }
-    } else if (result == QueryInfoResult::FAILED) {
-      g_discoveryContext.querySent = false;
-      g_discoveryContext.currentTokenIndex++;
-      if (g_discoveryContext.currentTokenIndex >= g_discoveryContext.tokenCount) {
-        g_discoveryContext.currentTokenIndex = 0;
-        g_discoveryContext.currentCandidateIndex++;
-      }
-    }
-    
-    return true;
+  expireProbes(now);
+  
+  if (g_discoveredFanCount >= kMaxSmartMiFans || expectationMet()) {
+    finishDiscovery(DiscoveryState::COMPLETE);
+    return false;
   }
   
-  return false;
+  sendProbes(now);
+  
+  if (g_discoveryContext.state == DiscoveryState::SENDING_HELLO &&
+      now - g_discoveryContext.startTime >= g_discoveryContext.discoveryMs) {
+    g_discoveryContext.state = DiscoveryState::QUERYING_DEVICES;
+  }
+  
+  // Done once the hello window is over and every candidate has had all its tokens
+  if (g_discoveryContext.state == DiscoveryState::QUERYING_DEVICES && !probesOutstanding()) {
+    finishDiscovery(DiscoveryState::COMPLETE);
+    return false;
+  }
+  
+  return true;
 }
 
 DiscoveryState SmartMiFanAsync_getDiscoveryState() {
@@ -194,8 +526,7 @@ bool SmartMiFanAsync_startQueryDevice(WiFiUDP &udp, const IPAddress &ip, const c
   g_queryContext.startTime = millis();
   g_queryContext.state = QueryState::WAITING_HELLO;
   
-  udp.stop();
-  udp.begin(0);
+  openUdp(&udp);
   
   uint8_t hello[32] = {0x21, 0x31, 0x00, 0x20};
   memset(hello + 4, 0xFF, 28);
@@ -330,9 +661,17 @@ void SmartMiFanAsync_printDiscoveredFans() {
 
 bool SmartMiFanAsync_handshakeAll() {
   if (!g_udpContext) return false;
+  // One broadcast hello for every fan without a fresh session; the loop below
+  // then only sends unicast hellos to fans that stayed silent
+  uint32_t helloMask = 0;
+  for (size_t i = 0; i < g_discoveredFanCount; ++i) {
+    if (sessionNeedsHello(g_discoveredFans[i].session)) helloMask |= 1UL << i;
+  }
+  broadcastHandshake(helloMask, kBroadcastHelloWindowMs);
+
   bool overall = true;
   for (size_t i = 0; i < g_discoveredFanCount; ++i) {
-    const auto &fan = g_discoveredFans[i];
+    auto &fan = g_discoveredFans[i];
     if (!prepareFanContext(fan)) {
       overall = false;
       continue;
@@ -341,6 +680,7 @@ bool SmartMiFanAsync_handshakeAll() {
       overall = false;
     }
   }
+  releaseFanContext();
   return overall;
 }
 
@@ -348,7 +688,7 @@ bool SmartMiFanAsync_setPowerAll(bool on) {
   if (!g_udpContext) return false;
   bool overall = true;
   for (size_t i = 0; i < g_discoveredFanCount; ++i) {
-    const auto &fan = g_discoveredFans[i];
+    auto &fan = g_discoveredFans[i];
     if (!prepareFanContext(fan)) {
       overall = false;
       continue;
@@ -357,6 +697,7 @@ bool SmartMiFanAsync_setPowerAll(bool on) {
       overall = false;
     }
   }
+  releaseFanContext();
   return overall;
 }
 
@@ -364,7 +705,7 @@ bool SmartMiFanAsync_setSpeedAll(uint8_t percent) {
   if (!g_udpContext) return false;
   bool overall = true;
   for (size_t i = 0; i < g_discoveredFanCount; ++i) {
-    const auto &fan = g_discoveredFans[i];
+    auto &fan = g_discoveredFans[i];
     if (!prepareFanContext(fan)) {
       overall = false;
       continue;
@@ -373,5 +714,67 @@ bool SmartMiFanAsync_setSpeedAll(uint8_t percent) {
       overall = false;
     }
   }
+  releaseFanContext();
   return overall;
 }
+
+// =========================
+// Per-Fan Control APIs
+// =========================
+// Addressed by fan index. The client is bound to the fan's cached crypto and
+// session, so a fan handshaked within SMART_MI_FAN_HANDSHAKE_TTL_MS costs a
+// single request/response round trip per command.
+
+bool SmartMiFanAsync_handshakeFan(uint8_t fanIndex) {
+  if (!prepareFanContext(fanIndex)) return false;
+  bool ok = SmartMiFanAsync.handshake();
+  releaseFanContext();
+  return ok;
+}
+
+bool SmartMiFanAsync_setFanPower(uint8_t fanIndex, bool on) {
+  if (!prepareFanContext(fanIndex)) return false;
+  bool ok = SmartMiFanAsync.setPower(on);
+  releaseFanContext();
+  return ok;
+}
+
+bool SmartMiFanAsync_setFanSpeed(uint8_t fanIndex, uint8_t percent) {
+  if (!prepareFanContext(fanIndex)) return false;
+  bool ok = SmartMiFanAsync.setSpeed(percent);
+  releaseFanContext();
+  return ok;
+}
+
+bool SmartMiFanAsync_setFanState(uint8_t fanIndex, bool on, uint8_t percent) {
+  if (!prepareFanContext(fanIndex)) return false;
+  bool ok = SmartMiFanAsync.setPowerAndSpeed(on, percent);
+  releaseFanContext();
+  return ok;
+}
+
+bool SmartMiFanAsync_setFanProperties(uint8_t fanIndex, const FanPropertyWrite props[], size_t count) {
+  if (!prepareFanContext(fanIndex)) return false;
+  bool ok = SmartMiFanAsync.setProperties(props, count);
+  releaseFanContext();
+  return ok;
+}
+
+bool SmartMiFanAsync_readFanState(uint8_t fanIndex) {
+  if (!prepareFanContext(fanIndex)) return false;
+  bool on = false;
+  uint8_t percent = 0;
+  bool ok = SmartMiFanAsync.readPowerAndSpeed(on, percent);
+  releaseFanContext();
+  return ok;
+}
+
+bool SmartMiFanAsync_readFanProperties(uint8_t fanIndex, const FanPropertyId props[], size_t count) {
+  if (count > SMART_MI_FAN_MAX_PROPERTY_WRITES) return false;
+  if (!prepareFanContext(fanIndex)) return false;
+  FanPropertyValue values[SMART_MI_FAN_MAX_PROPERTY_WRITES];
+  size_t found = 0;
+  bool ok = SmartMiFanAsync.getProperties(props, count, values, found);
+  releaseFanContext();
+  return ok;
+}
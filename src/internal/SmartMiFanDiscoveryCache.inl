@@ -0,0 +1,134 @@
+// =============================================================================
+// SmartMiFanAsync - Discovery Cache Module
+// =============================================================================
+// Contains: Discovery knowledge cache. Remembers per hello deviceId which
+//           token and model matched, and which devices are not fans or
+//           matched no token, so the next discovery probes known fans with
+//           their token first and skips everything else.
+// =============================================================================
+
+#include "SmartMiFanInternal.h"
+
+using namespace SmartMiFanInternal;
+
+namespace {
+
+// Entry for deviceId, reusing an empty or the least recently seen slot
+DiscoveryKnowledge &knowledgeSlot(uint32_t deviceId) {
+  DiscoveryKnowledge *entry = findDiscoveryKnowledge(deviceId);
+  if (entry) return *entry;
+
+  DiscoveryKnowledge *oldest = &g_discoveryKnowledge[0];
+  for (size_t i = 0; i < SMART_MI_FAN_DISCOVERY_CACHE_SIZE; ++i) {
+    DiscoveryKnowledge &slot = g_discoveryKnowledge[i];
+    if (slot.kind == DiscoveryKnowledgeKind::EMPTY) {
+      oldest = &slot;
+      break;
+    }
+    if (static_cast<int32_t>(slot.lastRun - oldest->lastRun) < 0) oldest = &slot;
+  }
+  memset(oldest, 0, sizeof(*oldest));
+  oldest->deviceId = deviceId;
+  return *oldest;
+}
+
+}  // namespace
+
+namespace SmartMiFanInternal {
+
+uint32_t discoveryDeviceId(const DiscoveryCandidate &candidate) {
+  return (static_cast<uint32_t>(candidate.deviceId[0]) << 24) | (candidate.deviceId[1] << 16) |
+         (candidate.deviceId[2] << 8) | candidate.deviceId[3];
+}
+
+DiscoveryKnowledge *findDiscoveryKnowledge(uint32_t deviceId) {
+  for (size_t i = 0; i < SMART_MI_FAN_DISCOVERY_CACHE_SIZE; ++i) {
+    DiscoveryKnowledge &entry = g_discoveryKnowledge[i];
+    if (entry.kind != DiscoveryKnowledgeKind::EMPTY && entry.deviceId == deviceId) return &entry;
+  }
+  return nullptr;
+}
+
+// Called for every new hello candidate. Returns false if the candidate is
+// known not to answer any of the current tokens (it is then not probed);
+// otherwise sets the token that matched last time as the first probe.
+bool applyDiscoveryKnowledge(const DiscoveryCandidate &candidate, DiscoveryCandidateProgress &progress) {
+  progress.hintToken = kNoDiscoveryToken;
+  if (!g_useDiscoveryCache) return true;
+  DiscoveryKnowledge *entry = findDiscoveryKnowledge(discoveryDeviceId(candidate));
+  if (!entry) return true;
+  bool seenThisRun = entry->lastRun == g_discoveryRun;  // Skipped device sent another hello
+  entry->lastRun = g_discoveryRun;
+
+  switch (entry->kind) {
+    case DiscoveryKnowledgeKind::NOT_A_FAN:
+      return false;
+
+    case DiscoveryKnowledgeKind::NO_TOKEN:
+      // Only valid for the same token list; re-probe now and then in case
+      // every reply of an earlier run was lost
+      if (entry->tokenSetHash != g_discoveryContext.tokenSetHash) return true;
+      if (seenThisRun) return false;
+      if (entry->skips >= kDiscoveryNegativeSkipRuns) {
+        entry->skips = 0;
+        return true;
+      }
+      entry->skips++;
+      return false;
+
+    case DiscoveryKnowledgeKind::FAN:
+      for (size_t t = 0; t < g_discoveryContext.tokenCount; ++t) {
+        if (g_discoveryTokenKeys[t].valid && memcmp(g_discoveryTokenKeys[t].token, entry->token, 16) == 0) {
+          progress.hintToken = static_cast<uint8_t>(t);
+          break;
+        }
+      }
+      return true;
+
+    default:
+      return true;
+  }
+}
+
+void rememberDiscoveredFan(const DiscoveryCandidate &candidate, size_t tokenIndex, const char *model) {
+  if (!g_useDiscoveryCache) return;
+  DiscoveryKnowledge &entry = knowledgeSlot(discoveryDeviceId(candidate));
+  entry.kind = DiscoveryKnowledgeKind::FAN;
+  entry.modelType = modelStringToType(model);
+  memcpy(entry.token, g_discoveryTokenKeys[tokenIndex].token, sizeof(entry.token));
+  entry.lastRun = g_discoveryRun;
+}
+
+void rememberNotAFan(const DiscoveryCandidate &candidate) {
+  if (!g_useDiscoveryCache) return;
+  DiscoveryKnowledge &entry = knowledgeSlot(discoveryDeviceId(candidate));
+  entry.kind = DiscoveryKnowledgeKind::NOT_A_FAN;
+  entry.lastRun = g_discoveryRun;
+}
+
+void rememberNoToken(const DiscoveryCandidate &candidate) {
+  if (!g_useDiscoveryCache) return;
+  DiscoveryKnowledge &entry = knowledgeSlot(discoveryDeviceId(candidate));
+  entry.kind = DiscoveryKnowledgeKind::NO_TOKEN;
+  entry.tokenSetHash = g_discoveryContext.tokenSetHash;
+  entry.skips = 0;
+  entry.lastRun = g_discoveryRun;
+}
+
+}  // namespace SmartMiFanInternal
+
+// =========================
+// Discovery Knowledge Cache API
+// =========================
+
+void SmartMiFanAsync_setDiscoveryCacheEnabled(bool enabled) {
+  g_useDiscoveryCache = enabled;
+}
+
+bool SmartMiFanAsync_isDiscoveryCacheEnabled() {
+  return g_useDiscoveryCache;
+}
+
+void SmartMiFanAsync_clearDiscoveryCache() {
+  memset(g_discoveryKnowledge, 0, sizeof(g_discoveryKnowledge));
+}
@@ -24,6 +24,49 @@ namespace SmartMiFanInternal {
 constexpr uint16_t kMiioPort = 54321;
 constexpr size_t kMaxSmartMiFans = 16;
 constexpr size_t kMaxFastConnectFans = 4;
+constexpr size_t kMiioMaxFrameLen = 32 + 256;  // Header + largest request cipher text
+
+// Cached AES key schedules: one per fan plus the standalone client and the device query
+// (discovery tokens have their own, see DiscoveryTokenKey)
+constexpr size_t kAesScheduleSlots = kMaxSmartMiFans + 2;
+
+// Async command timing (same values as the blocking client paths). Hellos and
+// requests are resent on the fan's RTO (see RttEstimator); these are the caps.
+constexpr unsigned long kBroadcastHelloWindowMs = 500; // Listen window of a broadcast hello (broadcastHandshake())
+constexpr unsigned long kHandshakeTimeoutMs = 2000;
+constexpr unsigned long kCommandAckTimeoutMs = 1500;
+constexpr unsigned long kRttClockGranularityMs = 10;  // Lower bound of the RTO variance term
+constexpr unsigned long kDiscoveryProbeTimeoutMs = 2000;  // miIO.info probe without reply (wrong token)
+constexpr size_t kDiscoveryRxPerUpdate = 8;               // Packets drained per updateDiscovery()
+constexpr unsigned long kDiscoveryHelloMinMs = 250;       // Hello re-broadcast while new devices answer
+constexpr unsigned long kDiscoveryHelloMaxMs = 1000;      // Backoff cap while nothing new answers
+constexpr uint8_t kNoDiscoveryToken = 0xFF;               // DiscoveryCandidateProgress::hintToken unset
+constexpr uint8_t kDiscoveryNegativeSkipRuns = 8;         // No-token devices are probed again after this many skips
+constexpr unsigned long kReconcileRetryMinMs = 1000;   // First retry after a failed reconcile
+constexpr unsigned long kReconcileRetryMaxMs = 30000;  // Backoff cap for fans that stay unreachable
+constexpr unsigned long kKeepAliveSpacingMs = 100;     // Min gap between two keep-alive hellos
+// Oldest session still used (optimistically past the TTL)
+constexpr unsigned long kSessionMaxAgeMs = (SMART_MI_FAN_OPTIMISTIC_SESSION_MS > SMART_MI_FAN_HANDSHAKE_TTL_MS)
+                                               ? SMART_MI_FAN_OPTIMISTIC_SESSION_MS
+                                               : SMART_MI_FAN_HANDSHAKE_TTL_MS;
+static_assert(SMART_MI_FAN_RTO_MIN_MS <= SMART_MI_FAN_RTO_MAX_MS, "RTO bounds are reversed");
+static_assert(SMART_MI_FAN_MAX_RETRANSMITS < 8, "Retransmission backoff shift would overflow");
+static_assert(SMART_MI_FAN_KEEPALIVE_LEAD_MS < SMART_MI_FAN_HANDSHAKE_TTL_MS,
+              "Keep-alive lead must be shorter than the handshake TTL");
+
+// Warm-boot fan table snapshot (see SmartMiFanSnapshot.inl for the layout)
+constexpr uint32_t kSnapshotMagic = 0x53464D53;  // "SMFS" read as little-endian bytes
+constexpr uint8_t kSnapshotVersion = 1;          // Bump on any layout or FanModelType change
+constexpr size_t kSnapshotHeaderLen = 8;
+constexpr size_t kSnapshotRecordMaxLen = 4 + 4 + 1 + 1 + 48 + 24 + 16 + 16 + 13;  // Incl. session (sleep snapshot)
+constexpr size_t kSnapshotMaxLen = kSnapshotHeaderLen + kMaxSmartMiFans * kSnapshotRecordMaxLen + 4;
+static_assert(kSnapshotMaxLen <= SMART_MI_FAN_SLEEP_SNAPSHOT_BYTES, "Sleep snapshot does not fit its public buffer size");
+
+// Discovery knowledge cache snapshot (same module, own blob)
+constexpr uint32_t kKnowledgeMagic = 0x4B464D53;  // "SMFK" read as little-endian bytes
+constexpr uint8_t kKnowledgeVersion = 1;          // Bump on any layout or FanModelType change
+constexpr size_t kKnowledgeRecordMaxLen = 4 + 1 + 2 + 1 + 16;  // FAN record (the largest)
+constexpr size_t kKnowledgeMaxLen = kSnapshotHeaderLen + SMART_MI_FAN_DISCOVERY_CACHE_SIZE * kKnowledgeRecordMaxLen + 4;
 
 // =========================
 // Internal Structures
@@ -72,33 +115,78 @@ struct SmartConnectContext {
   }
 };
 
-// Async Discovery Context (uses shared buffers for crypto)
+// One miIO.info probe in flight during discovery (candidate x token).
+// A wrong token is never answered; the probe is resent once halfway and
+// expires after kDiscoveryProbeTimeoutMs, freeing its slot.
+struct DiscoveryProbe {
+  bool active;
+  bool resent;
+  uint8_t candidate;      // Index into DiscoveryContext::candidates
+  uint8_t token;          // Index into DiscoveryContext::tokens / g_discoveryTokenKeys
+  uint32_t msgId;
+  unsigned long sentAt;
+};
+
+static_assert(SMART_MI_FAN_DISCOVERY_MAX_TOKENS <= 255, "DiscoveryProbe::token is a uint8_t");
+
+// Probing progress per candidate
+struct DiscoveryCandidateProgress {
+  size_t nextToken;   // Next token to probe
+  uint8_t pending;    // Probes in flight
+  bool resolved;      // A token answered; remaining tokens are skipped
+  uint8_t hintToken;  // Token that matched in an earlier run (kNoDiscoveryToken = none), probed alone first
+  bool hintSent;
+  bool hintExpired;   // Hint probe went unanswered: the other tokens are probed as usual
+};
+
+// What earlier discovery runs learned about one device (keyed by hello deviceId)
+enum class DiscoveryKnowledgeKind : uint8_t {
+  EMPTY,
+  FAN,         // token + model matched
+  NOT_A_FAN,   // token matched, model not supported (vacuum, lamp, ...)
+  NO_TOKEN     // every token was tried without reply
+};
+
+struct DiscoveryKnowledge {
+  uint32_t deviceId;
+  DiscoveryKnowledgeKind kind;
+  FanModelType modelType;  // FAN
+  uint8_t token[16];       // FAN: token that answered
+  uint32_t tokenSetHash;   // NO_TOKEN: token list the device was tried against
+  uint8_t skips;           // NO_TOKEN: runs skipped since the last probe
+  uint32_t lastRun;        // Discovery run that last saw the device (eviction)
+};
+
+// Async Discovery Context
+// Candidates are probed as soon as their hello arrives; probes for all
+// candidates and tokens run concurrently up to SMART_MI_FAN_DISCOVERY_MAX_INFLIGHT.
 struct DiscoveryContext {
   DiscoveryState state;
   unsigned long startTime;
   unsigned long discoveryMs;
   const char* const* tokens;
   size_t tokenCount;
-  size_t currentTokenIndex;
-  size_t currentCandidateIndex;
   DiscoveryCandidate candidates[kMaxSmartMiFans];
+  DiscoveryCandidateProgress progress[kMaxSmartMiFans];
   size_t candidateCount;
+  DiscoveryProbe probes[SMART_MI_FAN_DISCOVERY_MAX_INFLIGHT];
+  size_t nextProbeCandidate;  // Round-robin start for the next free slot
+  uint32_t tokenSetHash;      // Identifies the token list (knowledge cache)
   WiFiUDP* udp;
   unsigned long lastHelloSend;
   bool helloSent;
+  unsigned long helloIntervalMs;   // Adaptive re-broadcast interval
+  size_t candidatesAtLastHello;    // New candidates since the last hello reset the backoff
   
-  // For async miio.info query
-  DiscoveryCandidate currentQueryCandidate;
-  const char* currentQueryToken;
-  size_t queryCipherLen;
-  MiioHeader queryHeader;
-  unsigned long queryStartTime;
-  bool querySent;
-  
-  // Accessors to shared buffers (defined in Core module)
-  uint8_t* queryKey();
-  uint8_t* queryIv();
-  uint8_t* queryCipher();
+  void reset();
+};
+
+// Fans the application expects (early exit once all are resolved)
+struct DiscoveryExpectation {
+  size_t fanCount;                  // 0 = not set
+  uint32_t dids[kMaxSmartMiFans];
+  size_t didCount;                  // 0 = not set
+  bool allTokens;                   // Every configured token matched a fan
   
   void reset();
 };
@@ -115,19 +203,123 @@ struct QueryContext {
   unsigned long lastHelloSend;
   
   // For async miio.info query
-  size_t queryCipherLen;
-  MiioHeader queryHeader;
   unsigned long queryStartTime;
   bool querySent;
   
   // Accessors to shared buffers
   uint8_t* queryKey();
   uint8_t* queryIv();
-  uint8_t* queryCipher();
   
   void reset();
 };
 
+// Async Command Context (one per fan slot, indexed like g_discoveredFans)
+struct CommandContext {
+  CommandState state;
+  FanPropertyWrite props[SMART_MI_FAN_MAX_PROPERTY_WRITES];  // Sent in one set_properties request
+  uint8_t propCount;
+  bool isRead;                // get_properties (values in props ignored) instead of set_properties
+  bool byReconciler;          // Started by the reconciler; cleared when another command replaces it
+  unsigned long startTime;    // millis() when the command was started
+  unsigned long lastSend;     // millis() of last hello or request send
+  unsigned long helloStart;   // millis() of the first hello (handshake timeout)
+  unsigned long requestStart; // millis() of the first send of the request (ACK timeout)
+  uint8_t sends;              // Transmissions of the current hello or request (1 + resends)
+  uint32_t msgId;             // JSON id of the request in flight (0 = none yet)
+  uint16_t frameLen;          // Encoded request in frame (0 = none)
+  uint8_t frame[kMiioMaxFrameLen];  // Request as sent; resends repeat these bytes
+  MiioErr error;              // Result once COMPLETE/ERROR/TIMEOUT
+  uint32_t elapsedMs;         // Start to finish
+  
+  void reset();
+};
+
+// Per-fan property cache (last read back or acknowledged values)
+struct PropertyCache {
+  FanPropertyValue entries[SMART_MI_FAN_PROPERTY_CACHE_SIZE];
+  uint8_t count;
+  
+  void reset();
+};
+
+// Orchestrated values waiting for the coalescing cooldown (latest value wins)
+struct CoalesceSlot {
+  bool hasPower;
+  bool power;
+  bool hasSpeed;
+  uint8_t percent;
+  
+  void reset();
+};
+
+// Desired state of one fan (declarative control, converged by the reconciler)
+struct DesiredState {
+  bool hasPower;
+  bool power;
+  bool hasSpeed;
+  uint8_t percent;
+  bool inFlight;              // Reconcile command started in the fan's command context (see byReconciler)
+  uint8_t failures;           // Consecutive failed attempts (drives retry backoff)
+  unsigned long nextAttempt;  // millis() before which no retry is sent
+  
+  void reset();
+};
+
+// Keep-alive hello for one fan (SmartMiFanKeepAlive.inl)
+struct KeepAliveSlot {
+  bool pending;                 // Hello sent, reply not yet seen
+  bool failed;                  // No reply for the session in sessionStamp: not retried
+  unsigned long sessionStamp;   // session.handshakeMillis when the hello was sent
+  unsigned long sentAt;         // millis() of the first hello
+  unsigned long lastSend;       // millis() of the last (re)send
+  uint8_t sends;                // Hellos sent for this refresh
+  
+  void reset();
+};
+
+// Round-trip estimate of one fan (RFC 6298: SRTT / RTTVAR, RTO with backoff).
+// Only replies to a hello or request sent once are sampled (Karn's rule).
+struct RttEstimator {
+  uint16_t srttMs;
+  uint16_t rttVarMs;
+  uint32_t samples;
+  uint32_t retransmits;
+  
+  void reset();
+  void addSample(unsigned long rttMs);
+  unsigned long rto() const;
+};
+
+// Parallel Fan-Out Context (group of command contexts with a shared deadline)
+struct FanOutContext {
+  bool active;
+  uint32_t members;           // Bit i set = fan slot i takes part
+  unsigned long startTime;
+  unsigned long deadlineMs;
+  
+  void reset();
+};
+
+// Expanded AES-128 encrypt/decrypt key schedules for one key.
+// Lives in a fixed table and is looked up by key, so it is never copied
+// (mbedtls contexts may point into themselves) and survives fan table shifts.
+struct AesKeySchedule {
+  mbedtls_aes_context enc;
+  mbedtls_aes_context dec;
+  uint8_t key[16];
+  bool valid;
+};
+
+// Discovery token, parsed and derived once per startDiscovery().
+// Carries its own key schedules so probing never evicts fan schedules
+// from the shared table.
+struct DiscoveryTokenKey {
+  uint8_t token[16];
+  uint8_t iv[16];
+  AesKeySchedule aes;  // aes.key is the derived key
+  bool valid;          // Hex parsed; invalid tokens are never probed
+};
+
 // Phase 3: Single-Pass miIO.info Parser result
 struct MiioInfoFields {
   char model[24];
@@ -151,9 +343,6 @@ struct MiioQueryParams {
   const char* tokenHex;
   uint8_t* queryKey;
   uint8_t* queryIv;
-  uint8_t* queryCipher;
-  size_t* queryCipherLen;
-  MiioHeader* queryHeader;
   unsigned long* queryStartTime;
   bool* querySent;
 };
@@ -164,6 +353,7 @@ struct MiioQueryParams {
 extern SmartMiFanDiscoveredDevice g_discoveredFans[kMaxSmartMiFans];
 extern size_t g_discoveredFanCount;
 extern WiFiUDP* g_udpContext;
+extern WiFiUDP* g_udpOpen;  // Socket bound by openUdp(), if any
 extern FanErrorCallback g_errorCallback;
 
 extern FastConnectConfigEntry g_fastConnectConfig[kMaxFastConnectFans];
@@ -175,19 +365,39 @@ extern SmartConnectContext g_smartConnectContext;
 extern FastConnectValidationCallback g_originalFastConnectCallback;
 
 extern DiscoveryContext g_discoveryContext;
+extern DiscoveryTokenKey g_discoveryTokenKeys[SMART_MI_FAN_DISCOVERY_MAX_TOKENS];
+extern DiscoveryExpectation g_discoveryExpectation;
+extern DiscoveryKnowledge g_discoveryKnowledge[SMART_MI_FAN_DISCOVERY_CACHE_SIZE];
+extern uint32_t g_discoveryRun;
+extern bool g_useDiscoveryCache;
 extern QueryContext g_queryContext;
 
+extern CommandContext g_commandContexts[kMaxSmartMiFans];
+extern FanCommandCallback g_commandCallback;
+extern PropertyCache g_propertyCaches[kMaxSmartMiFans];
+extern DesiredState g_desiredStates[kMaxSmartMiFans];
+extern CoalesceSlot g_coalesceSlots[kMaxSmartMiFans];
+extern FanOutContext g_fanOutContext;
+extern FanOutCallback g_fanOutCallback;
+extern bool g_useFanOut;
+extern bool g_softActive[kMaxSmartMiFans];
+extern KeepAliveSlot g_keepAliveSlots[kMaxSmartMiFans];
+extern RttEstimator g_rttEstimators[kMaxSmartMiFans];
+extern bool g_useKeepAlive;
+extern unsigned long g_keepAliveLastSend;
+extern SystemState g_systemState;
+
 // Shared static buffers
 extern uint8_t g_sharedUdpBuffer[512];
-extern uint8_t g_sharedPlainBuffer[512];
-extern uint8_t g_sharedCipherBuffer[256];
 extern uint8_t g_sharedQueryKey[16];
 extern uint8_t g_sharedQueryIv[16];
 
 extern uint32_t g_msgId;
+extern SmartMiFanRxStats g_rxStats;
 
 // Supported models list
 extern const char* kSupportedModels[];
+extern const size_t kSupportedModelCount;
 
 // =========================
 // Core Utility Functions
@@ -208,30 +418,77 @@ void md5(const uint8_t* in, size_t len, uint8_t out[16]);
 
 // UDP helpers - safe packet discard (avoids flush() which can discard multiple packets)
 void discardUdpPacket(WiFiUDP* udp);
+// Bind once and keep the port while commands are in flight; stopUdp() before rebinding
+void openUdp(WiFiUDP* udp);
+void stopUdp(WiFiUDP* udp);
 
 // Crypto helpers
 bool hexToBytes16Helper(const char* hex, uint8_t out16[16]);
 void computeKeyIv(const uint8_t token[16], uint8_t key[16], uint8_t iv[16]);
+void aesScheduleExpand(AesKeySchedule& slot, const uint8_t key[16]);
+AesKeySchedule& aesScheduleFor(const uint8_t key[16]);
+int aesCbcEncrypt(AesKeySchedule& sched, const uint8_t iv[16], const uint8_t* in, uint8_t* out, size_t len);
+int aesCbcDecrypt(AesKeySchedule& sched, const uint8_t iv[16], const uint8_t* in, uint8_t* out, size_t len);
+int aesCbcEncrypt(const uint8_t key[16], const uint8_t iv[16], const uint8_t* in, uint8_t* out, size_t len);
+int aesCbcDecrypt(const uint8_t key[16], const uint8_t iv[16], const uint8_t* in, uint8_t* out, size_t len);
 
 // Model/Fan helpers
 bool isSupportedModel(const char* model);
 FanModelType modelStringToType(const char* model);
 void getSpeedParamsByType(FanModelType type, int& siid, int& piid, bool& useFanLevel);
 bool getSpeedParams(const char* model, int& siid, int& piid, bool& useFanLevel);
+void speedPercentToProperty(FanModelType type, uint8_t percent, int& siid, int& piid, int& value);
+FanPropertyWrite powerPropertyWrite(bool on);
+FanPropertyWrite speedPropertyWrite(FanModelType type, uint8_t percent);
+uint8_t speedPropertyToPercent(FanModelType type, int value);
 bool fanAlreadyStored(uint32_t did, const IPAddress& ip);
 
 // JSON parsing
 size_t pkcs7Unpad(uint8_t* buffer, size_t len);
 bool jsonExtractString(const char* json, const char* key, char* out, size_t outLen);
 uint32_t jsonExtractUint(const char* json, const char* key);
+uint32_t jsonExtractId(const char* json);
 uint32_t extractDidFromJson(const char* json, const uint8_t deviceId[4]);
 bool parseMiioInfoSinglePass(const char* json, MiioInfoFields& out);
 
 // Fan management
 void cacheFanCrypto(SmartMiFanDiscoveredDevice& fan);
 void appendDiscoveredFan(const SmartMiFanDiscoveredDevice& fan);
-bool prepareFanContext(const SmartMiFanDiscoveredDevice& fan);
-bool prepareFanContextCached(const SmartMiFanDiscoveredDevice& fan);
+bool prepareFanContext(SmartMiFanDiscoveredDevice& fan);
+bool prepareFanContext(uint8_t fanIndex);
+bool prepareFanContextCached(SmartMiFanDiscoveredDevice& fan);
+void releaseFanContext();
+void invalidateFanSessions();
+void applyHelloReply(SmartMiFanSession& session, const uint8_t hello[32]);
+void renewSessionFromReply(SmartMiFanSession& session);
+void seedSessionFromProbe(SmartMiFanSession& session, const DiscoveryCandidate& candidate);
+uint32_t nextRequestTimestamp(const SmartMiFanSession& session);
+bool extrapolateSession(SmartMiFanSession& session);
+RttEstimator* rttEstimatorFor(const IPAddress& ip);
+unsigned long retransmitWaitMs(const RttEstimator* rtt, uint8_t sends);
+void removeDiscoveredFan(size_t index);
+void storeCachedProperty(uint8_t fanIndex, int siid, int piid, int value);
+const FanPropertyValue* findCachedProperty(uint8_t fanIndex, int siid, int piid);
+
+// miIO framing
+void sendMiioHello(WiFiUDP* udp, const IPAddress& ip);
+void miioChecksum(const uint8_t* frame, const uint8_t token[16], size_t cipherLen, uint8_t out[16]);
+size_t encodeMiioFrame(const uint8_t token[16], AesKeySchedule& sched, const uint8_t iv[16],
+                       const uint8_t deviceId[4], uint32_t ts, const char* json,
+                       uint8_t* frame, size_t frameCap);
+size_t encodeMiioFrame(const uint8_t token[16], const uint8_t key[16], const uint8_t iv[16],
+                       const uint8_t deviceId[4], uint32_t ts, const char* json,
+                       uint8_t* frame, size_t frameCap);
+size_t buildSetPropertiesJson(uint32_t msgId, const FanPropertyWrite* props, size_t count,
+                             char* out, size_t outCap);
+bool replyHasPropertyError(const char* json);
+size_t buildGetPropertiesJson(uint32_t msgId, const FanPropertyId* props, size_t count,
+                             char* out, size_t outCap);
+size_t parseGetPropertiesResult(const char* json, FanPropertyValue* out, size_t outCap);
+size_t buildMiioRequest(const SmartMiFanDiscoveredDevice& fan, SmartMiFanSession& session,
+                        const char* json, uint8_t* out, size_t outCap);
+bool readMiioReply(WiFiUDP* udp, int len, const uint8_t key[16], const uint8_t iv[16],
+                   const char*& json);
 
 // Error handling
 void emitErrorCallback(uint8_t fanIndex, const IPAddress& ip, FanOp operation, 
@@ -243,12 +500,37 @@ bool storeHelloCandidate(const IPAddress& ip, const uint8_t* buffer, size_t len,
                          DiscoveryCandidate& candidate);
 bool candidateExists(const DiscoveryCandidate* candidates, size_t count, const IPAddress& ip);
 
+// Discovery knowledge cache
+uint32_t discoveryDeviceId(const DiscoveryCandidate& candidate);
+DiscoveryKnowledge* findDiscoveryKnowledge(uint32_t deviceId);
+bool applyDiscoveryKnowledge(const DiscoveryCandidate& candidate, DiscoveryCandidateProgress& progress);
+void rememberDiscoveredFan(const DiscoveryCandidate& candidate, size_t tokenIndex, const char* model);
+void rememberNotAFan(const DiscoveryCandidate& candidate);
+void rememberNoToken(const DiscoveryCandidate& candidate);
+
 // Query system (Phase 1 consolidated)
 bool sendMiioInfoQuery(MiioQueryParams& p);
 QueryInfoResult processMiioResponse(MiioQueryParams& p, bool checkSupportedModel = true);
+bool registerMiioInfoReply(const char* reply, const DiscoveryCandidate& candidate, const char* tokenHex,
+                           bool checkSupportedModel);
+
+// Async command engine
+bool beginFanOut(unsigned long deadlineMs);
+bool addFanOutMember(uint8_t fanIndex, const FanPropertyWrite* props, size_t count);
+bool commitFanOut();
+bool waitForFanOut();
+bool routeForeignReply(WiFiUDP* udp, int len);
+bool reconcileDesiredStates(unsigned long now);
+bool sessionNeedsHello(const SmartMiFanSession &session);
+uint32_t broadcastHandshake(uint32_t fanMask, unsigned long windowMs);
+bool keepAliveInFlight();
+bool updateKeepAlive(unsigned long now);
+bool handleKeepAliveHello(uint8_t fanIndex, const uint8_t hello[32]);
+
+// Command coalescing (orchestrated *All)
+bool flushCoalescedCommands(unsigned long now);
 
 // Discovery/Query async helpers
-QueryInfoResult attemptMiioInfoAsync(DiscoveryContext& ctx);
 QueryInfoResult attemptMiioInfoAsync(QueryContext& ctx);
 
 }  // namespace SmartMiFanInternal
@@ -0,0 +1,142 @@
+// =============================================================================
+// SmartMiFanAsync - Keep-Alive Module
+// =============================================================================
+// Contains: Background session refresh. SmartMiFanAsync_update() sends a hello
+//           to an idle fan shortly before its session reaches the TTL, so the
+//           next command goes out without a handshake round trip. Refreshes
+//           are staggered over the lead window and spaced apart; a fan with
+//           recent traffic has a renewed session and is simply not due yet.
+// =============================================================================
+
+#include "SmartMiFanInternal.h"
+
+using namespace SmartMiFanInternal;
+
+namespace {
+
+bool keepAlivePaused() {
+  return !g_useKeepAlive || g_systemState == SystemState::SLEEP;
+}
+
+// Session age at which fan slot i is refreshed. Slots are spread over the first
+// half of the lead window so a table restored at once does not refresh at once.
+unsigned long keepAliveDueAge(size_t fanIndex) {
+  return SMART_MI_FAN_HANDSHAKE_TTL_MS - SMART_MI_FAN_KEEPALIVE_LEAD_MS +
+         (fanIndex * (SMART_MI_FAN_KEEPALIVE_LEAD_MS / 2)) / kMaxSmartMiFans;
+}
+
+void resetKeepAliveSlots() {
+  for (size_t i = 0; i < kMaxSmartMiFans; ++i) {
+    g_keepAliveSlots[i].reset();
+  }
+}
+
+}  // namespace
+
+namespace SmartMiFanInternal {
+
+bool keepAliveInFlight() {
+  for (size_t i = 0; i < g_discoveredFanCount; ++i) {
+    if (g_keepAliveSlots[i].pending) return true;
+  }
+  return false;
+}
+
+// Hello reply from a fan with no command waiting for one.
+// Returns true if it answered a keep-alive hello.
+bool handleKeepAliveHello(uint8_t fanIndex, const uint8_t hello[32]) {
+  KeepAliveSlot &slot = g_keepAliveSlots[fanIndex];
+  if (!slot.pending) return false;
+  applyHelloReply(g_discoveredFans[fanIndex].session, hello);
+  if (slot.sends == 1) g_rttEstimators[fanIndex].addSample(millis() - slot.sentAt);
+  slot.reset();
+  return true;
+}
+
+// One keep-alive pass (called from SmartMiFanAsync_update()).
+// Returns true while a keep-alive hello is in flight.
+bool updateKeepAlive(unsigned long now) {
+  if (keepAlivePaused()) {
+    if (keepAliveInFlight()) resetKeepAliveSlots();  // Late replies are dropped as unmatched
+    return false;
+  }
+  // Discovery and device queries read the same socket
+  if (SmartMiFanAsync_isDiscoveryInProgress() || SmartMiFanAsync_isQueryInProgress()) return false;
+
+  bool inFlight = false;
+  bool mayStart = (now - g_keepAliveLastSend) >= kKeepAliveSpacingMs;
+
+  for (size_t i = 0; i < g_discoveredFanCount; ++i) {
+    KeepAliveSlot &slot = g_keepAliveSlots[i];
+    SmartMiFanDiscoveredDevice &fan = g_discoveredFans[i];
+
+    if (slot.pending) {
+      if (!fan.session.valid || fan.session.handshakeMillis != slot.sessionStamp) {
+        slot.reset();  // A command renewed (or dropped) the session meanwhile
+      } else {
+        RttEstimator &rtt = g_rttEstimators[i];
+        bool rtoExpired = now - slot.lastSend >= retransmitWaitMs(&rtt, slot.sends);
+        if (now - slot.sentAt >= kHandshakeTimeoutMs || (rtoExpired && slot.sends > SMART_MI_FAN_MAX_RETRANSMITS)) {
+          // Leave the session to expire; the next command does its own hello
+          slot.pending = false;
+          slot.failed = true;
+          FAN_LOGNET_F("Keep-alive hello unanswered: fanIndex=%u", (unsigned)i);
+          continue;
+        }
+        if (rtoExpired) {
+          sendMiioHello(g_udpContext, fan.ip);
+          slot.lastSend = now;
+          slot.sends++;
+          rtt.retransmits++;
+        }
+        inFlight = true;
+      }
+      continue;
+    }
+
+    if (!mayStart || !fan.session.valid) continue;
+    if (slot.failed && fan.session.handshakeMillis == slot.sessionStamp) continue;
+    const CommandContext &ctx = g_commandContexts[i];
+    if (ctx.state == CommandState::WAITING_HELLO || ctx.state == CommandState::WAITING_ACK) continue;
+    if (SmartMiFanAsync_getFanParticipationState(static_cast<uint8_t>(i)) == FanParticipationState::INACTIVE) continue;
+
+    unsigned long age = now - fan.session.handshakeMillis;
+    if (age < keepAliveDueAge(i) || age >= SMART_MI_FAN_HANDSHAKE_TTL_MS) continue;
+
+    sendMiioHello(g_udpContext, fan.ip);
+    slot.pending = true;
+    slot.failed = false;
+    slot.sessionStamp = fan.session.handshakeMillis;
+    slot.sentAt = now;
+    slot.lastSend = now;
+    slot.sends = 1;
+    g_keepAliveLastSend = now;
+    mayStart = false;  // One new hello per spacing interval
+    inFlight = true;
+  }
+
+  return inFlight;
+}
+
+}  // namespace SmartMiFanInternal
+
+// =========================
+// Session Keep-Alive API
+// =========================
+
+void SmartMiFanAsync_setKeepAliveEnabled(bool enabled) {
+  g_useKeepAlive = enabled;
+  if (!enabled) resetKeepAliveSlots();
+}
+
+bool SmartMiFanAsync_isKeepAliveEnabled() {
+  return g_useKeepAlive;
+}
+
+void SmartMiFanAsync_setSystemState(SystemState state) {
+  g_systemState = state;
+}
+
+SystemState SmartMiFanAsync_getSystemState() {
+  return g_systemState;
+}
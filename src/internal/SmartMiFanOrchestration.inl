@@ -11,11 +11,256 @@ using namespace SmartMiFanInternal;
 // =========================
 // Command Coalescing State
 // =========================
+// Orchestrated writes within kCommandCooldownMs of the previous send are not
+// dropped: each lands in the fan's CoalesceSlot (newer values overwrite older
+// ones, per property) and is sent once the cooldown ends - by the next
+// orchestrated call or by SmartMiFanAsync_update() (trailing edge).
 namespace {
   unsigned long g_lastCommandTime = 0;
   constexpr unsigned long kCommandCooldownMs = 100;  // Minimum time between orchestrated commands
+
+  bool isCoolingDown(unsigned long now) {
+    return g_lastCommandTime > 0 && (now - g_lastCommandTime) < kCommandCooldownMs;
+  }
+
+  bool hasPendingSlot(const CoalesceSlot &slot) {
+    return slot.hasPower || slot.hasSpeed;
+  }
+
+  // Record the latest value for every ACTIVE fan
+  void coalesceWrite(bool setPower, bool on, bool setSpeed, uint8_t percent) {
+    for (size_t i = 0; i < g_discoveredFanCount; ++i) {
+      if (SmartMiFanAsync_getFanParticipationState(static_cast<uint8_t>(i)) != FanParticipationState::ACTIVE) continue;
+      CoalesceSlot &slot = g_coalesceSlots[i];
+      if (setPower) {
+        slot.hasPower = true;
+        slot.power = on;
+      }
+      if (setSpeed) {
+        slot.hasSpeed = true;
+        slot.percent = percent;
+      }
+    }
+  }
+
+  // Take a fan's pending slot as one property list (power + speed in one request)
+  size_t takeSlot(size_t fanIndex, FanPropertyWrite props[2]) {
+    CoalesceSlot &slot = g_coalesceSlots[fanIndex];
+    SmartMiFanDiscoveredDevice &fan = g_discoveredFans[fanIndex];
+    cacheFanCrypto(fan);
+
+    size_t count = 0;
+    if (slot.hasPower) props[count++] = powerPropertyWrite(slot.power);
+    if (slot.hasSpeed) props[count++] = speedPropertyWrite(fan.modelType, slot.percent);
+    slot.reset();
+    return count;
+  }
+
+  // Send every pending slot. Blocking: wait for the ACKs (fan-out) or send one
+  // fan after another; returns true if any fan acknowledged. Non-blocking:
+  // start the fan-out only; returns true if anything was sent.
+  bool flushSlots(bool blocking) {
+    if (g_useFanOut || !blocking) {
+      if (!beginFanOut(SMART_MI_FAN_FANOUT_DEADLINE_MS)) return false;
+      for (size_t i = 0; i < g_discoveredFanCount; ++i) {
+        if (!hasPendingSlot(g_coalesceSlots[i])) continue;
+        if (SmartMiFanAsync_getFanParticipationState(static_cast<uint8_t>(i)) != FanParticipationState::ACTIVE) {
+          g_coalesceSlots[i].reset();
+          continue;
+        }
+        FanPropertyWrite props[2];
+        size_t count = takeSlot(i, props);
+        addFanOutMember(static_cast<uint8_t>(i), props, count);
+      }
+      if (!commitFanOut()) return false;
+      return blocking ? waitForFanOut() : true;
+    }
+
+    bool anySuccess = false;
+    for (size_t i = 0; i < g_discoveredFanCount; ++i) {
+      if (!hasPendingSlot(g_coalesceSlots[i])) continue;
+      SmartMiFanDiscoveredDevice &fan = g_discoveredFans[i];
+
+      // Only send to ACTIVE fans
+      FanParticipationState participation = SmartMiFanAsync_getFanParticipationState(static_cast<uint8_t>(i));
+      if (participation != FanParticipationState::ACTIVE) {
+        g_coalesceSlots[i].reset();
+        continue;
+      }
+
+      FanPropertyWrite props[2];
+      size_t count = takeSlot(i, props);
+
+      if (!prepareFanContext(fan)) {
+        fan.lastError = MiioErr::TIMEOUT;
+        // DBG_FAN_TIMEOUT: log prepare context failure before orchestrated set
+        FAN_LOGW_F("[DBG_FAN_TIMEOUT] prepareFanContext failed (orchestrated set): fanIndex=%u ip=%d.%d.%d.%d t=%lums",
+                   (unsigned)i, fan.ip[0], fan.ip[1], fan.ip[2], fan.ip[3], (unsigned long)millis());
+        continue;
+      }
+
+      if (SmartMiFanAsync.setProperties(props, count)) {
+        fan.ready = true;
+        fan.lastError = MiioErr::OK;
+        anySuccess = true;
+      } else {
+        fan.ready = false;
+        // lastError is set by setProperties
+      }
+    }
+    releaseFanContext();
+    return anySuccess;
+  }
+
+  bool orchestratedSet(bool setPower, bool on, bool setSpeed, uint8_t percent) {
+    if (!g_udpContext) return false;
+
+    // Latest value wins; an older pending value for the other property rides along
+    coalesceWrite(setPower, on, setSpeed, percent);
+
+    unsigned long now = millis();
+    if (isCoolingDown(now)) {
+      return true;  // Coalesced: sent when the cooldown ends
+    }
+    g_lastCommandTime = now;
+
+    return flushSlots(true);
+  }
 }
 
+namespace SmartMiFanInternal {
+
+// Trailing edge of the coalescing window (called from SmartMiFanAsync_update()).
+// Returns true while coalesced writes are waiting or were just sent.
+bool flushCoalescedCommands(unsigned long now) {
+  bool pending = false;
+  for (size_t i = 0; i < g_discoveredFanCount; ++i) {
+    if (hasPendingSlot(g_coalesceSlots[i])) {
+      pending = true;
+      break;
+    }
+  }
+  if (!pending) return false;
+  // Wait for the cooldown and for a running fan-out (a new one would replace it)
+  if (isCoolingDown(now) || g_fanOutContext.active) return true;
+
+  g_lastCommandTime = now;
+  flushSlots(false);
+  return true;
+}
+
+bool sessionNeedsHello(const SmartMiFanSession &session) {
+  return !session.valid || (millis() - session.handshakeMillis) >= SMART_MI_FAN_HANDSHAKE_TTL_MS;
+}
+
+// A fan's deviceId answered the broadcast from another address. Hello replies
+// are not authenticated, so the move is only taken once the new address answers
+// an encrypted miIO.info with the fan's token and DID.
+bool confirmFanMove(SmartMiFanDiscoveredDevice &fan, const IPAddress &newIp) {
+  if (!fan.cryptoCached) cacheFanCrypto(fan);
+  // Client's own session: the fan's session stays with the old address until confirmed
+  SmartMiFanAsync.attachUdp(*g_udpContext);
+  SmartMiFanAsync.setTokenCached(fan.tokenBytes, fan.cachedKey, fan.cachedIv);
+  SmartMiFanAsync.setFanAddress(newIp);
+  SmartMiFanAsync.setModelType(fan.modelType);
+
+  uint32_t did = 0;
+  if (!SmartMiFanAsync.handshake() ||
+      !SmartMiFanAsync.queryInfo(nullptr, 0, nullptr, 0, nullptr, 0, &did) || did != fan.did) {
+    FAN_LOGW_F("Fan %d.%d.%d.%d: DID %lu seen at %d.%d.%d.%d not confirmed", fan.ip[0], fan.ip[1], fan.ip[2],
+               fan.ip[3], (unsigned long)fan.did, newIp[0], newIp[1], newIp[2], newIp[3]);
+    return false;
+  }
+
+  FAN_LOGI_F("Fan moved: %d.%d.%d.%d -> %d.%d.%d.%d", fan.ip[0], fan.ip[1], fan.ip[2], fan.ip[3],
+             newIp[0], newIp[1], newIp[2], newIp[3]);
+  fan.ip = newIp;
+  fan.session = SmartMiFanAsync.getSession();
+  return true;
+}
+
+// Hello to every fan in fanMask with a single broadcast. Replies are matched by
+// source IP (and DID, where known). A known DID answering from an unknown IP is
+// only a hint that the fan moved; it is confirmed by confirmFanMove() after the
+// window. Waits until every fan answered or windowMs passed and returns the fans
+// that answered; the rest need a unicast hello.
+uint32_t broadcastHandshake(uint32_t fanMask, unsigned long windowMs) {
+  if (!g_udpContext || fanMask == 0) return 0;
+  // Discovery and device queries read the same socket
+  if (SmartMiFanAsync_isDiscoveryInProgress() || SmartMiFanAsync_isQueryInProgress()) return 0;
+
+  sendMiioHello(g_udpContext, IPAddress(255, 255, 255, 255));
+  uint32_t remaining = fanMask;
+  uint32_t moved = 0;
+  IPAddress movedTo[kMaxSmartMiFans];
+  unsigned long start = millis();
+
+  while ((remaining & ~moved) != 0 && millis() - start < windowMs) {
+    int len = g_udpContext->parsePacket();
+    if (len <= 0) {
+      yield();
+      continue;
+    }
+    IPAddress sender = g_udpContext->remoteIP();
+    int fanIndex = findFanIndexByIp(sender);
+    if (fanIndex >= 0 && (len != 32 || (remaining & (1UL << fanIndex)) == 0)) {
+      routeForeignReply(g_udpContext, len);  // Async ACK or keep-alive reply, not this hello
+      continue;
+    }
+    g_rxStats.received++;
+    if (len != 32) {
+      discardUdpPacket(g_udpContext);  // Late reply to an earlier request
+      g_rxStats.unmatched++;
+      continue;
+    }
+    uint8_t buf[32];
+    g_udpContext->read(buf, 32);
+    uint32_t did = (uint32_t(buf[8]) << 24) | (uint32_t(buf[9]) << 16) | (uint32_t(buf[10]) << 8) | uint32_t(buf[11]);
+
+    if (fanIndex < 0) {
+      // Unknown address: a known DID here is a move hint, anything else another miIO device
+      for (size_t i = 0; i < g_discoveredFanCount; ++i) {
+        if (g_discoveredFans[i].did != 0 && g_discoveredFans[i].did == did && (remaining & (1UL << i)) != 0) {
+          movedTo[i] = sender;
+          moved |= 1UL << i;
+          break;
+        }
+      }
+      g_rxStats.unknownSource++;
+      continue;
+    }
+
+    SmartMiFanDiscoveredDevice &fan = g_discoveredFans[fanIndex];
+    // Another device took over the fan's address, or the fan already answered
+    if ((fan.did != 0 && fan.did != did) || (remaining & (1UL << fanIndex)) == 0) {
+      g_rxStats.unmatched++;
+      continue;
+    }
+
+    applyHelloReply(fan.session, buf);
+    fan.ready = true;
+    fan.lastError = MiioErr::OK;
+    g_rxStats.matched++;
+    remaining &= ~(1UL << fanIndex);
+    moved &= ~(1UL << fanIndex);
+  }
+
+  for (size_t i = 0; i < g_discoveredFanCount; ++i) {
+    if ((moved & (1UL << i)) == 0) continue;
+    SmartMiFanDiscoveredDevice &fan = g_discoveredFans[i];
+    if (findFanIndexByIp(movedTo[i]) >= 0) continue;  // Address taken by another fan meanwhile
+    if (!confirmFanMove(fan, movedTo[i])) continue;
+    fan.ready = true;
+    fan.lastError = MiioErr::OK;
+    remaining &= ~(1UL << i);
+  }
+  releaseFanContext();
+
+  return fanMask & ~remaining;
+}
+
+}  // namespace SmartMiFanInternal
+
 // =========================
 // Error and Health API
 // =========================
@@ -38,12 +283,14 @@ bool SmartMiFanAsync_healthCheck(uint8_t fanIndex, uint32_t timeoutMs) {
   if (fanIndex >= g_discoveredFanCount) return false;
   if (!g_udpContext) return false;
   
-  const SmartMiFanDiscoveredDevice &fan = g_discoveredFans[fanIndex];
+  SmartMiFanDiscoveredDevice &fan = g_discoveredFans[fanIndex];
   
   if (!prepareFanContext(fan)) return false;
   
-  // Try handshake as health check
+  // Try handshake as health check (always on the wire, never from session cache)
+  SmartMiFanAsync.invalidateHandshake();
   bool success = SmartMiFanAsync.handshake(timeoutMs);
+  releaseFanContext();
   
   if (success) {
     g_discoveredFans[fanIndex].ready = true;
@@ -78,30 +325,36 @@ void SmartMiFanAsync_prepareForSleep(bool closeUdp, bool invalidateHandshake) {
     g_discoveredFans[i].ready = false;
   }
   
-  // Close UDP if requested
+  // Close UDP if requested (in-flight async commands cannot complete)
   if (closeUdp && g_udpContext) {
-    g_udpContext->stop();
+    stopUdp(g_udpContext);
+    SmartMiFanAsync_cancelAllCommands();
   }
   
   // Invalidate handshake cache if requested
   if (invalidateHandshake) {
     SmartMiFanAsync.invalidateHandshake();
+    invalidateFanSessions();
   }
   
-  // Reset coalescing timer
+  // Reset coalescing timer (pending values are dropped with the socket)
   g_lastCommandTime = 0;
+  if (closeUdp) {
+    for (size_t i = 0; i < kMaxSmartMiFans; ++i) {
+      g_coalesceSlots[i].reset();
+    }
+  }
 }
 
 void SmartMiFanAsync_softWakeUp() {
   // Re-initialize UDP if context exists
-  if (g_udpContext) {
-    g_udpContext->begin(0);
-  }
+  openUdp(g_udpContext);
   
-  // Mark fans as needing re-handshake
+  // Key/IV do not change over sleep. Sessions kept by prepareForSleep(..., false)
+  // are used as resumed: no hello, but a lost request falls back to one.
   for (size_t i = 0; i < g_discoveredFanCount; ++i) {
     g_discoveredFans[i].ready = false;
-    g_discoveredFans[i].cryptoCached = false;
+    if (g_discoveredFans[i].session.valid) g_discoveredFans[i].session.resumed = true;
   }
 }
 
@@ -148,6 +401,14 @@ bool SmartMiFanAsync_handshakeAllOrchestrated() {
   if (!g_udpContext) return false;
   
   bool anySuccess = false;
+  uint32_t helloMask = 0;
+  for (size_t i = 0; i < g_discoveredFanCount; ++i) {
+    const SmartMiFanDiscoveredDevice &fan = g_discoveredFans[i];
+    if (!fan.userEnabled || (fan.lastError != MiioErr::OK && !fan.ready)) continue;
+    if (sessionNeedsHello(fan.session)) helloMask |= 1UL << i;
+  }
+  // One broadcast for all; fans that stay silent get a unicast hello below
+  broadcastHandshake(helloMask, kBroadcastHelloWindowMs);
   
   for (size_t i = 0; i < g_discoveredFanCount; ++i) {
     SmartMiFanDiscoveredDevice &fan = g_discoveredFans[i];
@@ -169,88 +430,45 @@ bool SmartMiFanAsync_handshakeAllOrchestrated() {
       fan.lastError = MiioErr::TIMEOUT;
     }
   }
+  releaseFanContext();
   
   return anySuccess;
 }
 
-bool SmartMiFanAsync_setPowerAllOrchestrated(bool on) {
+bool SmartMiFanAsync_refreshSessionsAll() {
   if (!g_udpContext) return false;
-  
-  // Command coalescing - skip if called too frequently
-  unsigned long now = millis();
-  if (g_lastCommandTime > 0 && (now - g_lastCommandTime) < kCommandCooldownMs) {
-    return true;  // Silently succeed (command coalesced)
+
+  uint32_t mask = 0;
+  for (size_t i = 0; i < g_discoveredFanCount; ++i) {
+    if (g_discoveredFans[i].userEnabled) mask |= 1UL << i;
   }
-  g_lastCommandTime = now;
-  
-  bool anySuccess = false;
-  
+  uint32_t answered = broadcastHandshake(mask, kBroadcastHelloWindowMs);
+
+  bool overall = true;
   for (size_t i = 0; i < g_discoveredFanCount; ++i) {
+    if ((mask & ~answered & (1UL << i)) == 0) continue;
     SmartMiFanDiscoveredDevice &fan = g_discoveredFans[i];
-    
-    // Only send to ACTIVE fans
-    FanParticipationState participation = SmartMiFanAsync_getFanParticipationState(static_cast<uint8_t>(i));
-    if (participation != FanParticipationState::ACTIVE) continue;
-    
     if (!prepareFanContext(fan)) {
-      fan.lastError = MiioErr::TIMEOUT;
-      // DBG_FAN_TIMEOUT: log prepare context failure before setPower
-      FAN_LOGW_F("[DBG_FAN_TIMEOUT] prepareFanContext failed (setPower): fanIndex=%u ip=%d.%d.%d.%d t=%lums",
-                 (unsigned)i, fan.ip[0], fan.ip[1], fan.ip[2], fan.ip[3], (unsigned long)millis());
+      overall = false;
       continue;
     }
-    
-    if (SmartMiFanAsync.setPower(on)) {
-      fan.ready = true;
-      fan.lastError = MiioErr::OK;
-      anySuccess = true;
-    } else {
-      fan.ready = false;
-      // lastError is set by miotSetPropertyBool
-    }
+    fan.session.valid = false;  // Force a fresh hello
+    if (!SmartMiFanAsync.handshake()) overall = false;
   }
-  
-  return anySuccess;
+  releaseFanContext();
+  return overall;
+}
+
+bool SmartMiFanAsync_setPowerAllOrchestrated(bool on) {
+  return orchestratedSet(true, on, false, 0);
 }
 
 bool SmartMiFanAsync_setSpeedAllOrchestrated(uint8_t percent) {
-  if (!g_udpContext) return false;
-  
-  // Command coalescing - skip if called too frequently
-  unsigned long now = millis();
-  if (g_lastCommandTime > 0 && (now - g_lastCommandTime) < kCommandCooldownMs) {
-    return true;  // Silently succeed (command coalesced)
-  }
-  g_lastCommandTime = now;
-  
-  bool anySuccess = false;
-  
-  for (size_t i = 0; i < g_discoveredFanCount; ++i) {
-    SmartMiFanDiscoveredDevice &fan = g_discoveredFans[i];
-    
-    // Only send to ACTIVE fans
-    FanParticipationState participation = SmartMiFanAsync_getFanParticipationState(static_cast<uint8_t>(i));
-    if (participation != FanParticipationState::ACTIVE) continue;
-    
-    if (!prepareFanContext(fan)) {
-      fan.lastError = MiioErr::TIMEOUT;
-      // DBG_FAN_TIMEOUT: log prepare context failure before setSpeed
-      FAN_LOGW_F("[DBG_FAN_TIMEOUT] prepareFanContext failed (setSpeed): fanIndex=%u ip=%d.%d.%d.%d t=%lums",
-                 (unsigned)i, fan.ip[0], fan.ip[1], fan.ip[2], fan.ip[3], (unsigned long)millis());
-      continue;
-    }
-    
-    if (SmartMiFanAsync.setSpeed(percent)) {
-      fan.ready = true;
-      fan.lastError = MiioErr::OK;
-      anySuccess = true;
-    } else {
-      fan.ready = false;
-      // lastError is set by miotSetPropertyUint
-    }
-  }
-  
-  return anySuccess;
+  return orchestratedSet(false, false, true, percent);
+}
+
+bool SmartMiFanAsync_setStateAllOrchestrated(bool on, uint8_t percent) {
+  return orchestratedSet(true, on, true, percent);
 }
 
 // =========================
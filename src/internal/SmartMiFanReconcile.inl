@@ -0,0 +1,182 @@
+// =============================================================================
+// SmartMiFanAsync - Reconcile Module
+// =============================================================================
+// Contains: Desired-state control. The application sets what each fan should
+//           be; SmartMiFanAsync_update() sends only the property writes that
+//           differ from the last acknowledged / read-back state and retries
+//           failed fans with backoff until they converge.
+// =============================================================================
+
+#include "SmartMiFanInternal.h"
+
+using namespace SmartMiFanInternal;
+
+namespace {
+
+bool hasDesiredState(const DesiredState &desired) {
+  return desired.hasPower || desired.hasSpeed;
+}
+
+// Property writes still needed to reach the desired state.
+// Speed is compared after model quantization (dmaker.fan.1c: 40% and 50% are
+// both fan_level 2, so moving between them needs no packet).
+size_t collectDeltas(uint8_t fanIndex, FanPropertyWrite out[2]) {
+  const DesiredState &desired = g_desiredStates[fanIndex];
+  SmartMiFanDiscoveredDevice &fan = g_discoveredFans[fanIndex];
+  cacheFanCrypto(fan);
+
+  size_t count = 0;
+  if (desired.hasPower) {
+    FanPropertyWrite prop = powerPropertyWrite(desired.power);
+    const FanPropertyValue *cached = findCachedProperty(fanIndex, prop.siid, prop.piid);
+    if (!cached || cached->value != prop.value) out[count++] = prop;
+  }
+  if (desired.hasSpeed) {
+    FanPropertyWrite prop = speedPropertyWrite(fan.modelType, desired.percent);
+    const FanPropertyValue *cached = findCachedProperty(fanIndex, prop.siid, prop.piid);
+    if (!cached || cached->value != prop.value) out[count++] = prop;
+  }
+  return count;
+}
+
+// A changed target is worth an immediate attempt, even for a fan in backoff
+void desiredChanged(DesiredState &desired) {
+  desired.failures = 0;
+  desired.nextAttempt = 0;
+}
+
+void setDesired(uint8_t fanIndex, bool setPower, bool on, bool setSpeed, uint8_t percent) {
+  if (fanIndex >= g_discoveredFanCount) return;
+  DesiredState &desired = g_desiredStates[fanIndex];
+
+  if (percent < 1) percent = 1;
+  if (percent > 100) percent = 100;
+
+  if (setPower && (!desired.hasPower || desired.power != on)) {
+    desired.hasPower = true;
+    desired.power = on;
+    desiredChanged(desired);
+  }
+  if (setSpeed && (!desired.hasSpeed || desired.percent != percent)) {
+    desired.hasSpeed = true;
+    desired.percent = percent;
+    desiredChanged(desired);
+  }
+}
+
+}  // namespace
+
+namespace SmartMiFanInternal {
+
+// One reconcile pass (called from SmartMiFanAsync_update()).
+// Returns true if a command was started.
+bool reconcileDesiredStates(unsigned long now) {
+  bool started = false;
+
+  for (size_t i = 0; i < g_discoveredFanCount; ++i) {
+    uint8_t fanIndex = static_cast<uint8_t>(i);
+    DesiredState &desired = g_desiredStates[i];
+    if (!hasDesiredState(desired)) continue;
+
+    const CommandContext &ctx = g_commandContexts[i];
+    bool pending = ctx.state == CommandState::WAITING_HELLO || ctx.state == CommandState::WAITING_ACK;
+
+    if (desired.inFlight && !ctx.byReconciler) {
+      // Replaced by an explicit or coalesced command: its result is not ours
+      desired.inFlight = false;
+    }
+    if (desired.inFlight) {
+      if (pending) continue;
+      desired.inFlight = false;
+      if (ctx.state == CommandState::COMPLETE) {
+        desired.failures = 0;
+      } else if (ctx.state == CommandState::ERROR || ctx.state == CommandState::TIMEOUT) {
+        if (desired.failures < 16) desired.failures++;
+        unsigned long backoff = kReconcileRetryMinMs << (desired.failures - 1);
+        if (backoff > kReconcileRetryMaxMs) backoff = kReconcileRetryMaxMs;
+        desired.nextAttempt = now + backoff;
+        FAN_LOGNET_F("Reconcile failed: fanIndex=%u failures=%u retry in %lums",
+                     (unsigned)i, (unsigned)desired.failures, backoff);
+      }
+      // IDLE: cancelled or superseded - re-evaluate right away
+    }
+
+    // Leave fans alone while an explicit command is in flight
+    if (pending) continue;
+    // Failed fans (ERROR) keep being retried; only user-disabled fans are skipped
+    if (SmartMiFanAsync_getFanParticipationState(fanIndex) == FanParticipationState::INACTIVE) continue;
+    if (desired.failures > 0 && static_cast<long>(now - desired.nextAttempt) < 0) continue;
+
+    FanPropertyWrite deltas[2];
+    size_t count = collectDeltas(fanIndex, deltas);
+    if (count == 0) continue;
+
+    if (SmartMiFanAsync_startSetFanProperties(fanIndex, deltas, count)) {
+      g_commandContexts[i].byReconciler = true;
+      desired.inFlight = true;
+      started = true;
+    }
+  }
+
+  return started;
+}
+
+}  // namespace SmartMiFanInternal
+
+// =========================
+// Desired State API
+// =========================
+
+void SmartMiFanAsync_setDesiredPower(uint8_t fanIndex, bool on) {
+  setDesired(fanIndex, true, on, false, 0);
+}
+
+void SmartMiFanAsync_setDesiredSpeed(uint8_t fanIndex, uint8_t percent) {
+  setDesired(fanIndex, false, false, true, percent);
+}
+
+void SmartMiFanAsync_setDesiredState(uint8_t fanIndex, bool on, uint8_t percent) {
+  setDesired(fanIndex, true, on, true, percent);
+}
+
+void SmartMiFanAsync_setDesiredPowerAll(bool on) {
+  for (size_t i = 0; i < g_discoveredFanCount; ++i) {
+    setDesired(static_cast<uint8_t>(i), true, on, false, 0);
+  }
+}
+
+void SmartMiFanAsync_setDesiredSpeedAll(uint8_t percent) {
+  for (size_t i = 0; i < g_discoveredFanCount; ++i) {
+    setDesired(static_cast<uint8_t>(i), false, false, true, percent);
+  }
+}
+
+void SmartMiFanAsync_setDesiredStateAll(bool on, uint8_t percent) {
+  for (size_t i = 0; i < g_discoveredFanCount; ++i) {
+    setDesired(static_cast<uint8_t>(i), true, on, true, percent);
+  }
+}
+
+void SmartMiFanAsync_clearDesiredState(uint8_t fanIndex) {
+  if (fanIndex >= kMaxSmartMiFans) return;
+  g_desiredStates[fanIndex].reset();
+}
+
+bool SmartMiFanAsync_isFanConverged(uint8_t fanIndex) {
+  if (fanIndex >= g_discoveredFanCount) return false;
+  const DesiredState &desired = g_desiredStates[fanIndex];
+  if (!hasDesiredState(desired)) return true;
+  if (desired.inFlight) return false;
+
+  FanPropertyWrite deltas[2];
+  return collectDeltas(fanIndex, deltas) == 0;
+}
+
+bool SmartMiFanAsync_isConverged() {
+  for (size_t i = 0; i < g_discoveredFanCount; ++i) {
+    // User-disabled fans are not reconciled, so they cannot hold up convergence
+    if (SmartMiFanAsync_getFanParticipationState(static_cast<uint8_t>(i)) == FanParticipationState::INACTIVE) continue;
+    if (!SmartMiFanAsync_isFanConverged(static_cast<uint8_t>(i))) return false;
+  }
+  return true;
+}
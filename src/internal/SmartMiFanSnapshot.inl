@@ -0,0 +1,402 @@
+// =============================================================================
+// SmartMiFanAsync - Snapshot Module
+// =============================================================================
+// Contains: Warm-boot snapshot of the discovered fan table. Serializes IP, DID,
+//           model, fw/hw, token and the cached key/IV/model type into a
+//           compact versioned binary blob, and restores it without Smart
+//           Connect, queryInfo or MD5. The warm-boot snapshot stores no
+//           sessions: the first command to a restored fan does a fresh hello,
+//           which doubles as validation (a moved or re-tokened fan fails like
+//           any other). The deep-sleep snapshot adds each fan's session and
+//           its age, so a resumed fan is commanded without a hello.
+//           The discovery knowledge cache is kept in its own blob, so it
+//           survives a reboot next to (or without) the fan table.
+// =============================================================================
+//
+// Format v1 (little-endian):
+//   u32 magic "SMFS", u8 version, u8 fanCount, u8 flags (bit0 = sessions), u8 reserved
+//   fanCount records:
+//     u8 ip[4], u32 did, u8 modelType, u8 flags (bit0 = userEnabled),
+//     u8 token[16], u8 key[16], u8 iv[16],
+//     model, fw_ver, hw_ver as u8 length + chars (no terminator)
+//     with sessions: u8 valid, u8 deviceId[4], u32 deviceTimestamp, u32 ageMs
+//   u32 FNV-1a over everything before it
+//
+// Knowledge cache format v1 (little-endian):
+//   u32 magic "SMFK", u8 version, u8 reserved, u16 entryCount
+//   entryCount records:
+//     u32 deviceId, u8 kind, u16 runs since last seen,
+//     FAN: u8 modelType, u8 token[16]; NO_TOKEN: u32 tokenSetHash, u8 skips
+//   u32 FNV-1a over everything before it
+
+#include "SmartMiFanInternal.h"
+
+using namespace SmartMiFanInternal;
+
+namespace {
+
+constexpr uint8_t kSnapshotFlagEnabled = 0x01;   // Record flags
+constexpr uint8_t kSnapshotFlagSessions = 0x01;  // Header flags
+
+// Staging buffer for saveFans()/restoreFans() and the knowledge cache: static,
+// not ~2 KB on the caller's (loop task) stack
+uint8_t g_snapshotBuffer[kSnapshotMaxLen > kKnowledgeMaxLen ? kSnapshotMaxLen : kKnowledgeMaxLen];
+
+uint32_t snapshotChecksum(const uint8_t *data, size_t len) {
+  uint32_t hash = 2166136261u;
+  for (size_t i = 0; i < len; ++i) {
+    hash ^= data[i];
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+void putU16(uint8_t *p, uint16_t v) {
+  p[0] = static_cast<uint8_t>(v);
+  p[1] = static_cast<uint8_t>(v >> 8);
+}
+
+void putU32(uint8_t *p, uint32_t v) {
+  putU16(p, static_cast<uint16_t>(v));
+  putU16(p + 2, static_cast<uint16_t>(v >> 16));
+}
+
+uint16_t getU16(const uint8_t *p) {
+  return static_cast<uint16_t>(p[0] | (p[1] << 8));
+}
+
+uint32_t getU32(const uint8_t *p) {
+  return getU16(p) | (static_cast<uint32_t>(getU16(p + 2)) << 16);
+}
+
+size_t putString(uint8_t *p, const char *s, size_t fieldSize) {
+  size_t len = strnlen(s, fieldSize - 1);
+  p[0] = static_cast<uint8_t>(len);
+  memcpy(p + 1, s, len);
+  return 1 + len;
+}
+
+// Bounds-checked reader; every get fails once the record runs past the end
+struct SnapshotReader {
+  const uint8_t *pos;
+  const uint8_t *end;
+
+  bool take(size_t n, const uint8_t *&out) {
+    if (static_cast<size_t>(end - pos) < n) return false;
+    out = pos;
+    pos += n;
+    return true;
+  }
+
+  bool getString(char *out, size_t fieldSize) {
+    const uint8_t *len = nullptr;
+    const uint8_t *chars = nullptr;
+    if (!take(1, len) || *len >= fieldSize || !take(*len, chars)) return false;
+    if (out) {
+      memcpy(out, chars, *len);
+      out[*len] = '\0';
+    }
+    return true;
+  }
+};
+
+size_t serializeFan(const SmartMiFanDiscoveredDevice &fan, bool withSession, uint8_t *out) {
+  uint8_t *p = out;
+  for (int i = 0; i < 4; ++i) *p++ = fan.ip[i];
+  putU32(p, fan.did);
+  p += 4;
+  *p++ = static_cast<uint8_t>(fan.modelType);
+  *p++ = fan.userEnabled ? kSnapshotFlagEnabled : 0;
+  memcpy(p, fan.tokenBytes, 16);
+  memcpy(p + 16, fan.cachedKey, 16);
+  memcpy(p + 32, fan.cachedIv, 16);
+  p += 48;
+  p += putString(p, fan.model, sizeof(fan.model));
+  p += putString(p, fan.fw_ver, sizeof(fan.fw_ver));
+  p += putString(p, fan.hw_ver, sizeof(fan.hw_ver));
+  if (withSession) {
+    const SmartMiFanSession &session = fan.session;
+    bool valid = session.valid && (millis() - session.handshakeMillis) < kSessionMaxAgeMs;
+    *p++ = valid ? 1 : 0;
+    memcpy(p, session.deviceId, 4);
+    putU32(p + 4, session.deviceTimestamp);
+    putU32(p + 8, valid ? static_cast<uint32_t>(millis() - session.handshakeMillis) : 0);
+    p += 12;
+  }
+  return static_cast<size_t>(p - out);
+}
+
+// Parses one record; with fan == nullptr only validates it. A stored session is
+// resumed if it is still within kSessionMaxAgeMs after sleptMs.
+bool deserializeFan(SnapshotReader &reader, bool withSession, uint32_t sleptMs,
+                    SmartMiFanDiscoveredDevice *fan) {
+  static const char kHex[] = "0123456789abcdef";
+  const uint8_t *fixed = nullptr;
+  if (!reader.take(4 + 4 + 1 + 1 + 48, fixed)) return false;
+  if (fan) {
+    *fan = SmartMiFanDiscoveredDevice{};
+    fan->ip = IPAddress(fixed[0], fixed[1], fixed[2], fixed[3]);
+    fan->did = getU32(fixed + 4);
+    fan->modelType = static_cast<FanModelType>(fixed[8]);
+    fan->userEnabled = (fixed[9] & kSnapshotFlagEnabled) != 0;
+    memcpy(fan->tokenBytes, fixed + 10, 16);
+    memcpy(fan->cachedKey, fixed + 26, 16);
+    memcpy(fan->cachedIv, fixed + 42, 16);
+    for (size_t i = 0; i < 16; ++i) {
+      fan->token[i * 2] = kHex[fan->tokenBytes[i] >> 4];
+      fan->token[i * 2 + 1] = kHex[fan->tokenBytes[i] & 0x0F];
+    }
+    fan->token[32] = '\0';
+    fan->lastError = MiioErr::OK;
+    fan->cryptoCached = true;
+  }
+  if (!reader.getString(fan ? fan->model : nullptr, sizeof(SmartMiFanDiscoveredDevice::model)) ||
+      !reader.getString(fan ? fan->fw_ver : nullptr, sizeof(SmartMiFanDiscoveredDevice::fw_ver)) ||
+      !reader.getString(fan ? fan->hw_ver : nullptr, sizeof(SmartMiFanDiscoveredDevice::hw_ver))) {
+    return false;
+  }
+  if (!withSession) return true;
+
+  const uint8_t *stored = nullptr;
+  if (!reader.take(13, stored)) return false;
+  uint32_t savedAge = getU32(stored + 9);
+  uint32_t age = savedAge + sleptMs;
+  if (fan && stored[0] == 1 && age >= savedAge && age < kSessionMaxAgeMs) {
+    SmartMiFanSession &session = fan->session;
+    uint32_t savedTs = getU32(stored + 5);
+    memcpy(session.deviceId, stored + 1, 4);
+    // The device clock (seconds) kept running while we slept
+    session.deviceTimestamp = savedTs + sleptMs / 1000;
+    session.anchorTimestamp = (savedTs > savedAge / 1000) ? savedTs - savedAge / 1000 : 0;
+    session.handshakeMillis = millis() - age;
+    session.valid = true;
+    session.resumed = true;
+  }
+  return true;
+}
+
+size_t serializeSnapshot(uint8_t *out, size_t cap, bool withSessions) {
+  // Fans whose token does not parse have no crypto to store and are left out
+  uint8_t record[kSnapshotRecordMaxLen];
+  size_t total = kSnapshotHeaderLen + 4;
+  size_t stored = 0;
+  for (size_t i = 0; i < g_discoveredFanCount; ++i) {
+    cacheFanCrypto(g_discoveredFans[i]);
+    if (!g_discoveredFans[i].cryptoCached) continue;
+    total += serializeFan(g_discoveredFans[i], withSessions, record);
+    stored++;
+  }
+  if (!out) return total;
+  if (cap < total) return 0;
+
+  putU32(out, kSnapshotMagic);
+  out[4] = kSnapshotVersion;
+  out[5] = static_cast<uint8_t>(stored);
+  out[6] = withSessions ? kSnapshotFlagSessions : 0;
+  out[7] = 0;
+  size_t pos = kSnapshotHeaderLen;
+  for (size_t i = 0; i < g_discoveredFanCount; ++i) {
+    if (!g_discoveredFans[i].cryptoCached) continue;
+    pos += serializeFan(g_discoveredFans[i], withSessions, out + pos);
+  }
+  putU32(out + pos, snapshotChecksum(out, pos));
+  return total;
+}
+
+bool deserializeSnapshot(const uint8_t *data, size_t len, uint32_t sleptMs) {
+  // Discovery and Smart Connect append to the table while running
+  if (SmartMiFanAsync_isDiscoveryInProgress() || SmartMiFanAsync_isSmartConnectInProgress()) return false;
+  if (!data || len < kSnapshotHeaderLen + 4) return false;
+  if (getU32(data) != kSnapshotMagic) return false;
+  if (data[4] != kSnapshotVersion) {
+    FAN_LOGW_F("Fan snapshot version %u not supported (expected %u)", (unsigned)data[4], (unsigned)kSnapshotVersion);
+    return false;
+  }
+  size_t fanCount = data[5];
+  bool withSessions = (data[6] & kSnapshotFlagSessions) != 0;
+  if (fanCount > kMaxSmartMiFans) return false;
+  if (getU32(data + len - 4) != snapshotChecksum(data, len - 4)) {
+    FAN_LOGW_F("Fan snapshot checksum mismatch, ignoring it");
+    return false;
+  }
+
+  // Validate every record before the current table is touched
+  SnapshotReader reader{data + kSnapshotHeaderLen, data + len - 4};
+  for (size_t i = 0; i < fanCount; ++i) {
+    if (!deserializeFan(reader, withSessions, sleptMs, nullptr)) return false;
+  }
+  if (reader.pos != reader.end) return false;
+
+  SmartMiFanAsync_resetDiscoveredFans();
+  reader.pos = data + kSnapshotHeaderLen;
+  for (size_t i = 0; i < fanCount; ++i) {
+    SmartMiFanDiscoveredDevice &fan = g_discoveredFans[g_discoveredFanCount];
+    deserializeFan(reader, withSessions, sleptMs, &fan);
+    if (fanAlreadyStored(fan.did, fan.ip)) continue;
+    aesScheduleFor(fan.cachedKey);  // Expand key schedules now, not on the first command
+    g_discoveredFanCount++;
+  }
+  FAN_LOGI_F("Restored %u fan(s) from snapshot", (unsigned)g_discoveredFanCount);
+  return true;
+}
+
+size_t serializeKnowledge(const DiscoveryKnowledge &entry, uint8_t *out) {
+  uint8_t *p = out;
+  putU32(p, entry.deviceId);
+  p[4] = static_cast<uint8_t>(entry.kind);
+  uint32_t runsSince = g_discoveryRun - entry.lastRun;
+  putU16(p + 5, runsSince > 0xFFFF ? 0xFFFF : static_cast<uint16_t>(runsSince));
+  p += 7;
+  if (entry.kind == DiscoveryKnowledgeKind::FAN) {
+    *p++ = static_cast<uint8_t>(entry.modelType);
+    memcpy(p, entry.token, 16);
+    p += 16;
+  } else if (entry.kind == DiscoveryKnowledgeKind::NO_TOKEN) {
+    putU32(p, entry.tokenSetHash);
+    p[4] = entry.skips;
+    p += 5;
+  }
+  return static_cast<size_t>(p - out);
+}
+
+// Parses one record; with entry == nullptr only validates it
+bool deserializeKnowledge(SnapshotReader &reader, DiscoveryKnowledge *entry) {
+  const uint8_t *fixed = nullptr;
+  if (!reader.take(7, fixed)) return false;
+  DiscoveryKnowledgeKind kind = static_cast<DiscoveryKnowledgeKind>(fixed[4]);
+  const uint8_t *extra = nullptr;
+  switch (kind) {
+    case DiscoveryKnowledgeKind::FAN:
+      if (!reader.take(17, extra)) return false;
+      break;
+    case DiscoveryKnowledgeKind::NO_TOKEN:
+      if (!reader.take(5, extra)) return false;
+      break;
+    case DiscoveryKnowledgeKind::NOT_A_FAN:
+      break;
+    default:
+      return false;
+  }
+  if (!entry) return true;
+
+  *entry = DiscoveryKnowledge{};
+  entry->deviceId = getU32(fixed);
+  entry->kind = kind;
+  entry->lastRun = g_discoveryRun - getU16(fixed + 5);  // Keeps the eviction order
+  if (kind == DiscoveryKnowledgeKind::FAN) {
+    entry->modelType = static_cast<FanModelType>(extra[0]);
+    memcpy(entry->token, extra + 1, 16);
+  } else if (kind == DiscoveryKnowledgeKind::NO_TOKEN) {
+    entry->tokenSetHash = getU32(extra);
+    entry->skips = extra[4];
+  }
+  return true;
+}
+
+}  // namespace
+
+// =========================
+// Fan Table Snapshot API
+// =========================
+
+size_t SmartMiFanAsync_serializeFans(uint8_t *out, size_t cap) {
+  return serializeSnapshot(out, cap, false);
+}
+
+bool SmartMiFanAsync_deserializeFans(const uint8_t *data, size_t len) {
+  return deserializeSnapshot(data, len, 0);
+}
+
+bool SmartMiFanAsync_saveFans(SmartMiFanStorage &storage) {
+  size_t len = SmartMiFanAsync_serializeFans(g_snapshotBuffer, sizeof(g_snapshotBuffer));
+  if (len == 0) return false;
+  return storage.write(g_snapshotBuffer, len);
+}
+
+bool SmartMiFanAsync_restoreFans(SmartMiFanStorage &storage) {
+  size_t len = storage.read(g_snapshotBuffer, sizeof(g_snapshotBuffer));
+  if (len == 0) return false;
+  return SmartMiFanAsync_deserializeFans(g_snapshotBuffer, len);
+}
+
+size_t SmartMiFanAsync_saveSleepSnapshot(uint8_t *out, size_t cap) {
+  return serializeSnapshot(out, cap, true);
+}
+
+bool SmartMiFanAsync_resumeFromSleep(const uint8_t *data, size_t len, uint32_t sleptMs) {
+  return deserializeSnapshot(data, len, sleptMs);
+}
+
+// =========================
+// Discovery Knowledge Cache Snapshot API
+// =========================
+
+size_t SmartMiFanAsync_serializeDiscoveryCache(uint8_t *out, size_t cap) {
+  uint8_t record[kKnowledgeRecordMaxLen];
+  size_t total = kSnapshotHeaderLen + 4;
+  size_t stored = 0;
+  for (size_t i = 0; i < SMART_MI_FAN_DISCOVERY_CACHE_SIZE; ++i) {
+    if (g_discoveryKnowledge[i].kind == DiscoveryKnowledgeKind::EMPTY) continue;
+    total += serializeKnowledge(g_discoveryKnowledge[i], record);
+    stored++;
+  }
+  if (!out) return total;
+  if (cap < total) return 0;
+
+  putU32(out, kKnowledgeMagic);
+  out[4] = kKnowledgeVersion;
+  out[5] = 0;
+  putU16(out + 6, static_cast<uint16_t>(stored));
+  size_t pos = kSnapshotHeaderLen;
+  for (size_t i = 0; i < SMART_MI_FAN_DISCOVERY_CACHE_SIZE; ++i) {
+    if (g_discoveryKnowledge[i].kind == DiscoveryKnowledgeKind::EMPTY) continue;
+    pos += serializeKnowledge(g_discoveryKnowledge[i], out + pos);
+  }
+  putU32(out + pos, snapshotChecksum(out, pos));
+  return total;
+}
+
+bool SmartMiFanAsync_deserializeDiscoveryCache(const uint8_t *data, size_t len) {
+  // A running discovery reads and updates the cache
+  if (SmartMiFanAsync_isDiscoveryInProgress()) return false;
+  if (!data || len < kSnapshotHeaderLen + 4) return false;
+  if (getU32(data) != kKnowledgeMagic) return false;
+  if (data[4] != kKnowledgeVersion) {
+    FAN_LOGW_F("Discovery cache version %u not supported (expected %u)", (unsigned)data[4],
+               (unsigned)kKnowledgeVersion);
+    return false;
+  }
+  size_t entryCount = getU16(data + 6);
+  if (entryCount > SMART_MI_FAN_DISCOVERY_CACHE_SIZE) return false;
+  if (getU32(data + len - 4) != snapshotChecksum(data, len - 4)) {
+    FAN_LOGW_F("Discovery cache checksum mismatch, ignoring it");
+    return false;
+  }
+
+  // Validate every record before the current cache is touched
+  SnapshotReader reader{data + kSnapshotHeaderLen, data + len - 4};
+  for (size_t i = 0; i < entryCount; ++i) {
+    if (!deserializeKnowledge(reader, nullptr)) return false;
+  }
+  if (reader.pos != reader.end) return false;
+
+  SmartMiFanAsync_clearDiscoveryCache();
+  reader.pos = data + kSnapshotHeaderLen;
+  for (size_t i = 0; i < entryCount; ++i) {
+    deserializeKnowledge(reader, &g_discoveryKnowledge[i]);
+  }
+  FAN_LOGI_F("Restored %u discovery cache entries", (unsigned)entryCount);
+  return true;
+}
+
+bool SmartMiFanAsync_saveDiscoveryCache(SmartMiFanStorage &storage) {
+  size_t len = SmartMiFanAsync_serializeDiscoveryCache(g_snapshotBuffer, sizeof(g_snapshotBuffer));
+  if (len == 0) return false;
+  return storage.write(g_snapshotBuffer, len);
+}
+
+bool SmartMiFanAsync_restoreDiscoveryCache(SmartMiFanStorage &storage) {
+  size_t len = storage.read(g_snapshotBuffer, sizeof(g_snapshotBuffer));
+  if (len == 0) return false;
+  return SmartMiFanAsync_deserializeDiscoveryCache(g_snapshotBuffer, len);
+}